@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <vector>
+
+#include <glm/ext/vector_float2.hpp>
+#include <glm/ext/vector_float3.hpp>
+
+#include "raycast.hpp"
+
+// Times the library on procedural worlds that stress one thing each, so
+// changes can be compared by running it before and after
+// Usage: raycast-benchmark [--frames n] [--rays n] [--threads n] [scenario...]
+
+namespace
+{
+  // Every allocation made through new, so frames that allocate show up
+  std::atomic<uint64_t> allocations{0};
+}
+
+void* operator new(size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* memory = std::malloc(size ? size : 1))
+  {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+  std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+  std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+  std::free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+  std::free(memory);
+}
+
+namespace
+{
+  using Clock = std::chrono::steady_clock;
+
+  uint8_t checkerData[64*64*4];
+
+  pf::Texture checker()
+  {
+    pf::Texture texture;
+    texture.width = 64;
+    texture.height = 64;
+    texture.channels = 4;
+    texture.data = checkerData;
+    return texture;
+  }
+
+  // A backend that draws nothing, so only the library's own work is timed
+  void nullRect(const glm::vec4&, glm::vec2, glm::vec2) {}
+  void nullTextureRect(const pf::Texture&, glm::vec2, glm::vec2, glm::vec2, glm::vec2, float) {}
+  void nullTextureQuad(const pf::Texture&, glm::vec2, glm::vec2, glm::vec2, glm::vec2, glm::vec2, glm::vec2, glm::vec2, glm::vec2, float) {}
+
+  pf::Wall filledWall(glm::vec4 color = glm::vec4(1.0f), float reflection = 0.0f)
+  {
+    pf::Wall wall(pf::Wall::Filled);
+    pf::Wall::ColorData colorData;
+    colorData.color = color;
+    colorData.texture = checker();
+    colorData.reflection = reflection;
+    wall.colorData.push_back(colorData);
+    return wall;
+  }
+
+  void border(pf::RaycastCamera& camera, uint32_t size, const pf::Wall& wall)
+  {
+    for (uint32_t i = 0; i < size; i++)
+    {
+      camera.wall(glm::uvec2(i, 0)) = wall;
+      camera.wall(glm::uvec2(i, size - 1)) = wall;
+      camera.wall(glm::uvec2(0, i)) = wall;
+      camera.wall(glm::uvec2(size - 1, i)) = wall;
+    }
+  }
+
+  // Corridors one tile wide everywhere, so every ray stops within a few tiles
+  // but no two neighbouring columns hit the same face for long
+  void buildMaze(pf::RaycastCamera& camera, std::mt19937& random)
+  {
+    const uint32_t size = 255;
+    camera.resizeWorld(glm::uvec2(size));
+    pf::Wall wall = filledWall();
+    for (uint32_t y = 0; y < size; y++)
+    {
+      for (uint32_t x = 0; x < size; x++)
+      {
+        camera.wall(glm::uvec2(x, y)) = wall;
+      }
+    }
+
+    // Carve passages between the odd cells, depth first
+    std::vector<glm::ivec2> path = {glm::ivec2(1)};
+    std::vector<uint8_t> visited(size*size, false);
+    visited[size + 1] = true;
+    camera.wall(glm::uvec2(1)) = pf::Wall();
+    const glm::ivec2 steps[4] = {glm::ivec2(2, 0), glm::ivec2(-2, 0), glm::ivec2(0, 2), glm::ivec2(0, -2)};
+    while (!path.empty())
+    {
+      glm::ivec2 cell = path.back();
+      glm::ivec2 options[4];
+      uint32_t optionCount = 0;
+      for (glm::ivec2 step: steps)
+      {
+        glm::ivec2 next = cell + step;
+        if (next.x > 0 && next.x < int(size) - 1 && next.y > 0 && next.y < int(size) - 1 && !visited[next.y*size + next.x])
+        {
+          options[optionCount++] = next;
+        }
+      }
+
+      if (optionCount == 0)
+      {
+        path.pop_back();
+        continue;
+      }
+
+      glm::ivec2 next = options[random() % optionCount];
+      visited[next.y*size + next.x] = true;
+      camera.wall(glm::uvec2((cell + next) / 2)) = pf::Wall();
+      camera.wall(glm::uvec2(next)) = pf::Wall();
+      path.push_back(next);
+    }
+
+    camera.pos = glm::vec3(size/2 + 0.5f, size/2 + 0.5f, 0.5f);
+    camera.renderDistance = 256;
+  }
+
+  // A huge, nearly empty world seen to its far side
+  void buildField(pf::RaycastCamera& camera, std::mt19937& random)
+  {
+    const uint32_t size = 2048;
+    camera.resizeWorld(glm::uvec2(size));
+    pf::Wall pillar = filledWall();
+    for (uint32_t y = 0; y < size; y++)
+    {
+      for (uint32_t x = 0; x < size; x++)
+      {
+        if (random() % 1000 == 0)
+        {
+          camera.wall(glm::uvec2(x, y)) = pillar;
+        }
+      }
+    }
+    border(camera, size, pillar);
+
+    camera.pos = glm::vec3(size/2 + 0.5f, size/2 + 0.5f, 0.5f);
+    camera.renderDistance = size * 2;
+  }
+
+  // Rows of glass inside a hall of mirrors, so rays keep going until maxRayHits
+  void buildGlass(pf::RaycastCamera& camera, std::mt19937& random)
+  {
+    const uint32_t size = 128;
+    camera.resizeWorld(glm::uvec2(size));
+    pf::Wall glass = filledWall(glm::vec4(0.6f, 0.8f, 1.0f, 0.3f));
+    pf::Wall mirror = filledWall(glm::vec4(1.0f), 0.8f);
+    for (uint32_t y = 4; y < size - 4; y += 6)
+    {
+      for (uint32_t x = 2; x < size - 2; x++)
+      {
+        if (random() % 4 != 0)
+        {
+          camera.wall(glm::uvec2(x, y)) = random() % 8 == 0 ? mirror : glass;
+        }
+      }
+    }
+    border(camera, size, mirror);
+
+    camera.pos = glm::vec3(size/2 + 0.5f, size/2 + 2.5f, 0.5f);
+    camera.renderDistance = 512;
+    camera.maxRayHits = 64;
+  }
+
+  // Most tiles made of edges, each of which every ray through the tile tests
+  void buildShapes(pf::RaycastCamera& camera, std::mt19937& random)
+  {
+    const uint32_t size = 256;
+    camera.resizeWorld(glm::uvec2(size));
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (uint32_t y = 1; y < size - 1; y++)
+    {
+      for (uint32_t x = 1; x < size - 1; x++)
+      {
+        uint32_t kind = random() % 10;
+        if (kind >= 5 || (x > size/2 - 3 && x < size/2 + 3 && y > size/2 - 3 && y < size/2 + 3))
+        {
+          continue;
+        }
+
+        pf::Wall wall = filledWall();
+        wall.fillState = kind < 3 ? pf::Wall::Shape : kind < 4 ? pf::Wall::Strip : pf::Wall::Segments;
+        uint32_t corners = 6 + random() % 11;
+        for (uint32_t c = 0; c < corners; c++)
+        {
+          float angle = 6.2831853f * c / corners;
+          float radius = 0.15f + 0.3f * unit(random);
+          wall.positionData.emplace_back(0.5f + radius * std::cos(angle), 0.5f + radius * std::sin(angle));
+        }
+        camera.wall(glm::uvec2(x, y)) = wall;
+      }
+    }
+    border(camera, size, filledWall());
+
+    camera.pos = glm::vec3(size/2 + 0.5f, size/2 + 0.5f, 0.5f);
+    camera.renderDistance = 512;
+  }
+
+  // A plain room full of sprites, which all have to be projected and sorted
+  void buildSprites(pf::RaycastCamera& camera, std::mt19937&)
+  {
+    const uint32_t size = 128;
+    camera.resizeWorld(glm::uvec2(size));
+    border(camera, size, filledWall());
+
+    camera.pos = glm::vec3(size/2 + 0.5f, size/2 + 0.5f, 0.5f);
+    camera.renderDistance = 256;
+  }
+
+  struct Scenario
+  {
+    const char* name;
+    void (*build)(pf::RaycastCamera& camera, std::mt19937& random);
+    // Sprites submitted every frame
+    uint32_t sprites;
+  };
+
+  const Scenario scenarios[] = {
+    {"maze", buildMaze, 0},
+    {"field", buildField, 0},
+    {"glass", buildGlass, 0},
+    {"shapes", buildShapes, 0},
+    {"sprites", buildSprites, 4096},
+  };
+
+  struct Settings
+  {
+    uint32_t frames = 200;
+    uint32_t rays = 200000;
+    uint32_t threads = 1;
+  };
+
+  // Value below which fraction of the sorted values are
+  double percentile(const std::vector<double>& sorted, double fraction)
+  {
+    if (sorted.empty())
+    {
+      return 0.0;
+    }
+    return sorted[std::min<size_t>(sorted.size() - 1, size_t(fraction * sorted.size()))];
+  }
+
+  void printTimes(const char* label, std::vector<double>& times)
+  {
+    std::sort(times.begin(), times.end());
+    std::printf("  %-8s p50 %8.3f ms  p90 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n", label,
+      percentile(times, 0.5), percentile(times, 0.9), percentile(times, 0.99), times.empty() ? 0.0 : times.back());
+  }
+
+  void run(const Scenario& scenario, const Settings& settings)
+  {
+    pf::RaycastCamera camera;
+    camera.drawRect = nullRect;
+    camera.drawTextureRect = nullTextureRect;
+    camera.drawTextureQuad = nullTextureQuad;
+    camera.res = glm::uvec2(1280, 720);
+    camera.renderThreads = settings.threads;
+
+    std::mt19937 random(1);
+    scenario.build(camera, random);
+    std::printf("%s\n", scenario.name);
+
+    // castRay() in every direction from the camera
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<glm::vec2> rayDirs(settings.rays);
+    for (glm::vec2& rayDir: rayDirs)
+    {
+      float angle = 6.2831853f * unit(random);
+      rayDir = glm::vec2(std::cos(angle), std::sin(angle));
+    }
+    std::vector<pf::RayCastData> hits(camera.maxRayHits);
+    glm::vec2 rayStart(camera.pos.x, camera.pos.y);
+    camera.getWorld();
+
+    uint64_t hitCount = 0;
+    Clock::time_point start = Clock::now();
+    for (glm::vec2 rayDir: rayDirs)
+    {
+      hitCount += camera.castRay(rayStart, rayDir, hits.data(), hits.size());
+    }
+    double castSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::printf("  castRay  %8.2f Mrays/s  %6.2f hits/ray\n", settings.rays / castSeconds / 1e6, double(hitCount) / settings.rays);
+
+    // update() while turning, so the columns are cast again every frame
+    std::vector<glm::vec3> spritePositions(scenario.sprites);
+    glm::uvec2 worldSize = camera.getWorld().size();
+    for (glm::vec3& spritePos: spritePositions)
+    {
+      spritePos = glm::vec3(1.0f + unit(random) * (worldSize.x - 2), 1.0f + unit(random) * (worldSize.y - 2), 0.5f);
+    }
+    pf::Texture spriteTex = checker();
+
+    const uint32_t warmupFrames = 5;
+    std::vector<double> frameTimes;
+    std::vector<double> wallTimes;
+    uint64_t frameAllocations = 0;
+    uint64_t maxFrameAllocations = 0;
+    for (uint32_t frame = 0; frame < warmupFrames + settings.frames; frame++)
+    {
+      uint64_t allocationsBefore = allocations.load(std::memory_order_relaxed);
+      start = Clock::now();
+
+      for (const glm::vec3& spritePos: spritePositions)
+      {
+        camera.sprite(spriteTex, spritePos, glm::vec2(0.5f));
+      }
+      camera.update();
+
+      double frameTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+      uint64_t allocated = allocations.load(std::memory_order_relaxed) - allocationsBefore;
+      camera.rotate(0.01f);
+
+      if (frame >= warmupFrames)
+      {
+        frameTimes.push_back(frameTime);
+        wallTimes.push_back(camera.getStats().wallsMs);
+        frameAllocations += allocated;
+        maxFrameAllocations = std::max(maxFrameAllocations, allocated);
+      }
+    }
+
+    double frameSeconds = 0.0;
+    for (double frameTime: frameTimes)
+    {
+      frameSeconds += frameTime / 1000.0;
+    }
+    printTimes("update", frameTimes);
+#ifdef RAYCAST_STATS
+    printTimes("walls", wallTimes);
+#else
+    std::printf("  walls    timed when built with RAYCAST_STATS\n");
+#endif
+    std::printf("  columns  %8.2f Mrays/s  allocations %.1f per frame, %llu at most\n",
+      double(camera.res.x) * settings.frames / frameSeconds / 1e6, double(frameAllocations) / settings.frames, (unsigned long long)maxFrameAllocations);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  for (size_t i = 0; i < sizeof(checkerData); i++)
+  {
+    uint32_t texel = i / 4;
+    checkerData[i] = ((texel % 64) / 8 + (texel / 64) / 8) % 2 ? 220 : 60;
+  }
+
+  Settings settings;
+  std::vector<const char*> chosen;
+  for (int arg = 1; arg < argc; arg++)
+  {
+    uint32_t* setting = nullptr;
+    if (std::strcmp(argv[arg], "--frames") == 0)
+    {
+      setting = &settings.frames;
+    } else if (std::strcmp(argv[arg], "--rays") == 0)
+    {
+      setting = &settings.rays;
+    } else if (std::strcmp(argv[arg], "--threads") == 0)
+    {
+      setting = &settings.threads;
+    }
+
+    if (setting)
+    {
+      if (arg + 1 >= argc)
+      {
+        std::fprintf(stderr, "%s needs a value\n", argv[arg]);
+        return 1;
+      }
+      *setting = std::strtoul(argv[++arg], nullptr, 10);
+    } else
+    {
+      chosen.push_back(argv[arg]);
+    }
+  }
+  settings.frames = std::max(settings.frames, 1u);
+  settings.rays = std::max(settings.rays, 1u);
+
+  for (const char* name: chosen)
+  {
+    if (std::none_of(std::begin(scenarios), std::end(scenarios), [&](const Scenario& scenario) { return std::strcmp(scenario.name, name) == 0; }))
+    {
+      std::fprintf(stderr, "unknown scenario %s, pick from maze, field, glass, shapes and sprites\n", name);
+      return 1;
+    }
+  }
+
+  for (const Scenario& scenario: scenarios)
+  {
+    if (chosen.empty() || std::any_of(chosen.begin(), chosen.end(), [&](const char* name) { return std::strcmp(scenario.name, name) == 0; }))
+    {
+      run(scenario, settings);
+    }
+  }
+}
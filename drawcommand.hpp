@@ -0,0 +1,50 @@
+#ifndef RAYCAST_DRAW_COMMAND_HPP
+#define RAYCAST_DRAW_COMMAND_HPP
+
+#include <glm/ext/vector_float2.hpp>
+#include <glm/ext/vector_float4.hpp>
+#include "texture.hpp"
+
+namespace pf
+{
+  // One primitive of a frame, in the order it has to be drawn
+  struct DrawCommand
+  {
+    enum Type
+    {
+      // Solid color rectangle between pos[0] and pos[1]
+      Rect,
+
+      // tex mapped from tPos[0] to tPos[1] onto the rectangle between pos[0] and pos[1]
+      TextureRect,
+
+      // tex mapped onto the quad pos[0..3], with tPos[n] at pos[n]
+      // Quads whose corners are at different depths are walls, with pos[0] and
+      // pos[3] on the left edge and pos[1] and pos[2] on the right edge
+      TextureQuad
+    } type = Rect;
+
+    Texture tex;
+
+    // tex transposed, so texel (x, y) of tex is texel (y, x) of it, for drawing
+    // walls down their columns
+    // Only set by cameras with mipmapTextures, and then only on walls and sprites
+    Texture columnTex;
+
+    // Fill color for Rect, textured commands are multiplied by it
+    glm::vec4 color = glm::vec4(1.0f);
+
+    glm::vec2 pos[4];
+    glm::vec2 tPos[4];
+
+    // Distance of each corner of a TextureQuad from the camera
+    // Interpolating tPos[n] / depth[n] and 1 / depth[n] and dividing them maps
+    // the texture with perspective
+    float depth[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+
+    // Distance from the camera, INFINITY for the sky
+    float dis = 0.0f;
+  };
+}
+
+#endif // RAYCAST_DRAW_COMMAND_HPP
@@ -0,0 +1,116 @@
+#ifndef RAYCAST_FRAME_STATS_HPP
+#define RAYCAST_FRAME_STATS_HPP
+
+#include <cstdint>
+
+// Counting and timing only happen when built with RAYCAST_STATS defined (the
+// RAYCAST_STATS CMake option), otherwise it all compiles to nothing and the
+// stats stay zero
+#ifdef RAYCAST_STATS
+#include <chrono>
+#endif
+
+namespace pf
+{
+  // Work done by a RayCaster
+  struct RayStats
+  {
+    // Traversals started, one per ray and one more each time a ray carries on
+    // past a see through or reflective surface
+    uint64_t casts = 0;
+    // Of those, the ones carrying on past a surface
+    uint64_t childCasts = 0;
+    // Tiles visited one at a time
+    uint64_t steps = 0;
+    // Empty squares of tiles crossed at once
+    uint64_t emptySkips = 0;
+
+    void add(const RayStats& other)
+    {
+      casts += other.casts;
+      childCasts += other.childCasts;
+      steps += other.steps;
+      emptySkips += other.emptySkips;
+    }
+  };
+
+  // Work done by the last frame a RaycastCamera drew
+  struct FrameStats
+  {
+    RayStats rays;
+
+    // Screen columns, and the ones whose rays were cast rather than reused
+    uint32_t columns = 0;
+    uint32_t columnsCast = 0;
+    // Of the columns cast, the ones interpolated from their neighbours instead,
+    // see RaycastCamera::columnStride
+    uint32_t columnsInterpolated = 0;
+
+    // Sprites queued through sprites() that were outside the view or hidden
+    // behind walls, and the draws the rest were cut into
+    uint32_t spritesCulled = 0;
+    uint32_t spriteSlices = 0;
+
+    // Draws sorted by distance
+    uint32_t sortedDraws = 0;
+    // Callback calls, or commands when building a batch
+    uint32_t drawCalls = 0;
+
+    // Time spent in each phase of the frame, in milliseconds
+    double wallsMs = 0.0;
+    double sortMs = 0.0;
+    double skyMs = 0.0;
+    double floorsAndCeilingsMs = 0.0;
+    // Turning the draws into commands for drawBatch, and grouping those by texture
+    double buildMs = 0.0;
+    double groupMs = 0.0;
+    // Handing the draws to the callbacks or the commands to drawBatch
+    double submitMs = 0.0;
+  };
+
+#ifdef RAYCAST_STATS
+  // Adds the time until it goes out of scope to milliseconds, reporting the
+  // phase to the trace callbacks, if set, around it
+  class PhaseTimer
+  {
+    public:
+      PhaseTimer(const char* phase, double& milliseconds, void (*traceBegin)(const char* phase), void (*traceEnd)(const char* phase)) :
+      phase{phase}, milliseconds{milliseconds}, traceEnd{traceEnd}
+      {
+        if (traceBegin)
+        {
+          traceBegin(phase);
+        }
+        start = std::chrono::steady_clock::now();
+      }
+
+      ~PhaseTimer()
+      {
+        milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (traceEnd)
+        {
+          traceEnd(phase);
+        }
+      }
+
+      PhaseTimer(const PhaseTimer&) = delete;
+      PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    private:
+      const char* phase;
+      double& milliseconds;
+      void (*traceEnd)(const char* phase);
+      std::chrono::steady_clock::time_point start;
+  };
+
+// Statements that only count
+#define RAYCAST_STAT(...) __VA_ARGS__
+// Times the rest of the scope into milliseconds, within RaycastCamera
+#define RAYCAST_PHASE(phase, milliseconds) pf::PhaseTimer phaseTimer(phase, milliseconds, traceBegin, traceEnd)
+#else
+#define RAYCAST_STAT(...)
+#define RAYCAST_PHASE(phase, milliseconds)
+#endif
+}
+
+#endif // RAYCAST_FRAME_STATS_HPP
@@ -17,6 +17,16 @@ namespace pf
       {
       
       }
+
+      bool operator==(const Light& other) const
+      {
+        return color == other.color && pos == other.pos && intensity == other.intensity;
+      }
+
+      bool operator!=(const Light& other) const
+      {
+        return !(*this == other);
+      }
   };
 }
 
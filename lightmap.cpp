@@ -0,0 +1,367 @@
+#include "lightmap.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include "collision-lib/line.hpp"
+
+namespace pf
+{
+  namespace
+  {
+    // Whether the line from start to end crosses any segment of a Segments, Strip or Shape tile
+    bool crossesSegments(const Wall& wall, glm::ivec2 tilePos, glm::vec2 start, glm::vec2 end)
+    {
+      for (uint32_t p = wall.fillState != Wall::Shape ? 1 : 0; p < wall.positionData.size(); p += wall.fillState != Wall::Segments ? 1 : 2)
+      {
+        glm::vec2 pos1;
+        glm::vec2 pos2;
+
+        if (wall.fillState != Wall::Shape)
+        {
+          pos1 = wall.positionData[p-1];
+          pos2 = wall.positionData[p];
+        } else
+        {
+          pos1 = wall.positionData[p];
+          pos2 = wall.positionData[(p+1) % wall.positionData.size()];
+        }
+
+        glm::vec2 hitPoint = pf::lineToLineCollide(start, end, glm::vec2(tilePos) + pos1, glm::vec2(tilePos) + pos2);
+        if (hitPoint == hitPoint)
+        {
+          return true;
+        }
+      }
+
+      return false;
+    }
+  }
+
+  void LightMap::update(const World& world, const std::vector<Light>& lights, bool shadows)
+  {
+    const uint32_t* changedTiles = nullptr;
+    size_t changedCount = 0;
+    bool knownChanges = world.id() == seenWorld && world.changesSince(seenChanges, changedTiles, changedCount);
+    seenChanges = world.changeCount();
+    seenWorld = world.id();
+
+    bool lightsChanged = lights != litLights;
+    bool relight = !knownChanges || shadows != litShadows || world.size() != worldSize || world.origin() != worldOrigin || cellStart.empty();
+    if (relight)
+    {
+      faceSlots.clear();
+      texels.clear();
+      freeSlots.clear();
+    } else if (!faceSlots.empty())
+    {
+      // An edited tile can shadow anything the lights reaching it reach
+      dirtyLights.assign(litLights.size(), false);
+      for (size_t change = 0; change < changedCount; change++)
+      {
+        glm::ivec2 tilePos = world.tilePos(changedTiles[change]);
+        uint32_t cell = cellIndex(tilePos);
+        for (uint32_t l = cellStart[cell]; l < cellStart[cell+1]; l++)
+        {
+          const Light& light = litLights[cellLights[l]];
+          glm::vec2 closest = glm::clamp(light.pos, glm::vec2(tilePos), glm::vec2(tilePos) + 1.0f);
+          if (glm::distance(closest, light.pos) <= lightRanges[cellLights[l]])
+          {
+            dirtyLights[cellLights[l]] = true;
+          }
+        }
+      }
+
+      for (size_t l = 0; l < litLights.size(); l++)
+      {
+        if (dirtyLights[l])
+        {
+          dropFaces(world, litLights[l]);
+        }
+      }
+
+      if (lightsChanged)
+      {
+        for (size_t l = 0; l < glm::max(lights.size(), litLights.size()); l++)
+        {
+          if (l < litLights.size() && (l >= lights.size() || lights[l] != litLights[l]))
+          {
+            dropFaces(world, litLights[l]);
+          }
+          if (l < lights.size() && (l >= litLights.size() || lights[l] != litLights[l]))
+          {
+            dropFaces(world, lights[l]);
+          }
+        }
+      }
+    }
+
+    if (relight || lightsChanged)
+    {
+      litLights = lights;
+      litShadows = shadows;
+      worldSize = world.size();
+      worldOrigin = world.origin();
+      buildCullGrid(world);
+    }
+  }
+
+  void LightMap::clear()
+  {
+    faceSlots.clear();
+    texels.clear();
+    freeSlots.clear();
+
+    litLights.clear();
+    cellStart.clear();
+  }
+
+  glm::vec3 LightMap::faceLight(const World& world, glm::ivec2 tilePos, Face face, float texCoord, std::vector<uint64_t>& misses) const
+  {
+    uint32_t texel = glm::clamp(int(texCoord * faceTexels), 0, int(faceTexels) - 1);
+    uint64_t key = uint64_t(world.tileIndex(tilePos))*4 + face;
+
+    auto slot = faceSlots.find(key);
+    if (slot != faceSlots.end())
+    {
+      return texels[slot->second*faceTexels + texel];
+    }
+
+    misses.push_back(key);
+    return texelLight(world, tilePos, face, texel);
+  }
+
+  glm::vec3 LightMap::pointLight(const World& world, glm::vec2 point, glm::ivec2 tilePos, glm::vec2 normal) const
+  {
+    glm::vec3 light(0.0f);
+    if (!world.contains(tilePos) || cellStart.empty())
+    {
+      return light;
+    }
+
+    // Shadow rays end just inside the tile, so the surface itself doesn't block them
+    glm::vec2 target = point - normal * 0.001f;
+
+    uint32_t cell = cellIndex(tilePos);
+    for (uint32_t l = cellStart[cell]; l < cellStart[cell+1]; l++)
+    {
+      const Light& source = litLights[cellLights[l]];
+      glm::vec2 toLight = source.pos - point;
+      float dis2 = glm::dot(toLight, toLight);
+      float range = lightRanges[cellLights[l]];
+      if (dis2 > range*range || glm::dot(normal, toLight) < 0.0f)
+      {
+        continue;
+      }
+
+      if (litShadows && shadowed(world, source.pos, target, tilePos))
+      {
+        continue;
+      }
+
+      light += glm::vec3(source.color) * (source.intensity / glm::max(dis2, 0.0001f));
+    }
+
+    return glm::min(light, glm::vec3(1.0f));
+  }
+
+  void LightMap::cacheFaces(const World& world, std::vector<uint64_t>& faces, WorkerPool* workers)
+  {
+    std::sort(faces.begin(), faces.end());
+    faces.erase(std::unique(faces.begin(), faces.end()), faces.end());
+
+    // Slots are claimed up front, so the faces can be lit in parallel
+    pendingSlots.clear();
+    for (uint64_t face: faces)
+    {
+      uint32_t slot;
+      if (!freeSlots.empty())
+      {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+      } else
+      {
+        slot = texels.size() / faceTexels;
+        texels.resize(texels.size() + faceTexels);
+      }
+
+      faceSlots.emplace(face, slot);
+      pendingSlots.push_back(slot);
+    }
+
+    auto lightFace = [&](uint32_t face, uint32_t)
+    {
+      glm::ivec2 tilePos = world.tilePos(faces[face] / 4);
+      for (uint32_t texel = 0; texel < faceTexels; texel++)
+      {
+        texels[pendingSlots[face]*faceTexels + texel] = texelLight(world, tilePos, Face(faces[face] % 4), texel);
+      }
+    };
+
+    if (workers && faces.size() > 1)
+    {
+      workers->run(faces.size(), lightFace);
+    } else
+    {
+      for (uint32_t face = 0; face < faces.size(); face++)
+      {
+        lightFace(face, 0);
+      }
+    }
+  }
+
+  // private members
+  glm::vec3 LightMap::texelLight(const World& world, glm::ivec2 tilePos, Face face, uint32_t texel) const
+  {
+    float along = (texel + 0.5f) / faceTexels;
+    glm::vec2 corner(tilePos);
+    switch (face)
+    {
+      case MinY:
+        return pointLight(world, corner + glm::vec2(along, 0.0f), tilePos, glm::vec2(0.0f, -1.0f));
+      case MaxY:
+        return pointLight(world, corner + glm::vec2(along, 1.0f), tilePos, glm::vec2(0.0f, 1.0f));
+      case MinX:
+        return pointLight(world, corner + glm::vec2(0.0f, along), tilePos, glm::vec2(-1.0f, 0.0f));
+      case MaxX:
+        return pointLight(world, corner + glm::vec2(1.0f, along), tilePos, glm::vec2(1.0f, 0.0f));
+    }
+
+    return glm::vec3(0.0f);
+  }
+
+  bool LightMap::shadowed(const World& world, glm::vec2 lightPos, glm::vec2 point, glm::ivec2 targetTile) const
+  {
+    glm::vec2 rayDir = point - lightPos;
+    if (rayDir == glm::vec2(0.0f))
+    {
+      return false;
+    }
+
+    // Same walk as the camera's rays, with the point at distance 1
+    glm::ivec2 tile = glm::floor(lightPos);
+    glm::ivec2 stepDir(rayDir.x < 0.0f ? -1 : 1, rayDir.y < 0.0f ? -1 : 1);
+    glm::vec2 tileDelta = glm::abs(1.0f / rayDir);
+    glm::vec2 edgeDelta(
+      rayDir.x == 0.0f ? INFINITY : (rayDir.x < 0.0f ? lightPos.x - tile.x : tile.x + 1.0f - lightPos.x) * tileDelta.x,
+      rayDir.y == 0.0f ? INFINITY : (rayDir.y < 0.0f ? lightPos.y - tile.y : tile.y + 1.0f - lightPos.y) * tileDelta.y);
+
+    while (tile != targetTile)
+    {
+      if (edgeDelta.x < edgeDelta.y)
+      {
+        if (edgeDelta.x > 1.0f)
+        {
+          break;
+        }
+        edgeDelta.x += tileDelta.x;
+        tile.x += stepDir.x;
+      } else
+      {
+        if (edgeDelta.y > 1.0f)
+        {
+          break;
+        }
+        edgeDelta.y += tileDelta.y;
+        tile.y += stepDir.y;
+      }
+
+      if (tile != targetTile && world.occupied(tile))
+      {
+        const Wall& wall = world.material(world.tileIndex(tile));
+        if (wall.fillState == Wall::Filled || crossesSegments(wall, tile, lightPos, point))
+        {
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  void LightMap::dropFaces(const World& world, const Light& light)
+  {
+    float range = lightRange(light);
+    if (range <= 0.0f || faceSlots.empty())
+    {
+      return;
+    }
+
+    glm::ivec2 minTile = glm::floor(light.pos - range);
+    glm::ivec2 maxTile = glm::floor(light.pos + range);
+    for (auto face = faceSlots.begin(); face != faceSlots.end();)
+    {
+      glm::ivec2 tilePos = world.tilePos(face->first / 4);
+      if (tilePos.x >= minTile.x && tilePos.x <= maxTile.x && tilePos.y >= minTile.y && tilePos.y <= maxTile.y)
+      {
+        freeSlots.push_back(face->second);
+        face = faceSlots.erase(face);
+      } else
+      {
+        face++;
+      }
+    }
+  }
+
+  void LightMap::buildCullGrid(const World& world)
+  {
+    cellsSize = (world.size() + (1u << cellShift) - 1u) >> cellShift;
+    cellStart.assign(cellsSize.x * cellsSize.y + 1, 0);
+
+    lightRanges.resize(litLights.size());
+    lightCells.resize(litLights.size());
+    for (size_t l = 0; l < litLights.size(); l++)
+    {
+      lightRanges[l] = lightRange(litLights[l]);
+
+      // Cells the light's range overlaps, empty when it's out of the world
+      glm::ivec2 minCell = glm::max((glm::ivec2(glm::floor(litLights[l].pos - lightRanges[l])) - worldOrigin) >> int(cellShift), glm::ivec2(0));
+      glm::ivec2 maxCell = glm::min((glm::ivec2(glm::floor(litLights[l].pos + lightRanges[l])) - worldOrigin) >> int(cellShift), glm::ivec2(cellsSize) - 1);
+      if (lightRanges[l] <= 0.0f)
+      {
+        maxCell = minCell - 1;
+      }
+      lightCells[l] = CellRange{minCell, maxCell};
+
+      for (int32_t y = minCell.y; y <= maxCell.y; y++)
+      {
+        for (int32_t x = minCell.x; x <= maxCell.x; x++)
+        {
+          cellStart[y*cellsSize.x + x + 1]++;
+        }
+      }
+    }
+
+    for (size_t cell = 1; cell < cellStart.size(); cell++)
+    {
+      cellStart[cell] += cellStart[cell-1];
+    }
+
+    // Fill each cell from its start, lights stay in order within a cell
+    cellLights.resize(cellStart.back());
+    cellFill.assign(cellStart.begin(), cellStart.end() - 1);
+    for (size_t l = 0; l < litLights.size(); l++)
+    {
+      for (int32_t y = lightCells[l].min.y; y <= lightCells[l].max.y; y++)
+      {
+        for (int32_t x = lightCells[l].min.x; x <= lightCells[l].max.x; x++)
+        {
+          cellLights[cellFill[y*cellsSize.x + x]++] = l;
+        }
+      }
+    }
+  }
+
+  float LightMap::lightRange(const Light& light)
+  {
+    float brightest = glm::max(light.color.r, glm::max(light.color.g, light.color.b));
+    if (light.intensity <= 0.0f || brightest <= 0.0f)
+    {
+      return 0.0f;
+    }
+
+    return std::sqrt(255.0f * light.intensity * brightest);
+  }
+}
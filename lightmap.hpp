@@ -0,0 +1,107 @@
+#ifndef RAYCAST_LIGHT_MAP_HPP
+#define RAYCAST_LIGHT_MAP_HPP
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/ext/vector_float2.hpp>
+#include <glm/ext/vector_float3.hpp>
+#include <glm/ext/vector_int2.hpp>
+#include <glm/ext/vector_uint2.hpp>
+
+#include "light.hpp"
+#include "world.hpp"
+#include "workerpool.hpp"
+
+namespace pf
+{
+  // Light reaching the faces of filled tiles, cached in a few texels per face
+  // A light reaches intensity * color / distance^2, and stops at the distance
+  // where that drops below 1/255
+  // Faces are only relit when a light in range of them changes, or a tile in
+  // range of a light that reaches them is edited
+  class LightMap
+  {
+    public:
+      enum Face
+      {
+        MinY,
+        MaxY,
+        MinX,
+        MaxX
+      };
+
+      // Texels along each face
+      static constexpr uint32_t faceTexels = 8;
+
+      // Drops the faces that changes to lights, shadows or the world since the last
+      // call could have affected
+      void update(const World& world, const std::vector<Light>& lights, bool shadows);
+
+      void clear();
+
+      // Light reaching the texel of a face at texCoord along it
+      // Faces that aren't cached yet are lit directly and appended to misses
+      // Only reads the cache, so render threads can call it together
+      glm::vec3 faceLight(const World& world, glm::ivec2 tilePos, Face face, float texCoord, std::vector<uint64_t>& misses) const;
+
+      // Light reaching a point in tilePos, normal is 0 for surfaces lit from every side
+      // Never cached
+      glm::vec3 pointLight(const World& world, glm::vec2 point, glm::ivec2 tilePos, glm::vec2 normal) const;
+
+      // Lights and caches the faces faceLight() missed, duplicates are fine
+      void cacheFaces(const World& world, std::vector<uint64_t>& faces, WorkerPool* workers);
+
+    private:
+      glm::vec3 texelLight(const World& world, glm::ivec2 tilePos, Face face, uint32_t texel) const;
+
+      // Whether anything but targetTile is in the way from a light to a point in targetTile
+      bool shadowed(const World& world, glm::vec2 lightPos, glm::vec2 point, glm::ivec2 targetTile) const;
+
+      // Drops cached faces of tiles within range of a light
+      void dropFaces(const World& world, const Light& light);
+
+      void buildCullGrid(const World& world);
+
+      uint32_t cellIndex(glm::ivec2 tilePos) const
+      {
+        tilePos = (tilePos - worldOrigin) >> int(cellShift);
+        return tilePos.y*cellsSize.x + tilePos.x;
+      }
+
+      static float lightRange(const Light& light);
+
+      struct CellRange
+      {
+        glm::ivec2 min;
+        glm::ivec2 max;
+      };
+
+      // The lights and settings the cache was lit with
+      std::vector<Light> litLights;
+      std::vector<float> lightRanges;
+      bool litShadows = true;
+      glm::uvec2 worldSize = glm::uvec2(0);
+      glm::ivec2 worldOrigin = glm::ivec2(0);
+      uint64_t seenChanges = 0;
+      uint64_t seenWorld = 0;
+
+      // Lights within range of each 8x8 tile cell, cellStart has one more entry than cells
+      static constexpr uint32_t cellShift = 3;
+      glm::uvec2 cellsSize = glm::uvec2(0);
+      std::vector<uint32_t> cellStart;
+      std::vector<uint32_t> cellLights;
+      std::vector<CellRange> lightCells;
+      std::vector<uint32_t> cellFill;
+      std::vector<uint8_t> dirtyLights;
+
+      // Keyed by tile index * 4 + face, faceTexels texels per slot
+      std::unordered_map<uint64_t, uint32_t> faceSlots;
+      std::vector<glm::vec3> texels;
+      std::vector<uint32_t> freeSlots;
+      std::vector<uint32_t> pendingSlots;
+  };
+}
+
+#endif // RAYCAST_LIGHT_MAP_HPP
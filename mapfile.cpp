@@ -0,0 +1,222 @@
+#include "mapfile.hpp"
+
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "wall.hpp"
+#include "world.hpp"
+
+namespace pf
+{
+  // The records are read in place, so their layout can't change within a version
+  static_assert(sizeof(MapHeader) == 120 && sizeof(MapMaterial) == 56 && sizeof(MapColor) == 24 && sizeof(MapTexture) == 16, "map file layout changed");
+
+  MapFile::~MapFile()
+  {
+    close();
+  }
+
+  bool MapFile::open(const char* path)
+  {
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+      return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    HANDLE fileMapping = nullptr;
+    if (GetFileSizeEx(file, &fileSize) && uint64_t(fileSize.QuadPart) >= sizeof(MapHeader) && uint64_t(fileSize.QuadPart) <= SIZE_MAX)
+    {
+      fileMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    CloseHandle(file);
+    if (!fileMapping)
+    {
+      return false;
+    }
+
+    // The view keeps the mapping alive on its own
+    mapping = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(fileMapping);
+    if (!mapping)
+    {
+      return false;
+    }
+    mappingSize = fileSize.QuadPart;
+#else
+    int file = ::open(path, O_RDONLY);
+    if (file < 0)
+    {
+      return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(file, &fileStat) != 0 || uint64_t(fileStat.st_size) < sizeof(MapHeader) || uint64_t(fileStat.st_size) > SIZE_MAX)
+    {
+      ::close(file);
+      return false;
+    }
+
+    void* fileMapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    ::close(file);
+    if (fileMapping == MAP_FAILED)
+    {
+      return false;
+    }
+    mapping = fileMapping;
+    mappingSize = fileStat.st_size;
+#endif
+
+    if (!view(mapping, mappingSize))
+    {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  bool MapFile::open(const void* mapData, size_t mapSize)
+  {
+    close();
+
+    return view(mapData, mapSize);
+  }
+
+  void MapFile::close()
+  {
+    if (mapping)
+    {
+#ifdef _WIN32
+      UnmapViewOfFile(mapping);
+#else
+      munmap(mapping, mappingSize);
+#endif
+    }
+
+    mapping = nullptr;
+    mappingSize = 0;
+    data = nullptr;
+    dataSize = 0;
+    header = nullptr;
+  }
+
+  uint64_t MapFile::blockMaskBytes(uint32_t sizeX, uint32_t sizeY)
+  {
+    uint64_t blockSize = uint64_t(1) << World::blockShift;
+    return (sizeX + blockSize - 1) / blockSize * ((sizeY + blockSize - 1) / blockSize) * sizeof(uint64_t);
+  }
+
+  uint64_t MapFile::regionMaskBytes(uint32_t sizeX, uint32_t sizeY)
+  {
+    uint64_t regionSize = uint64_t(1) << World::regionShift;
+    return (sizeX + regionSize - 1) / regionSize * ((sizeY + regionSize - 1) / regionSize) * sizeof(uint64_t);
+  }
+
+  // private members
+  bool MapFile::view(const void* mapData, size_t mapSize)
+  {
+    data = static_cast<const uint8_t*>(mapData);
+    dataSize = mapSize;
+    header = reinterpret_cast<const MapHeader*>(data);
+    if (mapSize < sizeof(MapHeader) || reinterpret_cast<uintptr_t>(mapData) % 8 != 0 || !validate())
+    {
+      data = nullptr;
+      dataSize = 0;
+      header = nullptr;
+      return false;
+    }
+    return true;
+  }
+
+  bool MapFile::validate() const
+  {
+    if (std::memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version == 0 || header->version > version ||
+        header->byteOrder != byteOrderMark || header->headerSize < sizeof(MapHeader) || header->fileSize > dataSize)
+    {
+      return false;
+    }
+
+    // Tiles are indexed with 32 bits, and the acceleration grid is aligned to regions
+    uint64_t tiles = uint64_t(header->size[0]) * header->size[1];
+    int32_t regionSize = 1 << World::regionShift;
+    if (tiles > UINT32_MAX || header->origin[0] % regionSize != 0 || header->origin[1] % regionSize != 0)
+    {
+      return false;
+    }
+
+    auto fits = [&](uint64_t offset, uint64_t bytes)
+    {
+      return offset % 8 == 0 && offset >= header->headerSize && offset <= header->fileSize && bytes <= header->fileSize - offset;
+    };
+    if (!fits(header->fillGrid, tiles) ||
+        !fits(header->materialGrid, tiles * sizeof(uint32_t)) ||
+        !fits(header->blockMask, blockMaskBytes(header->size[0], header->size[1])) ||
+        !fits(header->regionMask, regionMaskBytes(header->size[0], header->size[1])) ||
+        !fits(header->materials, uint64_t(header->materialCount) * sizeof(MapMaterial)) ||
+        !fits(header->colors, uint64_t(header->colorCount) * sizeof(MapColor)) ||
+        !fits(header->positions, uint64_t(header->positionCount) * 2 * sizeof(float)) ||
+        !fits(header->textures, uint64_t(header->textureCount) * sizeof(MapTexture)))
+    {
+      return false;
+    }
+
+    auto validTexture = [&](uint32_t texture)
+    {
+      return texture == noTexture || texture < header->textureCount;
+    };
+
+    uint64_t refs = 0;
+    for (uint32_t m = 0; m < header->materialCount; m++)
+    {
+      const MapMaterial& material = materials()[m];
+      if (material.fillState > Wall::Filled ||
+          uint64_t(material.firstColor) + material.colorCount > header->colorCount ||
+          uint64_t(material.firstPosition) + material.positionCount > header->positionCount ||
+          !validTexture(material.floorTexture) || !validTexture(material.ceilingTexture))
+      {
+        return false;
+      }
+      refs += material.refs;
+    }
+    if (refs != tiles)
+    {
+      return false;
+    }
+
+    for (uint32_t c = 0; c < header->colorCount; c++)
+    {
+      if (!validTexture(colors()[c].texture))
+      {
+        return false;
+      }
+    }
+
+    // The grids are copied as they are, so every tile has to use a material in
+    // range, with the same fill state as the material
+    const uint8_t* fills = fillGrid();
+    const uint32_t* tileMaterials = materialGrid();
+    const MapMaterial* records = materials();
+    for (uint64_t tile = 0; tile < tiles; tile++)
+    {
+      if (tileMaterials[tile] >= header->materialCount || fills[tile] != records[tileMaterials[tile]].fillState)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+}
@@ -0,0 +1,181 @@
+#ifndef RAYCAST_MAP_FILE_HPP
+#define RAYCAST_MAP_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pf
+{
+  // Map files hold a World as it is laid out in memory, so loading one copies
+  // whole sections instead of building tiles one by one
+  // Sections start at 8 byte aligned offsets, in the byte order of the machine
+  // that wrote the file
+  struct MapHeader
+  {
+    char magic[4];
+    uint32_t version;
+    // byteOrderMark as written, files from machines of the other byte order don't match
+    uint32_t byteOrder;
+    uint32_t headerSize;
+
+    int32_t origin[2];
+    uint32_t size[2];
+
+    uint32_t materialCount;
+    uint32_t colorCount;
+    uint32_t positionCount;
+    uint32_t textureCount;
+
+    // Byte offsets of the sections from the start of the file
+    // The grids hold a byte fill state and a material index per tile row by row,
+    // the masks are the World's empty space acceleration, which World::load()
+    // builds again from the fill grid
+    uint64_t fillGrid;
+    uint64_t materialGrid;
+    uint64_t blockMask;
+    uint64_t regionMask;
+    uint64_t materials;
+    uint64_t colors;
+    uint64_t positions;
+    uint64_t textures;
+
+    uint64_t fileSize;
+  };
+
+  // A Wall, whose colors and positions are ranges of the shared color and position sections
+  struct MapMaterial
+  {
+    uint32_t fillState;
+    // Tiles using the material, World::load() counts them again from the grid
+    uint32_t refs;
+    uint32_t firstColor;
+    uint32_t colorCount;
+    uint32_t firstPosition;
+    uint32_t positionCount;
+    uint32_t floorTexture;
+    uint32_t ceilingTexture;
+    float fogColor[3];
+    float fogMinStrength;
+    float fogMaxStrength;
+    float fogMaxDistance;
+  };
+
+  struct MapColor
+  {
+    float color[4];
+    float reflection;
+    uint32_t texture;
+  };
+
+  // Textures aren't stored, materials refer to them by their index in the list
+  // of textures the map was saved with, which has to be given back when loading
+  struct MapTexture
+  {
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t padding;
+  };
+
+  // A map file mapped into memory, checked once when opened so the World can
+  // copy its grids as they are
+  class MapFile
+  {
+    public:
+      static constexpr char magic[4] = {'P', 'F', 'R', 'M'};
+      // Files of newer versions are refused
+      static constexpr uint32_t version = 1;
+      static constexpr uint32_t byteOrderMark = 0x01020304;
+      // Texture index of materials without a texture
+      static constexpr uint32_t noTexture = UINT32_MAX;
+
+      MapFile() = default;
+
+      ~MapFile();
+
+      MapFile(const MapFile&) = delete;
+      MapFile& operator=(const MapFile&) = delete;
+
+      // Maps the file at path
+      // Returns false when it can't be read or isn't a valid map
+      bool open(const char* path);
+
+      // Uses a map that is already in memory, which has to stay there while it's open
+      // mapData has to be 8 byte aligned
+      bool open(const void* mapData, size_t mapSize);
+
+      void close();
+
+      bool isOpen() const
+      {
+        return header != nullptr;
+      }
+
+      const MapHeader& getHeader() const
+      {
+        return *header;
+      }
+
+      const uint8_t* fillGrid() const
+      {
+        return data + header->fillGrid;
+      }
+
+      const uint32_t* materialGrid() const
+      {
+        return reinterpret_cast<const uint32_t*>(data + header->materialGrid);
+      }
+
+      const uint64_t* blockMask() const
+      {
+        return reinterpret_cast<const uint64_t*>(data + header->blockMask);
+      }
+
+      const uint64_t* regionMask() const
+      {
+        return reinterpret_cast<const uint64_t*>(data + header->regionMask);
+      }
+
+      const MapMaterial* materials() const
+      {
+        return reinterpret_cast<const MapMaterial*>(data + header->materials);
+      }
+
+      const MapColor* colors() const
+      {
+        return reinterpret_cast<const MapColor*>(data + header->colors);
+      }
+
+      // Two floats per position
+      const float* positions() const
+      {
+        return reinterpret_cast<const float*>(data + header->positions);
+      }
+
+      const MapTexture* textures() const
+      {
+        return reinterpret_cast<const MapTexture*>(data + header->textures);
+      }
+
+      // Section sizes in bytes for a world of the given size
+      static uint64_t blockMaskBytes(uint32_t sizeX, uint32_t sizeY);
+      static uint64_t regionMaskBytes(uint32_t sizeX, uint32_t sizeY);
+
+    private:
+      // Uses mapData without closing the map open before
+      bool view(const void* mapData, size_t mapSize);
+
+      // Whether the header and the sections it points at make a valid map
+      bool validate() const;
+
+      const uint8_t* data = nullptr;
+      size_t dataSize = 0;
+      const MapHeader* header = nullptr;
+
+      // The mapping open(path) made, if any
+      void* mapping = nullptr;
+      size_t mappingSize = 0;
+  };
+}
+
+#endif // RAYCAST_MAP_FILE_HPP
@@ -0,0 +1,262 @@
+#include "pagedworld.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include <glm/common.hpp>
+#include <glm/ext/vector_int2_sized.hpp>
+
+namespace pf
+{
+  void PagedWorld::update(World& world, glm::vec2 focus)
+  {
+    glm::ivec2 focusChunk = chunkOf(glm::ivec2(glm::floor(focus)));
+
+    // Move the world once the chunks to load around the focus would leave it
+    uint32_t sideChunks = loadRadius*2 + 3;
+    glm::ivec2 offset = glm::abs(focusChunk - (firstChunk + int(loadRadius + 1)));
+    if (world.id() != filledWorld || sideChunks != worldChunks || !(unloadedWall == filledUnloaded))
+    {
+      firstChunk = focusChunk - int(loadRadius + 1);
+      worldChunks = sideChunks;
+      world.resize(glm::uvec2(worldChunks * chunkSize), firstChunk * int(chunkSize), unloadedWall);
+      filledWorld = world.id();
+      filledUnloaded = unloadedWall;
+      chunkFilled.assign(worldChunks * worldChunks, false);
+
+      // They're all in the cached chunks the world gets filled from
+      editedTiles.clear();
+    } else if (glm::max(offset.x, offset.y) > 1)
+    {
+      // The chunks the world still covers move along inside it, only those
+      // it newly covers are filled
+      glm::ivec2 newFirstChunk = focusChunk - int(loadRadius + 1);
+      glm::ivec2 moved = newFirstChunk - firstChunk;
+      world.moveOrigin(newFirstChunk * int(chunkSize), unloadedWall);
+      std::vector<uint8_t> movedFilled(worldChunks * worldChunks, false);
+      for (uint32_t y = 0; y < worldChunks; y++)
+      {
+        for (uint32_t x = 0; x < worldChunks; x++)
+        {
+          glm::ivec2 from = glm::ivec2(x, y) + moved;
+          if (from.x >= 0 && uint32_t(from.x) < worldChunks && from.y >= 0 && uint32_t(from.y) < worldChunks)
+          {
+            movedFilled[y*worldChunks + x] = chunkFilled[from.y*worldChunks + from.x];
+          }
+        }
+      }
+      chunkFilled.swap(movedFilled);
+      firstChunk = newFirstChunk;
+      filledWorld = world.id();
+    }
+
+    for (glm::ivec2 tilePos: editedTiles)
+    {
+      glm::ivec2 worldChunk = chunkOf(tilePos) - firstChunk;
+      if (worldChunk.x < 0 || uint32_t(worldChunk.x) >= worldChunks || worldChunk.y < 0 || uint32_t(worldChunk.y) >= worldChunks ||
+          !chunkFilled[worldChunk.y*worldChunks + worldChunk.x])
+      {
+        continue;
+      }
+
+      const Chunk& chunk = chunks.at(chunkKey(chunkOf(tilePos))).chunk;
+      glm::ivec2 inChunk = tilePos & int(chunkSize - 1);
+      world.setWall(glm::uvec2(tilePos - world.origin()), chunk.palette[chunk.tiles[inChunk.y*chunkSize + inChunk.x]]);
+    }
+    editedTiles.clear();
+
+    // Chunks still missing from the world, nearest to the focus first
+    std::vector<std::pair<uint32_t, uint32_t>> missing;
+    for (uint32_t y = 0; y < worldChunks; y++)
+    {
+      for (uint32_t x = 0; x < worldChunks; x++)
+      {
+        if (!chunkFilled[y*worldChunks + x])
+        {
+          glm::ivec2 toFocus = glm::abs(firstChunk + glm::ivec2(x, y) - focusChunk);
+          missing.emplace_back(toFocus.x*toFocus.x + toFocus.y*toFocus.y, y*worldChunks + x);
+        }
+      }
+    }
+    std::sort(missing.begin(), missing.end());
+
+    uint32_t loads = 0;
+    for (const std::pair<uint32_t, uint32_t>& slot: missing)
+    {
+      glm::ivec2 chunkPos = firstChunk + glm::ivec2(slot.second % worldChunks, slot.second / worldChunks);
+      auto cached = chunks.find(chunkKey(chunkPos));
+      if (cached == chunks.end())
+      {
+        if (!loadChunk || loads >= loadsPerUpdate)
+        {
+          continue;
+        }
+        loads++;
+
+        CachedChunk loaded;
+        if (!loadChunk(chunkPos, loaded.chunk) || !compact(loaded.chunk))
+        {
+          continue;
+        }
+        cacheBytes += chunkBytes(loaded.chunk);
+        cached = chunks.emplace(chunkKey(chunkPos), std::move(loaded)).first;
+      }
+
+      fillChunk(world, chunkPos, cached->second.chunk);
+      chunkFilled[slot.second] = true;
+    }
+
+    world.commit();
+    evict(focusChunk);
+  }
+
+  bool PagedWorld::setWall(glm::ivec2 tilePos, const Wall& newWall)
+  {
+    auto cached = chunks.find(chunkKey(chunkOf(tilePos)));
+    if (cached == chunks.end())
+    {
+      return false;
+    }
+
+    Chunk& chunk = cached->second.chunk;
+    cacheBytes -= chunkBytes(chunk);
+
+    // Edits leave unused walls behind, drop them before the palette gets bigger than the chunk
+    if (chunk.palette.size() >= chunkSize*chunkSize)
+    {
+      compact(chunk);
+    }
+    if (chunk.palette.empty())
+    {
+      chunk.palette.emplace_back();
+    }
+    if (chunk.tiles.empty())
+    {
+      chunk.tiles.assign(chunkSize*chunkSize, 0);
+    }
+
+    size_t index = std::find(chunk.palette.begin(), chunk.palette.end(), newWall) - chunk.palette.begin();
+    if (index == chunk.palette.size())
+    {
+      chunk.palette.push_back(newWall);
+    }
+
+    glm::ivec2 inChunk = tilePos & int(chunkSize - 1);
+    chunk.tiles[inChunk.y*chunkSize + inChunk.x] = index;
+
+    cacheBytes += chunkBytes(chunk);
+    cached->second.edited = true;
+    editedTiles.push_back(tilePos);
+    return true;
+  }
+
+  void PagedWorld::clear()
+  {
+    chunks.clear();
+    cacheBytes = 0;
+    filledWorld = 0;
+    editedTiles.clear();
+  }
+
+  // private members
+  bool PagedWorld::compact(Chunk& chunk)
+  {
+    if (chunk.tiles.empty())
+    {
+      if (chunk.palette.size() > 1)
+      {
+        chunk.palette.resize(1);
+      }
+      chunk.palette.shrink_to_fit();
+      return true;
+    }
+
+    if (chunk.tiles.size() != chunkSize*chunkSize)
+    {
+      return false;
+    }
+
+    // Keep the walls in use, in order of first use
+    std::vector<uint32_t> remap(chunk.palette.size(), UINT32_MAX);
+    std::vector<Wall> used;
+    for (uint16_t& tile: chunk.tiles)
+    {
+      if (tile >= chunk.palette.size())
+      {
+        return false;
+      }
+
+      if (remap[tile] == UINT32_MAX)
+      {
+        remap[tile] = used.size();
+        used.push_back(chunk.palette[tile]);
+      }
+      tile = remap[tile];
+    }
+    chunk.palette.swap(used);
+
+    if (chunk.palette.size() == 1)
+    {
+      chunk.tiles.clear();
+      chunk.tiles.shrink_to_fit();
+    }
+    return true;
+  }
+
+  size_t PagedWorld::chunkBytes(const Chunk& chunk)
+  {
+    size_t bytes = sizeof(CachedChunk) + chunk.tiles.capacity() * sizeof(uint16_t) + chunk.palette.capacity() * sizeof(Wall);
+    for (const Wall& wall: chunk.palette)
+    {
+      bytes += wall.colorData.capacity() * sizeof(Wall::ColorData) + wall.positionData.capacity() * sizeof(glm::vec2);
+    }
+    return bytes;
+  }
+
+  void PagedWorld::fillChunk(World& world, glm::ivec2 chunkPos, const Chunk& chunk) const
+  {
+    static const std::vector<Wall> emptyPalette(1);
+    glm::uvec2 corner = glm::uvec2((chunkPos - firstChunk) * int(chunkSize));
+    world.setWalls(corner, glm::uvec2(chunkSize), chunk.palette.empty() ? emptyPalette : chunk.palette, chunk.tiles.empty() ? nullptr : chunk.tiles.data());
+  }
+
+  void PagedWorld::evict(glm::ivec2 focusChunk)
+  {
+    if (cacheBytes <= memoryBudget)
+    {
+      return;
+    }
+
+    std::vector<std::pair<int64_t, uint64_t>> outside;
+    for (const auto& cached: chunks)
+    {
+      glm::ivec2 chunkPos(int32_t(cached.first >> 32), int32_t(uint32_t(cached.first)));
+      glm::ivec2 worldChunk = chunkPos - firstChunk;
+      if (worldChunk.x >= 0 && uint32_t(worldChunk.x) < worldChunks && worldChunk.y >= 0 && uint32_t(worldChunk.y) < worldChunks)
+      {
+        continue;
+      }
+
+      glm::i64vec2 toFocus = glm::i64vec2(chunkPos) - glm::i64vec2(focusChunk);
+      outside.emplace_back(toFocus.x*toFocus.x + toFocus.y*toFocus.y, cached.first);
+    }
+    std::sort(outside.begin(), outside.end(), std::greater<std::pair<int64_t, uint64_t>>());
+
+    for (const std::pair<int64_t, uint64_t>& chunk: outside)
+    {
+      if (cacheBytes <= memoryBudget)
+      {
+        break;
+      }
+
+      auto cached = chunks.find(chunk.second);
+      if (cached->second.edited && saveChunk)
+      {
+        saveChunk(glm::ivec2(int32_t(chunk.second >> 32), int32_t(uint32_t(chunk.second))), cached->second.chunk);
+      }
+      cacheBytes -= chunkBytes(cached->second.chunk);
+      chunks.erase(cached);
+    }
+  }
+}
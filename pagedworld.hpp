@@ -0,0 +1,135 @@
+#ifndef RAYCAST_PAGED_WORLD_HPP
+#define RAYCAST_PAGED_WORLD_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/ext/vector_float2.hpp>
+#include <glm/ext/vector_int2.hpp>
+
+#include "wall.hpp"
+#include "world.hpp"
+
+namespace pf
+{
+  // Maps too large to keep as one World, split into square chunks of tiles
+  // Chunks are loaded on demand around a focus point and streamed into a World
+  // that covers just that area, and moves along with the focus
+  // Loaded chunks stay cached until the cache goes over its memory budget, when
+  // the chunks furthest from the focus are evicted first
+  class PagedWorld
+  {
+    public:
+      // Tiles per side of a chunk, as a power of 2
+      static constexpr uint32_t chunkShift = World::regionShift;
+      static constexpr uint32_t chunkSize = 1u << chunkShift;
+
+      // The tiles of a chunk row by row, as indices into palette
+      // A chunk without tiles is palette[0] all over, or empty without a palette,
+      // which takes no memory for tiles
+      struct Chunk
+      {
+        std::vector<Wall> palette;
+        std::vector<uint16_t> tiles;
+      };
+
+      // Fills chunk with the tiles from chunkPos * chunkSize on
+      // Returns false when the chunk isn't available, it's asked for again by later updates
+      bool (*loadChunk)(glm::ivec2 chunkPos, Chunk& chunk) = nullptr;
+
+      // Given chunks edited through setWall() before they're evicted
+      void (*saveChunk)(glm::ivec2 chunkPos, const Chunk& chunk) = nullptr;
+
+      // Stands in for the tiles of chunks that haven't loaded
+      // Changing it refills the world on the next update()
+      Wall unloadedWall;
+
+      // Chunks around the focus chunk that are loaded into the world in each
+      // direction, so the world reaches at least loadRadius * chunkSize tiles
+      // from the focus and should cover the render distance
+      // Note: Tiles past the world read as empty rather than unloadedWall, so
+      // rays reaching further see through to nothing
+      uint32_t loadRadius = 2;
+
+      // Chunks loaded per update(), nearest first, so streaming doesn't stall a frame
+      uint32_t loadsPerUpdate = 8;
+
+      // Bytes the cached chunks may take, roughly
+      // Chunks in the world are never evicted, so the cache can go over it
+      size_t memoryBudget = size_t(64) << 20;
+
+      // Fills world with the chunks around focus, loading those that aren't cached
+      // The world spans one chunk more than loadRadius on each side, and is
+      // moved when the focus leaves its middle chunks, keeping the chunks it
+      // still covers and filling the rest
+      // Note: Moving the world changes its tile indices and id() like World::moveOrigin()
+      void update(World& world, glm::vec2 focus);
+
+      // Edits a tile of a cached chunk, which reaches the world on the next update()
+      // Edits to the world itself are lost when their chunk leaves it, or when
+      // it moves before they're committed
+      // Returns false when the tile's chunk isn't cached
+      bool setWall(glm::ivec2 tilePos, const Wall& newWall);
+
+      // Drops every cached chunk without saving it, and refills the world on the next update()
+      void clear();
+
+      size_t memoryUsed() const
+      {
+        return cacheBytes;
+      }
+
+      size_t cachedChunks() const
+      {
+        return chunks.size();
+      }
+
+    private:
+      struct CachedChunk
+      {
+        Chunk chunk;
+        bool edited = false;
+      };
+
+      // Drops unused walls from the palette and shrinks uniform chunks down to it
+      // Returns false when the tiles don't fit the chunk or the palette
+      static bool compact(Chunk& chunk);
+
+      static size_t chunkBytes(const Chunk& chunk);
+
+      static uint64_t chunkKey(glm::ivec2 chunkPos)
+      {
+        return uint64_t(uint32_t(chunkPos.x)) << 32 | uint32_t(chunkPos.y);
+      }
+
+      static glm::ivec2 chunkOf(glm::ivec2 tilePos)
+      {
+        return tilePos >> int(chunkShift);
+      }
+
+      // Writes the tiles of a chunk into the world at once
+      void fillChunk(World& world, glm::ivec2 chunkPos, const Chunk& chunk) const;
+
+      // Evicts chunks outside the world, furthest from focusChunk first, until
+      // the cache fits its budget
+      void evict(glm::ivec2 focusChunk);
+
+      std::unordered_map<uint64_t, CachedChunk> chunks;
+      size_t cacheBytes = 0;
+
+      // The world update() filled, its first chunk and its size in chunks
+      uint64_t filledWorld = 0;
+      Wall filledUnloaded;
+      glm::ivec2 firstChunk = glm::ivec2(0);
+      uint32_t worldChunks = 0;
+      // Whether each chunk of the world holds its cached tiles, row by row
+      std::vector<uint8_t> chunkFilled;
+
+      // Tiles setWall() changed since the last update()
+      std::vector<glm::ivec2> editedTiles;
+  };
+}
+
+#endif // RAYCAST_PAGED_WORLD_HPP
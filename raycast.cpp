@@ -1,12 +1,17 @@
 #include "raycast.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstring>
+#include <initializer_list>
+#include <utility>
 #include <glm/geometric.hpp>
 #include <glm/fwd.hpp>
 #include <glm/trigonometric.hpp>
 #include <glm/mat2x2.hpp>
 
-#include "collision-lib/line.hpp"
+#include "simd.hpp"
 
 namespace pf 
 {
@@ -39,495 +44,1644 @@ namespace pf
     skyColor = glm::vec4(1.0f);
   }
 
+  RaycastCamera::~RaycastCamera()
+  {
+    waitFrame();
+  }
+
   // Note: This function will invalidate the current contents of the world
   void RaycastCamera::resizeWorld(glm::uvec2 newSize)
   {
-    wallMapSize = newSize;
-    wallMap.resize(newSize.x * newSize.y);
+    waitFrame();
+
+    world.resize(newSize);
   }
 
   Wall& RaycastCamera::wall(glm::uvec2 wallPos)
   {
-    return wallMap[wallPos.y*wallMapSize.x + wallPos.x];
+    waitFrame();
+
+    return world.wall(wallPos);
   }
 
   const Wall& RaycastCamera::wall(glm::uvec2 wallPos) const
   {
-    return wallMap[wallPos.y*wallMapSize.x + wallPos.x];
+    return world.wall(wallPos);
+  }
+
+  bool RaycastCamera::loadMap(const MapFile& map, const std::vector<Texture>& textures)
+  {
+    waitFrame();
+
+    return world.load(map, textures);
+  }
+
+  void RaycastCamera::clearTextureCache()
+  {
+    waitFrame();
+
+    textureCache.clear();
+  }
+
+  bool RaycastCamera::saveMap(const char* path, const std::vector<Texture>& textures)
+  {
+    waitFrame();
+    viewWorld();
+
+    return viewed().save(path, textures);
   }
 
   void RaycastCamera::sky(float startSky) 
   {
-    if (skyImg.data && drawTextureRect)
+    waitFrame();
+    takeView();
+
+    drawSky(startSky);
+  }
+
+  void RaycastCamera::floorsAndCeilings(float startCeil, float startFloor) 
+  {
+    waitFrame();
+    takeView();
+
+    drawFloorsAndCeilings(startCeil, startFloor);
+  }
+
+  void RaycastCamera::walls() 
+  {
+    waitFrame();
+    takeView();
+
+    castWalls();
+  }
+
+  std::vector<RayCastData> RaycastCamera::castRay(glm::vec2 startPos, glm::vec2 rayDir, float startDis, uint32_t startRenderDis) 
+  {
+    waitFrame();
+    viewWorld();
+
+    RayCaster caster(viewed(), renderDistance, skipEmptySpace, fixedPointRays);
+    std::vector<RayCastData> returnValue;
+
+    do
+    {
+      returnValue.emplace_back();
+    } while (caster.castSegment(startPos, rayDir, startDis, startRenderDis, returnValue.back()));
+
+    return returnValue;
+  }
+
+  uint32_t RaycastCamera::castRay(glm::vec2 startPos, glm::vec2 rayDir, RayCastData* hits, uint32_t maxHits, float startDis, uint32_t startRenderDis)
+  {
+    waitFrame();
+    viewWorld();
+
+    return RayCaster(viewed(), renderDistance, skipEmptySpace, fixedPointRays).castHits(startPos, rayDir, hits, maxHits, startDis, startRenderDis);
+  }
+
+  const World& RaycastCamera::getWorld()
+  {
+    waitFrame();
+    viewWorld();
+
+    return viewed();
+  }
+  void RaycastCamera::sprite(const Texture& spriteTex, const glm::vec3 &spritePos, glm::vec2 spriteSize, glm::vec2 spriteOrigin) 
+  {
+    glm::vec2 tempFront = glm::normalize(front);
+    glm::vec2 tempRight = glm::normalize(right);
+    glm::mat2 inverseCameraProjection = glm::inverse(glm::mat2(tempRight.x, tempFront.x, tempRight.y, tempFront.y));
+
+    glm::vec2 transformedPos = inverseCameraProjection * glm::vec2(spritePos - pos);
+    if (transformedPos.y <= 0.0f) 
+    {
+      return;
+    }
+    transformedPos.x *= glm::length(front) / glm::length(right);
+    //transformedPos.y;
+
+    //glm::vec2 projectedPos(screenSize.x * 0.5f * (transformedPos.x / transformedPos.y + 1.0f), screenSize.y * 0.5f * ((pos.z - spritePos.z) / transformedPos.y + 1.0f) + facing * screenSize.y);
+    glm::vec2 projectedPos(transformedPos.x / transformedPos.y, ((pos.z - spritePos.z) / transformedPos.y) + facing);
+
+    spriteSize = glm::abs(spriteSize / transformedPos.y);
+
+    DrawData sprite;
+    sprite.tex = spriteTex;
+    if (spriteTex.data)
+    {
+      // Untinted, batched and software backends multiply textures by color
+      sprite.color = glm::vec4(1.0f);
+    }
+    sprite.pos1 = projectedPos - spriteSize*spriteOrigin;
+    sprite.pos2 = projectedPos + spriteSize*(1.0f-spriteOrigin);
+    //sprite.setFillColor(sf::Color(glm::min(color.r / transformedPos.y, 255.0f), glm::min(color.g / transformedPos.y, 255.0f), glm::min(color.b / transformedPos.y, 255.0f)));
+    sprite.dis = transformedPos.y;
+    queuedDraws.push_back(sprite);
+  }
+
+  void RaycastCamera::sprites(const SpriteBatch& batch)
+  {
+    SpriteQueue& queue = queuedSprites;
+    queue.x.insert(queue.x.end(), batch.x, batch.x + batch.count);
+    queue.y.insert(queue.y.end(), batch.y, batch.y + batch.count);
+    queue.z.insert(queue.z.end(), batch.z, batch.z + batch.count);
+    for (size_t s = 0; s < batch.count; s++)
+    {
+      queue.width.push_back(glm::abs(batch.width[s]));
+      queue.height.push_back(glm::abs(batch.height[s]));
+      queue.origins.push_back(batch.origins ? batch.origins[s] : glm::vec2(0.5f));
+    }
+    queue.textures.insert(queue.textures.end(), batch.textures, batch.textures + batch.count);
+  }
+
+  void RaycastCamera::rotate(float ang) 
+  {
+    glm::mat2 rotation(glm::cos(ang), glm::sin(ang), -glm::sin(ang), glm::cos(ang));
+
+    front = rotation * front;
+    right = rotation * right;
+  }
+
+  void RaycastCamera::update() 
+  {
+    if (drawBatch)
+    {
+      // Without a frame in flight there's nothing to submit yet
+      if (asyncFrames && !frameWorker.pending)
+      {
+        beginFrame();
+        return;
+      }
+
+      const std::vector<DrawCommand>& commands = buildFrame();
+      if (asyncFrames)
+      {
+        beginFrame();
+      }
+
+      RAYCAST_PHASE("submit", finishedStats.submitMs);
+      drawBatch(commands.data(), commands.size());
+    } else
+    {
+      // Only batched frames are built ahead, a callback can't be called from another thread
+      waitFrame();
+      frameWorker.pending = false;
+
+      startFrame();
+      drawFrame();
+      completeFrame();
+    }
+  }
+
+  void RaycastCamera::beginFrame()
+  {
+    if (frameWorker.pending)
+    {
+      return;
+    }
+
+    // A thread of its own, since building the frame runs tasks on workers
+    if (!frameWorker.thread)
+    {
+      frameWorker.thread = std::make_unique<TaskThread>();
+    }
+
+    startFrame();
+    frameWorker.thread->start([this]()
+    {
+      buildCommands();
+    });
+    frameWorker.pending = true;
+  }
+
+  const std::vector<DrawCommand>& RaycastCamera::buildFrame()
+  {
+    if (frameWorker.pending)
+    {
+      frameWorker.wait();
+      frameWorker.pending = false;
+    } else
+    {
+      startFrame();
+      buildCommands();
+    }
+    completeFrame();
+
+    // The caller's last commands are built into next
+    finishedCommands.swap(frameCommands);
+    return finishedCommands;
+  }
+
+  // private members
+  void RaycastCamera::waitFrame()
+  {
+    frameWorker.wait();
+  }
+
+  RaycastCamera::FrameWorker::FrameWorker(const FrameWorker& other)
+  {
+    other.wait();
+  }
+
+  RaycastCamera::FrameWorker& RaycastCamera::FrameWorker::operator=(const FrameWorker& other)
+  {
+    // The frame this camera began is replaced along with everything else
+    wait();
+    other.wait();
+    pending = false;
+    return *this;
+  }
+
+  void RaycastCamera::FrameWorker::wait() const
+  {
+    if (pending)
+    {
+      thread->wait();
+    }
+  }
+
+  void RaycastCamera::takeView()
+  {
+    viewWorld();
+
+    view.pos = pos;
+    view.front = front;
+    view.right = right;
+    view.facing = facing;
+    view.res = res;
+    view.renderDistance = renderDistance;
+    view.doShadows = doShadows;
+    view.doLighting = doLighting;
+    view.ambientLight = ambientLight;
+    view.renderThreads = renderThreads;
+    view.usePackets = usePackets;
+    view.skipEmptySpace = skipEmptySpace;
+    view.fixedPointRays = fixedPointRays;
+    view.cacheColumns = cacheColumns;
+    view.columnStride = columnStride;
+    view.mergeWallFaces = mergeWallFaces;
+    view.mipmapTextures = mipmapTextures;
+    view.maxRayHits = maxRayHits;
+    view.lights = lights;
+    view.floorImg = floorImg;
+    view.floorColor = floorColor;
+    view.floorScale = floorScale;
+    view.skyImg = skyImg;
+    view.skyColor = skyColor;
+    view.ceilingImg = ceilingImg;
+    view.ceilingColor = ceilingColor;
+    view.ceilingScale = ceilingScale;
+  }
+
+  void RaycastCamera::startFrame()
+  {
+    takeView();
+
+    // The frame takes the sprites queued so far, later ones are for the next frame
+    toDraw.clear();
+    toDraw.swap(queuedDraws);
+    std::swap(frameSprites, queuedSprites);
+  }
+
+  void RaycastCamera::buildCommands()
+  {
+    frameCommands.clear();
+
+    batching = true;
+    drawFrame();
+    batching = false;
+
+    {
+      RAYCAST_PHASE("group", frameStats.groupMs);
+      groupCommands();
+    }
+  }
+
+  void RaycastCamera::completeFrame()
+  {
+    finishedStats = frameStats;
+    adaptColumnStride(frameMs);
+  }
+
+  void RaycastCamera::drawSky(float startSky)
+  {
+    if (view.skyImg.data)
+    {
+      emitTextureRect(view.skyImg, glm::vec4(1.0f), glm::vec2(-1.0f), glm::vec2(1.0f), glm::vec2(std::atan2(-view.front.y, -view.front.x)/M_PI - 1.0f, 0.0f), glm::vec2(std::atan2(-view.front.y, -view.front.x)/M_PI - 0.5f, 1.0f), INFINITY);
+    }
+  }
+
+  void RaycastCamera::drawFloorsAndCeilings(float startCeil, float startFloor)
+  {
+    bool tileFloors = viewed().hasTileFloors();
+
+    if (!view.floorImg.data && !tileFloors) 
+    {
+      emitRect(view.floorColor, glm::vec2(-1.0f, startFloor), glm::vec2(1.0f, 1.0f), 0.0f);
+    } else 
+    {
+      surfaceRows(true, startFloor);
+    }
+
+    if (!view.ceilingImg.data && !tileFloors) 
+    {
+      emitRect(view.ceilingColor, glm::vec2(-1.0f, -1.0f), glm::vec2(1.0f, startCeil), 0.0f);
+    } else 
+    {
+      surfaceRows(false, startCeil);
+    }
+  }
+
+  void RaycastCamera::castWalls()
+  {
+    if (view.doLighting)
+    {
+      lighting.update(viewed(), view.lights, view.doShadows);
+    } else
+    {
+      lighting.clear();
+    }
+
+    float lineWidth = 2.0f/float(view.res.x);
+
+    castStride = 1;
+    while (castStride * 2 <= glm::min(view.columnStride, columnsPerBatch))
+    {
+      castStride *= 2;
+    }
+
+    columns.clear();
+    for (float ray = -1.0f; ray < 1.0f; ray += lineWidth) 
+    {
+      columns.push_back(ray);
+    }
+    wallTops.resize(columns.size());
+    wallBottoms.resize(columns.size());
+    wallDraws.resize(columns.size());
+    occluderDis.resize(columns.size());
+    occluderTops.resize(columns.size());
+    occluderBottoms.resize(columns.size());
+
+    markDirtyColumns();
+    RAYCAST_STAT(
+      frameStats.columns = columns.size();
+      frameStats.columnsCast = std::count(columnDirty.begin(), columnDirty.end(), true);
+    )
+
+    uint32_t batchCount = (columns.size() + columnsPerBatch - 1) / columnsPerBatch;
+    columnBatches.resize(batchCount);
+    batchHits.resize(batchCount);
+
+    uint32_t threadCount = view.renderThreads > 0 ? view.renderThreads : std::thread::hardware_concurrency();
+    if (threadCount > 1)
+    {
+      if (!workers || workers->size() != threadCount)
+      {
+        workers = std::make_shared<WorkerPool>(threadCount);
+      }
+
+      threadScratch.resize(threadCount);
+      workers->run(batchCount, [&](uint32_t batch, uint32_t thread)
+      {
+        columnBatches[batch].clear();
+        wallColumns(batch, lineWidth, threadScratch[thread], columnBatches[batch]);
+      });
+    } else
+    {
+      threadScratch.resize(1);
+      for (uint32_t batch = 0; batch < batchCount; batch++)
+      {
+        columnBatches[batch].clear();
+        wallColumns(batch, lineWidth, threadScratch[0], columnBatches[batch]);
+      }
+    }
+
+    RAYCAST_STAT(
+      for (ThreadScratch& scratch: threadScratch)
+      {
+        frameStats.rays.add(scratch.rayStats);
+        frameStats.columnsInterpolated += scratch.columnsInterpolated;
+        scratch.rayStats = RayStats();
+        scratch.columnsInterpolated = 0;
+      }
+    )
+
+    if (view.doLighting)
+    {
+      // Faces seen for the first time were lit directly, cache them for later frames
+      missedFaces.clear();
+      for (ThreadScratch& scratch: threadScratch)
+      {
+        missedFaces.insert(missedFaces.end(), scratch.lightMisses.begin(), scratch.lightMisses.end());
+        scratch.lightMisses.clear();
+      }
+      lighting.cacheFaces(viewed(), missedFaces, threadCount > 1 ? workers.get() : nullptr);
+    }
+
+    // Before the walls are merged, whose spans are cut around sprites
+    projectSprites(lineWidth);
+
+    if (batching && view.mergeWallFaces)
+    {
+      mergeWalls(lineWidth);
+    } else
+    {
+      for (std::vector<DrawData>& batch: columnBatches)
+      {
+        toDraw.insert(toDraw.end(), batch.begin(), batch.end());
+      }
+    }
+  }
+
+  void RaycastCamera::drawFrame()
+  {
+    RAYCAST_STAT(frameStats = FrameStats();)
+    std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+
+    {
+      RAYCAST_PHASE("walls", frameStats.wallsMs);
+      castWalls();
+    }
+
+    {
+      RAYCAST_PHASE("sort", frameStats.sortMs);
+      RAYCAST_STAT(frameStats.sortedDraws = toDraw.size();)
+      sortDrawQueue();
+    }
+
+    // The sky, floor and ceiling end at the farthest draw they can't be seen through
+    float top = view.facing;
+    float bottom = view.facing;
+    for (const DrawData& drawData: toDraw)
+    {
+      if (opaque(drawData))
+      {
+        top = drawData.pos1.y;
+        bottom = drawData.pos2.y;
+        break;
+      }
+    }
+
+    {
+      RAYCAST_PHASE("sky", frameStats.skyMs);
+      drawSky(top);
+    }
+
+    {
+      RAYCAST_PHASE("floorsAndCeilings", frameStats.floorsAndCeilingsMs);
+      drawFloorsAndCeilings(top, bottom);
+    }
+
+    RAYCAST_PHASE(batching ? "build" : "submit", batching ? frameStats.buildMs : frameStats.submitMs);
+    for (const DrawData& drawData: toDraw)
+    {
+      /*fogShader.setUniform("fogLevel", calculateFogStrength(playerTile, drawData.getScale().x));
+
+      fogShader.setUniform("texture", *drawData.getTexture());*/
+
+      // Walls and sprites are mapped top to bottom, so the level follows how many
+      // texel rows land on each pixel row, which for walls is down to distance
+      // Merged walls go by their nearer end
+      float pixelRows = glm::abs(drawData.pos2.y - drawData.pos1.y);
+      if (drawData.merged)
+      {
+        pixelRows = glm::max(pixelRows, glm::abs(drawData.endY.y - drawData.endY.x));
+      }
+      pixelRows *= view.res.y * 0.5f;
+      float texelRows = glm::abs(drawData.tPos2.y - drawData.tPos1.y) * drawData.tex.height;
+      const Texture* columnTex = nullptr;
+
+      if (drawData.merged)
+      {
+        emitTextureQuad(mipLevel(drawData.tex, texelRows / pixelRows, &columnTex), drawData.color, drawData.pos1, glm::vec2(drawData.pos2.x, drawData.endY.x), glm::vec2(drawData.pos2.x, drawData.endY.y), glm::vec2(drawData.pos1.x, drawData.pos2.y),
+          drawData.tPos1, glm::vec2(drawData.tPos2.x, drawData.tPos1.y), drawData.tPos2, glm::vec2(drawData.tPos1.x, drawData.tPos2.y), drawData.dis,
+          glm::vec4(drawData.edgeDis.x, drawData.edgeDis.y, drawData.edgeDis.y, drawData.edgeDis.x), columnTex);
+      } else if (drawData.tex.data && (batching || drawTextureRect))
+      {
+        const Texture& level = mipLevel(drawData.tex, texelRows / pixelRows, &columnTex);
+        emitTextureRect(level, drawData.color, drawData.pos1, drawData.pos2, drawData.tPos1, drawData.tPos2, drawData.dis, columnTex);
+      } else
+      {
+        emitRect(drawData.color, drawData.pos1, drawData.pos2, drawData.dis);
+      }
+    }
+
+    // Keeps its capacity, so later frames don't allocate
+    toDraw.clear();
+
+    frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+  }
+
+  void RaycastCamera::markDirtyColumns()
+  {
+    const uint32_t* changedTiles = nullptr;
+    size_t changedCount = 0;
+    const World& tiles = viewed();
+    bool knownChanges = tiles.id() == seenWorld && tiles.changesSince(seenChanges, changedTiles, changedCount);
+    seenChanges = tiles.changeCount();
+    seenWorld = tiles.id();
+
+    // Cached hits point into the world they were cast in, a later snapshot of the
+    // same world has the same tiles wherever none of the changes are
+    rebaseHits = castWorld != &tiles;
+    castWorld = &tiles;
+    castSnapshot = snapshot;
+
+    // Hits only depend on where rays start and where they point, not on pos.z or facing
+    glm::vec2 rayStart(view.pos.x, view.pos.y);
+    bool moved = !view.cacheColumns || rayStart != cachedRayStart || view.front != cachedFront || view.right != cachedRight ||
+      view.renderDistance != cachedRenderDistance || view.maxRayHits != cachedMaxRayHits || castStride != cachedColumnStride ||
+      view.fixedPointRays != cachedFixedPoint || columnHitCounts.size() != columns.size();
+    cachedRayStart = rayStart;
+    cachedFront = view.front;
+    cachedRight = view.right;
+    cachedRenderDistance = view.renderDistance;
+    cachedMaxRayHits = view.maxRayHits;
+    cachedColumnStride = castStride;
+    cachedFixedPoint = view.fixedPointRays;
+
+    columnHitStarts.resize(columns.size());
+    columnHitCounts.resize(columns.size());
+    columnReach.resize(columns.size());
+    columnBent.resize(columns.size());
+    if (moved || !knownChanges)
+    {
+      columnDirty.assign(columns.size(), true);
+      return;
+    }
+
+    columnDirty.assign(columns.size(), false);
+    if (changedCount == 0)
+    {
+      return;
+    }
+
+    // Reflected rays can go anywhere, so any edit recasts them
+    for (size_t column = 0; column < columns.size(); column++)
+    {
+      columnDirty[column] = columnBent[column];
+    }
+
+    // A straight ray passes through a tile if its column lies between the tile's
+    // corners, and only matters if the tile starts before the ray's last hit
+    // In camera space, a point is t * (front + right * x)
+    glm::mat2 toCamera = glm::inverse(glm::mat2(view.front.x, view.front.y, view.right.x, view.right.y));
+    for (size_t change = 0; change < changedCount; change++)
+    {
+      glm::vec2 tilePos(tiles.tilePos(changedTiles[change]));
+
+      float nearT = INFINITY;
+      float minX = INFINITY;
+      float maxX = -INFINITY;
+      bool crossesCamera = false;
+      for (int corner = 0; corner < 4; corner++)
+      {
+        glm::vec2 cameraPos = toCamera * (tilePos + glm::vec2(corner & 1, corner >> 1) - rayStart);
+        if (cameraPos.x <= 0.0f)
+        {
+          crossesCamera = true;
+          continue;
+        }
+
+        nearT = glm::min(nearT, cameraPos.x);
+        minX = glm::min(minX, cameraPos.y / cameraPos.x);
+        maxX = glm::max(maxX, cameraPos.y / cameraPos.x);
+      }
+
+      if (crossesCamera)
+      {
+        if (nearT == INFINITY)
+        {
+          // Entirely behind the camera
+          continue;
+        }
+        nearT = 0.0f;
+        minX = -INFINITY;
+        maxX = INFINITY;
+      }
+
+      // One extra column either side covers rounding in the projection
+      size_t first = std::lower_bound(columns.begin(), columns.end(), minX) - columns.begin();
+      size_t end = std::upper_bound(columns.begin(), columns.end(), maxX) - columns.begin();
+      first = first > 0 ? first - 1 : 0;
+      end = glm::min(end + 1, columns.size());
+      for (size_t column = first; column < end; column++)
+      {
+        columnDirty[column] |= nearT <= columnReach[column];
+      }
+    }
+  }
+
+  void RaycastCamera::wallColumns(uint32_t batch, float lineWidth, ThreadScratch& scratch, std::vector<DrawData>& output)
+  {
+    uint32_t firstColumn = batch * columnsPerBatch;
+    uint32_t endColumn = glm::min<uint32_t>(firstColumn + columnsPerBatch, columns.size());
+    uint32_t maxHits = glm::max(view.maxRayHits, 1u);
+
+    bool dirty = false;
+    bool allDirty = true;
+    for (uint32_t column = firstColumn; column < endColumn; column++)
     {
-      drawTextureRect(skyImg, glm::vec2(-1.0f), glm::vec2(1.0f), glm::vec2(std::atan2(-front.y, -front.x)/M_PI - 1.0f, 0.0f), glm::vec2(std::atan2(-front.y, -front.x)/M_PI - 0.5f, 1.0f), 1.0f);
+      dirty |= columnDirty[column];
+      allDirty &= columnDirty[column];
+    }
+
+    std::vector<RayCastData>& hits = batchHits[batch];
+    if (rebaseHits)
+    {
+      const World& tiles = viewed();
+      for (RayCastData& hit: hits)
+      {
+        if (hit.tileHit)
+        {
+          hit.tileHit = &tiles.material(tiles.tileIndex(hit.tileHitPos));
+        }
+      }
+    }
+
+    if (dirty)
+    {
+      // Rebuild the batch's hits, only casting the columns that changed
+      RayCaster caster(viewed(), view.renderDistance, view.skipEmptySpace, view.fixedPointRays);
+      RAYCAST_STAT(caster.setStats(&scratch.rayStats);)
+      std::vector<RayCastData>& rebuilt = scratch.rebuiltHits;
+      rebuilt.clear();
+      scratch.hits.resize(maxHits * simd::packetWidth);
+
+      // Batches with only a few columns to recast are cast column by column
+      uint32_t column = firstColumn;
+      if (castStride > 1 && allDirty)
+      {
+        castSparse(firstColumn, endColumn, caster, scratch, rebuilt);
+        column = endColumn;
+      }
+
+      while (column < endColumn)
+      {
+        if (!columnDirty[column])
+        {
+          uint32_t hitStart = columnHitStarts[column];
+          columnHitStarts[column] = rebuilt.size();
+          rebuilt.insert(rebuilt.end(), hits.begin() + hitStart, hits.begin() + hitStart + columnHitCounts[column]);
+          column++;
+          continue;
+        }
+
+        uint32_t dirtyRun = 1;
+        while (dirtyRun < simd::packetWidth && column + dirtyRun < endColumn && columnDirty[column + dirtyRun])
+        {
+          dirtyRun++;
+        }
+
+        if (view.usePackets && simd::packetWidth > 1 && dirtyRun == simd::packetWidth)
+        {
+          glm::vec2 rayDirs[simd::packetWidth];
+          uint32_t hitCounts[simd::packetWidth];
+          for (uint32_t lane = 0; lane < simd::packetWidth; lane++)
+          {
+            rayDirs[lane] = view.front + view.right * columns[column + lane];
+          }
+
+          caster.castRayPacket(glm::vec2(view.pos.x, view.pos.y), rayDirs, scratch.hits.data(), maxHits, hitCounts);
+
+          for (uint32_t lane = 0; lane < simd::packetWidth; lane++)
+          {
+            storeColumn(column + lane, &scratch.hits[lane * maxHits], hitCounts[lane], rebuilt);
+          }
+          column += simd::packetWidth;
+        } else
+        {
+          glm::vec2 rayDir = view.front + view.right * columns[column];
+
+          uint32_t hitCount = caster.castHits(glm::vec2(view.pos.x, view.pos.y), rayDir, scratch.hits.data(), maxHits);
+          storeColumn(column, scratch.hits.data(), hitCount, rebuilt);
+          column++;
+        }
+      }
+
+      hits.swap(rebuilt);
+    }
+
+    for (uint32_t column = firstColumn; column < endColumn; column++)
+    {
+      size_t firstHit = output.size();
+      projectColumn(columns[column], lineWidth, hits.data() + columnHitStarts[column], columnHitCounts[column], scratch.lightMisses, output);
+      recordExtent(column, output, firstHit);
+    }
+  }
+
+  void RaycastCamera::storeColumn(uint32_t column, const RayCastData* hits, uint32_t hitCount, std::vector<RayCastData>& batchHits)
+  {
+    columnHitStarts[column] = batchHits.size();
+    columnHitCounts[column] = hitCount;
+    batchHits.insert(batchHits.end(), hits, hits + hitCount);
+
+    bool bent = false;
+    for (uint32_t hit = 0; hit + 1 < hitCount; hit++)
+    {
+      bent |= hits[hit].tileHit && hits[hit].tileHit->colorData[hits[hit].surfaceHit].reflection > 0.0f;
+    }
+    columnBent[column] = bent;
+
+    // Past its last hit, nothing the ray could pass through matters
+    // Continued rays start a little past each hit, so allow a tile of slack
+    if (hitCount == 0 || hits[hitCount-1].tileHit == nullptr)
+    {
+      columnReach[column] = INFINITY;
+    } else
+    {
+      columnReach[column] = hits[hitCount-1].dis + 1.0f;
+    }
+  }
+
+  void RaycastCamera::castSparse(uint32_t firstColumn, uint32_t endColumn, RayCaster& caster, ThreadScratch& scratch, std::vector<RayCastData>& batchHits)
+  {
+    uint32_t maxHits = glm::max(view.maxRayHits, 1u);
+
+    // Every castStride-th column and the batch's last one
+    uint32_t anchors[columnsPerBatch + 1];
+    uint32_t anchorCount = 0;
+    for (uint32_t column = firstColumn; column < endColumn; column += castStride)
+    {
+      anchors[anchorCount++] = column;
+    }
+    if (anchors[anchorCount-1] != endColumn - 1)
+    {
+      anchors[anchorCount++] = endColumn - 1;
+    }
+
+    // Packets don't need their rays to be neighbours
+    for (uint32_t anchor = 0; anchor < anchorCount;)
+    {
+      if (view.usePackets && simd::packetWidth > 1 && anchorCount - anchor >= simd::packetWidth)
+      {
+        glm::vec2 rayDirs[simd::packetWidth];
+        uint32_t hitCounts[simd::packetWidth];
+        for (uint32_t lane = 0; lane < simd::packetWidth; lane++)
+        {
+          rayDirs[lane] = view.front + view.right * columns[anchors[anchor + lane]];
+        }
+
+        caster.castRayPacket(glm::vec2(view.pos.x, view.pos.y), rayDirs, scratch.hits.data(), maxHits, hitCounts);
+
+        for (uint32_t lane = 0; lane < simd::packetWidth; lane++)
+        {
+          storeColumn(anchors[anchor + lane], &scratch.hits[lane * maxHits], hitCounts[lane], batchHits);
+        }
+        anchor += simd::packetWidth;
+      } else
+      {
+        glm::vec2 rayDir = view.front + view.right * columns[anchors[anchor]];
+
+        uint32_t hitCount = caster.castHits(glm::vec2(view.pos.x, view.pos.y), rayDir, scratch.hits.data(), maxHits);
+        storeColumn(anchors[anchor], scratch.hits.data(), hitCount, batchHits);
+        anchor++;
+      }
+    }
+
+    for (uint32_t anchor = 0; anchor + 1 < anchorCount; anchor++)
+    {
+      refineColumns(anchors[anchor], anchors[anchor + 1], caster, scratch, batchHits);
+    }
+  }
+
+  void RaycastCamera::refineColumns(uint32_t leftColumn, uint32_t rightColumn, RayCaster& caster, ThreadScratch& scratch, std::vector<RayCastData>& batchHits)
+  {
+    if (rightColumn - leftColumn < 2)
+    {
+      return;
+    }
+
+    if (!columnsMatch(leftColumn, rightColumn, batchHits))
+    {
+      uint32_t middle = (leftColumn + rightColumn) / 2;
+      glm::vec2 rayDir = view.front + view.right * columns[middle];
+
+      uint32_t hitCount = caster.castHits(glm::vec2(view.pos.x, view.pos.y), rayDir, scratch.hits.data(), glm::max(view.maxRayHits, 1u));
+      storeColumn(middle, scratch.hits.data(), hitCount, batchHits);
+
+      refineColumns(leftColumn, middle, caster, scratch, batchHits);
+      refineColumns(middle, rightColumn, caster, scratch, batchHits);
+      return;
+    }
+
+    // On a flat face 1/dis is linear across the screen, and so is anything
+    // linear along the face divided by dis
+    // Reflected hits are too, dis is how far along the unfolded ray they are
+    uint32_t hitCount = columnHitCounts[leftColumn];
+    for (uint32_t column = leftColumn + 1; column < rightColumn; column++)
+    {
+      // Read through indices, storeColumn() may move the hits
+      const RayCastData* leftHits = batchHits.data() + columnHitStarts[leftColumn];
+      const RayCastData* rightHits = batchHits.data() + columnHitStarts[rightColumn];
+      float t = (columns[column] - columns[leftColumn]) / (columns[rightColumn] - columns[leftColumn]);
+
+      for (uint32_t hit = 0; hit < hitCount; hit++)
+      {
+        const RayCastData& leftHit = leftHits[hit];
+        const RayCastData& rightHit = rightHits[hit];
+        RayCastData& interpolated = scratch.hits[hit];
+        interpolated = leftHit;
+        if (leftHit.tileHit == nullptr)
+        {
+          continue;
+        }
+
+        interpolated.dis = 1.0f / glm::mix(1.0f / leftHit.dis, 1.0f / rightHit.dis, t);
+        interpolated.texCoord = glm::mix(leftHit.texCoord / leftHit.dis, rightHit.texCoord / rightHit.dis, t) * interpolated.dis;
+        interpolated.hitPos = glm::mix(leftHit.hitPos / leftHit.dis, rightHit.hitPos / rightHit.dis, t) * interpolated.dis;
+      }
+
+      storeColumn(column, scratch.hits.data(), hitCount, batchHits);
+      RAYCAST_STAT(scratch.columnsInterpolated++;)
+    }
+  }
+
+  bool RaycastCamera::columnsMatch(uint32_t leftColumn, uint32_t rightColumn, const std::vector<RayCastData>& batchHits) const
+  {
+    // Even on one face, a steep jump in depth is likely to hide something between
+    constexpr float maxDepthRatio = 1.25f;
+
+    uint32_t hitCount = columnHitCounts[leftColumn];
+    if (hitCount != columnHitCounts[rightColumn])
+    {
+      return false;
+    }
+
+    const RayCastData* leftHits = batchHits.data() + columnHitStarts[leftColumn];
+    const RayCastData* rightHits = batchHits.data() + columnHitStarts[rightColumn];
+    for (uint32_t hit = 0; hit < hitCount; hit++)
+    {
+      const RayCastData& leftHit = leftHits[hit];
+      const RayCastData& rightHit = rightHits[hit];
+      if (leftHit.tileHit == nullptr || rightHit.tileHit == nullptr)
+      {
+        if (leftHit.tileHit != rightHit.tileHit)
+        {
+          return false;
+        }
+        continue;
+      }
+
+      // Shapes and segments can turn corners within a tile
+      if (leftHit.tileHit != rightHit.tileHit || leftHit.tileHit->fillState != Wall::Filled || leftHit.tileHitPos != rightHit.tileHitPos ||
+          leftHit.verticalHit != rightHit.verticalHit || leftHit.surfaceHit != rightHit.surfaceHit)
+      {
+        return false;
+      }
+
+      if (glm::max(leftHit.dis, rightHit.dis) > glm::min(leftHit.dis, rightHit.dis) * maxDepthRatio)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void RaycastCamera::adaptColumnStride(double frameMs)
+  {
+    if (frameTimeTarget <= 0.0f)
+    {
+      return;
+    }
+
+    if (frameMs > frameTimeTarget && columnStride < maxColumnStride)
+    {
+      columnStride = glm::min(glm::max(columnStride, 1u) * 2, maxColumnStride);
+    } else if (frameMs < frameTimeTarget * 0.5 && columnStride > 1)
+    {
+      columnStride /= 2;
+    }
+  }
+
+  void RaycastCamera::projectColumn(float ray, float lineWidth, const RayCastData* eyeCasts, uint32_t hitCount, std::vector<uint64_t>& lightMisses, std::vector<DrawData>& output)
+  {
+    for (uint32_t hit = 0; hit < hitCount; hit++)
+    {
+      const RayCastData &eyeCast = eyeCasts[hit];
+      if (eyeCast.tileHit == nullptr) 
+      {
+        continue;
+      }
+
+      DrawData scanLine;
+      float centerY = (view.pos.z - 0.5f) * 2.0f / eyeCast.dis + view.facing;
+      float halfSize = 1.0f/eyeCast.dis;
+
+      scanLine.pos1 = glm::vec2(ray, centerY - halfSize);
+      scanLine.pos2 = glm::vec2(ray+lineWidth, centerY + halfSize);
+
+      scanLine.tPos1 = glm::vec2(eyeCast.texCoord, 0.0f);
+      scanLine.tPos2 = glm::vec2(eyeCast.texCoord, 1.0f);
+
+      glm::vec2 relHitPos(eyeCast.hitPos.x - (int)eyeCast.hitPos.x, eyeCast.hitPos.y - (int)eyeCast.hitPos.y);
+      float dis = glm::distance(glm::vec2(view.pos.x, view.pos.y), glm::vec2(eyeCast.hitPos.x, eyeCast.hitPos.y));
+
+      const Wall::ColorData* surfaceHit = &eyeCast.tileHit->colorData[eyeCast.surfaceHit];
+      scanLine.color = surfaceHit->color;
+      scanLine.color.a = glm::min(scanLine.color.a, 1.0f - surfaceHit->reflection);
+      scanLine.tex = surfaceHit->texture;
+      scanLine.dis = eyeCast.dis;
+
+      if (view.doLighting)
+      {
+        // Folded into the color, so backends draw lit walls without extra work
+        glm::vec3 light = glm::min(view.ambientLight + surfaceLight(eyeCast, lightMisses), glm::vec3(1.0f));
+        scanLine.color = glm::vec4(glm::vec3(scanLine.color) * light, scanLine.color.a);
+      }
+
+      output.push_back(scanLine);
+      // lightIntensity += ((rand()%3)-1)*0.001;
     }
   }
 
-  void RaycastCamera::floorsAndCeilings(float startCeil, float startFloor) 
+  void RaycastCamera::mergeWalls(float lineWidth)
   {
-    Wall* playerTile = &wall(glm::uvec2(pos));
-
-    if (!floorImg.data) 
+    // Everything queued before the walls is a sprite
+    spriteNear.assign(columns.size(), INFINITY);
+    spriteFar.assign(columns.size(), -INFINITY);
+    for (const DrawData& sprite: toDraw)
     {
-      if (drawRect)
+      float left = glm::min(sprite.pos1.x, sprite.pos2.x);
+      float right = glm::max(sprite.pos1.x, sprite.pos2.x);
+      int64_t firstColumn = glm::clamp<int64_t>(std::floor((left + 1.0f) / lineWidth), 0, columns.size());
+      int64_t endColumn = glm::clamp<int64_t>(std::ceil((right + 1.0f) / lineWidth), 0, columns.size());
+      for (int64_t column = firstColumn; column < endColumn; column++)
       {
-        drawRect(floorColor, glm::vec2(-1.0f, startFloor), glm::vec2(1.0f, 1.0f));
+        spriteNear[column] = glm::min(spriteNear[column], sprite.dis);
+        spriteFar[column] = glm::max(spriteFar[column], sprite.dis);
       }
-    } else 
+    }
+
+    WallSpan span;
+    for (uint32_t batch = 0; batch < columnBatches.size(); batch++)
     {
-      float step = 2.0f / res.y;
-      float lastDis = (pos.z * 2.0f) / (1.0f+step - facing);
+      const std::vector<DrawData>& draws = columnBatches[batch];
+      const std::vector<RayCastData>& hits = batchHits[batch];
+      uint32_t firstColumn = batch * columnsPerBatch;
+      uint32_t endColumn = glm::min<uint32_t>(firstColumn + columnsPerBatch, columns.size());
 
-      glm::vec2 startDir = front - right;
-      glm::vec2 endDir = front + right;
-      for (float y = 1.0f; y > startFloor; y -= step) 
+      size_t nextDraw = 0;
+      for (uint32_t column = firstColumn; column < endColumn; column++)
       {
-        float dis = (pos.z * 2.0f) / (y - facing);
+        uint32_t wallDraw = wallDraws[column];
+        if (wallDraw == uint32_t(-1))
+        {
+          closeSpan(span, lineWidth);
+          continue;
+        }
+
+        toDraw.insert(toDraw.end(), draws.begin() + nextDraw, draws.begin() + wallDraw);
+        nextDraw = wallDraw + 1;
+
+        // Only the last hit of a column can merge, since nothing else in the
+        // column is behind it
+        const DrawData& draw = draws[wallDraw];
+        const RayCastData& hit = hits[columnHitStarts[column] + columnHitCounts[column] - 1];
+        if (span.open && extendsSpan(span, column, hit, draw))
+        {
+          span.lastColumn = column;
+          span.lastHit = hit;
+          span.nearDis = glm::min(span.nearDis, hit.dis);
+          span.farDis = glm::max(span.farDis, hit.dis);
+          span.spriteNear = glm::min(span.spriteNear, spriteNear[column]);
+          span.spriteFar = glm::max(span.spriteFar, spriteFar[column]);
+          continue;
+        }
 
-        /*scanLine[0].color = sfColor(playerTile->fogColor);
-        scanLine[1].color = scanLine[0].color;
-        scanLine[2].color = scanLine[0].color;
-        scanLine[3].color = scanLine[0].color;*/
+        closeSpan(span, lineWidth);
 
-        if (drawTextureQuad)
+        // Faces seen in a reflection aren't in the camera's perspective
+        if (hit.tileHit && draw.tex.data && !columnBent[column])
         {
-          drawTextureQuad(floorImg, glm::vec2(-1.0f, y), glm::vec2(1.0f, y), glm::vec2(1.0f, y-step), glm::vec2(-1.0f, y-step), glm::vec2(glm::vec2(pos) + startDir*lastDis)/floorScale, glm::vec2(glm::vec2(pos) + endDir*lastDis)/floorScale, glm::vec2(glm::vec2(pos) + endDir*dis)/floorScale, glm::vec2(glm::vec2(pos) + startDir*dis)/floorScale, floorColor.a);
+          span.open = true;
+          span.firstColumn = column;
+          span.lastColumn = column;
+          span.firstHit = hit;
+          span.lastHit = hit;
+          span.draw = draw;
+          span.nearDis = hit.dis;
+          span.farDis = hit.dis;
+          span.spriteNear = spriteNear[column];
+          span.spriteFar = spriteFar[column];
+        } else
+        {
+          toDraw.push_back(draw);
         }
-        lastDis = dis;
       }
     }
 
-    if (!ceilingImg.data) 
+    closeSpan(span, lineWidth);
+  }
+
+  bool RaycastCamera::extendsSpan(const WallSpan& span, uint32_t column, const RayCastData& hit, const DrawData& draw) const
+  {
+    if (column != span.lastColumn + 1 || hit.tileHit == nullptr || columnBent[column])
+    {
+      return false;
+    }
+
+    if (hit.tileHitPos != span.lastHit.tileHitPos || hit.surfaceHit != span.lastHit.surfaceHit || hit.verticalHit != span.lastHit.verticalHit)
+    {
+      return false;
+    }
+
+    // Lighting is folded into the color, so this also cuts where the light changes
+    if (!(draw.tex == span.draw.tex) || draw.color != span.draw.color)
+    {
+      return false;
+    }
+
+    // The texture has to keep moving the same way across the face
+    if ((hit.texCoord - span.lastHit.texCoord) * (span.lastHit.texCoord - span.firstHit.texCoord) < 0.0f)
+    {
+      return false;
+    }
+
+    // The merged wall is sorted by its far end, which is only right for
+    // sprites that are wholly in front of or behind it
+    float nearDis = glm::min(span.nearDis, hit.dis);
+    float farDis = glm::max(span.farDis, hit.dis);
+    float nearSprite = glm::min(span.spriteNear, spriteNear[column]);
+    float farSprite = glm::max(span.spriteFar, spriteFar[column]);
+    return !(nearSprite < farDis && farSprite > nearDis);
+  }
+
+  void RaycastCamera::closeSpan(WallSpan& span, float lineWidth)
+  {
+    if (!span.open)
+    {
+      return;
+    }
+    span.open = false;
+
+    if (span.lastColumn == span.firstColumn)
+    {
+      toDraw.push_back(span.draw);
+      return;
+    }
+
+    // Across a flat face, 1 / dis and texCoord / dis are linear in screen x,
+    // so the right edge is extrapolated from the first and last column
+    float leftX = columns[span.firstColumn];
+    float rightX = columns[span.lastColumn] + lineWidth;
+    float t = (rightX - leftX) / (columns[span.lastColumn] - leftX);
+    float leftQ = 1.0f / span.firstHit.dis;
+    float lastQ = 1.0f / span.lastHit.dis;
+    float rightQ = leftQ + (lastQ - leftQ) * t;
+    float rightTex = (span.firstHit.texCoord * leftQ + (span.lastHit.texCoord * lastQ - span.firstHit.texCoord * leftQ) * t) / rightQ;
+    if (!(rightQ > 0.0f))
+    {
+      rightQ = lastQ;
+      rightTex = span.lastHit.texCoord;
+    }
+    float rightDis = 1.0f / rightQ;
+    float rightCenterY = (view.pos.z - 0.5f) * 2.0f / rightDis + view.facing;
+
+    DrawData wall = span.draw;
+    wall.merged = true;
+    wall.pos2.x = rightX;
+    wall.endY = glm::vec2(rightCenterY - rightQ, rightCenterY + rightQ);
+    wall.tPos2.x = rightTex;
+    wall.edgeDis = glm::vec2(span.firstHit.dis, rightDis);
+    wall.dis = span.farDis;
+    toDraw.push_back(wall);
+  }
+
+  bool RaycastCamera::opaque(const DrawData& draw)
+  {
+    return draw.color.a >= 1.0f && (!draw.tex.data || draw.tex.channels == 1 || draw.tex.channels == 3);
+  }
+
+  void RaycastCamera::recordExtent(uint32_t column, const std::vector<DrawData>& output, size_t firstHit)
+  {
+    // Hits come nearest first, so the last one is the one that can merge
+    wallDraws[column] = output.size() > firstHit ? output.size() - 1 : -1;
+
+    // The floor and ceiling end at the farthest wall they can't be seen through
+    wallTops[column] = INFINITY;
+    wallBottoms[column] = -INFINITY;
+    for (size_t draw = output.size(); draw > firstHit; draw--)
     {
-      if (drawRect)
+      if (opaque(output[draw - 1]))
       {
-        drawRect(ceilingColor, glm::vec2(-1.0f, startCeil), glm::vec2(1.0f, 1.0f));
+        wallTops[column] = output[draw - 1].pos1.y;
+        wallBottoms[column] = output[draw - 1].pos2.y;
+        break;
       }
-    } else 
+    }
+
+    occluderDis[column] = INFINITY;
+    for (size_t draw = firstHit; draw < output.size(); draw++)
     {
-      float step = 2.0f / res.y;
-      float lastDis = ((1.0f - pos.z) * 2.0f) / (facing + (1.0f-step));
-      glm::vec2 startDir = front - right;
-      glm::vec2 endDir = front + right;
-      for (float y = -1.0f; y < startCeil; y += step) 
+      const DrawData& wall = output[draw];
+      if (opaque(wall))
       {
-        float dis = ((1.0f - pos.z) * 2.0f) / (facing - y);
-
-        /*scanLine[0].color = sfColor(playerTile->fogColor);
-        scanLine[1].color = scanLine[0].color;
-        scanLine[2].color = scanLine[0].color;
-        scanLine[3].color = scanLine[0].color;*/
-    
-        if (drawTextureQuad)
-        {
-          drawTextureQuad(ceilingImg, glm::vec2(-1.0f, y), glm::vec2(1.0f, y), glm::vec2(1.0f, y+step), glm::vec2(-1.0f, y+step), glm::vec2(glm::vec2(pos) + startDir*lastDis)/ceilingScale, glm::vec2(glm::vec2(pos) + endDir*lastDis)/ceilingScale, glm::vec2(glm::vec2(pos) + endDir*dis)/ceilingScale, glm::vec2(glm::vec2(pos) + startDir*dis)/ceilingScale, ceilingColor.a);
-        }
-        lastDis = dis;
+        occluderDis[column] = wall.dis;
+        occluderTops[column] = wall.pos1.y;
+        occluderBottoms[column] = wall.pos2.y;
+        break;
       }
     }
   }
 
-  void RaycastCamera::walls() 
+  void RaycastCamera::projectSprites(float lineWidth)
   {
-    float lineWidth = 2.0f/float(res.x);
-    for (float ray = -1.0f; ray < 1.0f; ray += lineWidth) 
+    SpriteQueue& queue = frameSprites;
+    size_t count = queue.textures.size();
+    if (count == 0)
     {
-      glm::vec2 rayDir = front + right * ray;
+      return;
+    }
 
-      std::vector<RayCastData> eyeCasts = castRay(glm::vec2(pos.x, pos.y), rayDir);
+    // The projection sprite() makes, with the inverse worked out once for all of them
+    glm::vec2 tempFront = glm::normalize(view.front);
+    glm::vec2 tempRight = glm::normalize(view.right);
+    glm::mat2 inverseCameraProjection = glm::inverse(glm::mat2(tempRight.x, tempFront.x, tempRight.y, tempFront.y));
 
-      for (RayCastData &eyeCast: eyeCasts)
-      {
-        if (eyeCast.tileHit == nullptr) 
-        {
-          continue;
-        }
+    // Padded to whole packets, the padding is never read back
+    constexpr uint32_t width = simd::packetWidth;
+    size_t padded = (count + width - 1) / width * width;
+    for (std::vector<float>* values: {&queue.x, &queue.y, &queue.z, &queue.width, &queue.height, &spriteDepths, &spriteScreenX, &spriteScreenY, &spriteWidths, &spriteHeights})
+    {
+      values->resize(padded, 0.0f);
+    }
 
-        DrawData scanLine;
-        float centerY = (pos.z - 0.5f) * 2.0f / eyeCast.dis + facing;
-        float halfSize = 1.0f/eyeCast.dis;
+    simd::FloatN row0x = simd::splat(inverseCameraProjection[0][0]), row0y = simd::splat(inverseCameraProjection[1][0]);
+    simd::FloatN row1x = simd::splat(inverseCameraProjection[0][1]), row1y = simd::splat(inverseCameraProjection[1][1]);
+    simd::FloatN posX = simd::splat(view.pos.x), posY = simd::splat(view.pos.y), posZ = simd::splat(view.pos.z);
+    simd::FloatN aspect = simd::splat(glm::length(view.front) / glm::length(view.right));
+    simd::FloatN horizon = simd::splat(view.facing);
+    for (size_t first = 0; first < padded; first += width)
+    {
+      simd::FloatN toSpriteX = simd::sub(simd::loadUnaligned(&queue.x[first]), posX);
+      simd::FloatN toSpriteY = simd::sub(simd::loadUnaligned(&queue.y[first]), posY);
+      simd::FloatN across = simd::add(simd::mul(row0x, toSpriteX), simd::mul(row0y, toSpriteY));
+      simd::FloatN depth = simd::add(simd::mul(row1x, toSpriteX), simd::mul(row1y, toSpriteY));
 
-        scanLine.pos1 = glm::vec2(ray, centerY - halfSize);
-        scanLine.pos2 = glm::vec2(ray+lineWidth, centerY + halfSize);
+      simd::storeUnaligned(&spriteDepths[first], depth);
+      simd::storeUnaligned(&spriteScreenX[first], simd::div(simd::mul(across, aspect), depth));
+      simd::storeUnaligned(&spriteScreenY[first], simd::add(simd::div(simd::sub(posZ, simd::loadUnaligned(&queue.z[first])), depth), horizon));
+      simd::storeUnaligned(&spriteWidths[first], simd::div(simd::loadUnaligned(&queue.width[first]), depth));
+      simd::storeUnaligned(&spriteHeights[first], simd::div(simd::loadUnaligned(&queue.height[first]), depth));
+    }
 
-        scanLine.tPos1 = glm::vec2(eyeCast.texCoord, 0.0f);
-        scanLine.tPos2 = glm::vec2(eyeCast.texCoord, 1.0f);
+    bool occlusion = occluderDis.size() == columns.size();
+    for (size_t s = 0; s < count; s++)
+    {
+      if (!(spriteDepths[s] > 0.0f))
+      {
+        RAYCAST_STAT(frameStats.spritesCulled++;)
+        continue;
+      }
 
-        glm::vec2 relHitPos(eyeCast.hitPos.x - (int)eyeCast.hitPos.x, eyeCast.hitPos.y - (int)eyeCast.hitPos.y);
-        float dis = glm::distance(glm::vec2(pos.x, pos.y), glm::vec2(eyeCast.hitPos.x, eyeCast.hitPos.y));
+      glm::vec2 projectedPos(spriteScreenX[s], spriteScreenY[s]);
+      glm::vec2 spriteSize(spriteWidths[s], spriteHeights[s]);
 
-        Wall::ColorData* surfaceHit = &eyeCast.tileHit->colorData[eyeCast.surfaceHit];
-        scanLine.color = surfaceHit->color;
-        scanLine.color.a = glm::min(scanLine.color.a, 1.0f - surfaceHit->reflection);
-        scanLine.tex = surfaceHit->texture;
-        scanLine.dis = eyeCast.dis;
+      DrawData sprite;
+      sprite.tex = queue.textures[s];
+      if (sprite.tex.data)
+      {
+        sprite.color = glm::vec4(1.0f);
+      }
+      sprite.pos1 = projectedPos - spriteSize*queue.origins[s];
+      sprite.pos2 = projectedPos + spriteSize*(1.0f-queue.origins[s]);
+      sprite.dis = spriteDepths[s];
 
-        /*bool pVert = verticalHit;
-        double pEndX = endX;
-        double pEndY = endY;
-        int pTileType = tileType;
-        if (doDarkness) 
-        {
-          int tileEndX = tileHitX;
-          int tileEndY = tileHitY;
-          double pEndX = endX;
-          double pEndY = endY;
-          wallLight = sf::Color::Black;
-          for (int l = 0; l < lights.size(); l++) 
-          {
-            if (doShadows)
-            {
-              castRay(lights[l].pos, pf::getAngle(pEndX, pEndY, lights[l].pos.x, lights[l].pos.y)); 
-            } else 
-            {
-              dis = pf::distance(pEndX, pEndY, lights[l].pos.x, lights[l].pos.y); 
-            }
-            
-            if (!doShadows || (floor(pEndX) == floor(endX) && floor(pEndY) == floor(endY))) 
-            {
-              wallLight.r = (wallLight.r+(lights[l].color.r/(dis*dis)*lights[l].intensity) > 255 ? 255 : wallLight.r+(lights[l].color.r/(dis*dis)*lights[l].intensity));
-              wallLight.g = (wallLight.g+(lights[l].color.g/(dis*dis)*lights[l].intensity) > 255 ? 255 : wallLight.g+(lights[l].color.g/(dis*dis)*lights[l].intensity));
-              wallLight.b = (wallLight.b+(lights[l].color.b/(dis*dis)*lights[l].intensity) > 255 ? 255 : wallLight.b+(lights[l].color.b/(dis*dis)*lights[l].intensity));
-            }
-            //std::cout << (lights[l].intensity*256) << '/' << dis << '\n';
-            //wall.setFillColor(sf::Color(lightColor.r, lightColor.g, lightColor.b, 255-(doShadows ? (dis/lightIntensity) : 0)));
-          }
-        } else wallLight = sf::Color::White;
-        if (pTileType == 0) 
+      // Sizes are magnitudes, so pos1 is always the left and top corner
+      int64_t firstColumn = glm::clamp<int64_t>(std::floor((sprite.pos1.x + 1.0f) / lineWidth), 0, columns.size());
+      int64_t endColumn = glm::clamp<int64_t>(std::ceil((sprite.pos2.x + 1.0f) / lineWidth), 0, columns.size());
+      if (firstColumn >= endColumn)
+      {
+        RAYCAST_STAT(frameStats.spritesCulled++;)
+        continue;
+      }
+
+      if (!occlusion)
+      {
+        RAYCAST_STAT(frameStats.spriteSlices++;)
+        toDraw.push_back(sprite);
+        continue;
+      }
+
+      // Draw the runs of columns where no opaque wall in front covers the sprite top to bottom
+      int64_t runStart = firstColumn;
+      bool drawn = false;
+      for (int64_t column = firstColumn; column <= endColumn; column++)
+      {
+        if (column < endColumn && !(sprite.dis > occluderDis[column] && sprite.pos1.y >= occluderTops[column] && sprite.pos2.y <= occluderBottoms[column]))
         {
-          wallLight = sf::Color::Transparent;
-          rectSpr.setFillColor(wallLight);
-        } else 
+          continue;
+        }
+
+        if (column > runStart)
         {
-          if (pVert) 
+          drawn = true;
+          RAYCAST_STAT(frameStats.spriteSlices++;)
+          if (runStart == firstColumn && column == endColumn)
           {
-            if (pEndY < pos.y) 
-            {
-              wall.setFillColor(wallLight * tile->down.color);
-            } else 
-            {
-              wall.setFillColor(wallLight * tile->up.color);
-            }
-          } else 
+            toDraw.push_back(sprite);
+          } else
           {
-            if (pEndX < pos.x) 
-            {
-              wall.setFillColor(wallLight * tile->right.color);
-            } else 
-            {
-              wall.setFillColor(wallLight * tile->left.color);
-            }
+            DrawData slice = sprite;
+            slice.pos1.x = glm::max(sprite.pos1.x, columns[runStart]);
+            slice.pos2.x = glm::min(sprite.pos2.x, columns[column-1] + lineWidth);
+            float spriteWidth = sprite.pos2.x - sprite.pos1.x;
+            slice.tPos1.x = sprite.tPos1.x + (sprite.tPos2.x - sprite.tPos1.x) * (slice.pos1.x - sprite.pos1.x) / spriteWidth;
+            slice.tPos2.x = sprite.tPos1.x + (sprite.tPos2.x - sprite.tPos1.x) * (slice.pos2.x - sprite.pos1.x) / spriteWidth;
+            toDraw.push_back(slice);
           }
-        }*/
+        }
+        runStart = column + 1;
+      }
 
-        toDraw.push_back(scanLine);
-        // lightIntensity += ((rand()%3)-1)*0.001;
+      if (!drawn)
+      {
+        RAYCAST_STAT(frameStats.spritesCulled++;)
       }
     }
+
+    for (std::vector<float>* values: {&queue.x, &queue.y, &queue.z, &queue.width, &queue.height})
+    {
+      values->clear();
+    }
+    queue.origins.clear();
+    queue.textures.clear();
   }
 
-  std::vector<RayCastData> RaycastCamera::castRay(glm::vec2 startPos, glm::vec2 rayDir, float startDis, uint32_t startRenderDis) 
+  void RaycastCamera::surfaceRows(bool floor, float start)
   {
-    std::vector<RayCastData> returnValue(1);
+    const Texture& surfaceImg = floor ? view.floorImg : view.ceilingImg;
+    const glm::vec4& color = floor ? view.floorColor : view.ceilingColor;
+    float scale = floor ? view.floorScale : view.ceilingScale;
+    float height = (floor ? view.pos.z : 1.0f - view.pos.z) * 2.0f;
+    float side = floor ? 1.0f : -1.0f;
+    const World& tiles = viewed();
+    bool tileFloors = tiles.hasTileFloors();
 
-    RayCastData *ray = &returnValue[0];
+    float step = 2.0f / view.res.y;
+    float lineWidth = 2.0f / view.res.x;
 
-    bool continueCasting = false;
+    // Without the wall extents of a walls() call at this resolution, every column is visible
+    bool extents = !wallTops.empty() && glm::abs(float(wallTops.size()) - view.res.x) <= 1.0f;
+    uint32_t columnCount = extents ? wallTops.size() : view.res.x;
 
-    ray->tileHitPos = glm::floor(startPos);
+    glm::vec2 startDir = view.front - view.right;
+    for (uint32_t row = 0; row < view.res.y; row++)
+    {
+      float yTop = -1.0f + row * step;
+      float yBottom = yTop + step;
 
-    glm::vec2 edgeDelta;
-    glm::vec2 tileDelta = glm::abs(1.0f / rayDir);
+      // The edges of the row farthest from and nearest to the camera
+      float yFar = floor ? yTop : yBottom;
+      float yNear = floor ? yBottom : yTop;
+      if (side * (yNear - view.facing) <= 0.0f || side * (yNear - start) <= 0.0f)
+      {
+        continue;
+      }
 
-    glm::i8vec2 stepDir;
+      // The row that crosses the horizon is cut off just past it
+      float farDis = height / glm::max(side * (yFar - view.facing), step * 0.5f);
+      float nearDis = height / (side * (yNear - view.facing));
+      float centerDis = height / glm::max(side * ((yTop + yBottom) * 0.5f - view.facing), step * 0.5f);
 
-    bool hitWall = false;
+      // World position under the middle of the row at the left screen edge, and its change per column
+      glm::vec2 rowStart = glm::vec2(view.pos) + startDir * centerDis;
+      glm::vec2 rowStep = view.right * (centerDis * lineWidth);
 
-    // setup ray dirs
-    if (rayDir.x < 0) 
-    {
-      stepDir.x = -1;
-      edgeDelta.x = (startPos.x - ray->tileHitPos.x) * tileDelta.x;
-    } else 
-    {
-      stepDir.x = 1;
-      edgeDelta.x = (ray->tileHitPos.x + 1.0f - startPos.x) * tileDelta.x;
-    }
-    if (rayDir.y < 0) 
-    {
-      stepDir.y = -1;
-      edgeDelta.y = (startPos.y - ray->tileHitPos.y) * tileDelta.y;
-    } else 
-    {
-      stepDir.y = 1;
-      edgeDelta.y = (ray->tileHitPos.y + 1.0f - startPos.y) * tileDelta.y;
-    }
+      // Texture repeats each pixel of the row covers, across it or between its
+      // near and far edge, whichever is more, for picking mip levels
+      float pixelRepeats = glm::max(glm::length(rowStep), (farDis - nearDis) * glm::length(view.front)) / scale;
 
-    uint32_t tile = startRenderDis;
-    for (; !hitWall && tile < renderDistance; tile++) 
-    {
-      bool changedX = false;
-      if (edgeDelta.x < edgeDelta.y) 
+      uint32_t column = 0;
+      while (column < columnCount)
       {
-        ray->hitPos = startPos + rayDir * edgeDelta.x;
-        edgeDelta.x += tileDelta.x;
-        ray->tileHitPos.x += stepDir.x;
-        ray->verticalHit = false;
-        changedX = true;
-      } else 
-      {
-        ray->hitPos = startPos + rayDir * edgeDelta.y;
-        edgeDelta.y += tileDelta.y;
-        ray->tileHitPos.y += stepDir.y;
-        ray->verticalHit = true;
-      }
+        // Columns where walls cover the whole row are skipped
+        if (extents && !(floor ? wallBottoms[column] < yBottom : wallTops[column] > yTop))
+        {
+          column++;
+          continue;
+        }
 
-      if (ray->tileHitPos.x >= 0 && ray->tileHitPos.x < wallMapSize.x &&
-          ray->tileHitPos.y >= 0 && ray->tileHitPos.y < wallMapSize.y) 
-      {
-        switch ((ray->tileHit = &wall(ray->tileHitPos))->fillState) 
+        // Extend the span while it stays visible and keeps the same texture
+        const Texture* spanImg = &surfaceImg;
+        glm::ivec2 lastTile(INT32_MIN);
+        uint32_t spanStart = column;
+        for (; column < columnCount; column++)
         {
-          case Wall::Filled:
-            hitWall = true;
-            ray->texCoord = ray->hitPos[!ray->verticalHit] - ray->tileHitPos[!ray->verticalHit];
-            if (ray->tileHit->colorData.size() == 1)
-            {
-              ray->surfaceHit = 0;
-            } else
-            {
-              if (ray->verticalHit)
-              {
-                if (rayDir.y > 0.0f)
-                {
-                  ray->surfaceHit = 0;
-                } else
-                {
-                  ray->surfaceHit = 1;
-                }
-              } else
-              {
-                if (rayDir.x > 0.0f)
-                {
-                  ray->surfaceHit = 2;
-                } else
-                {
-                  ray->surfaceHit = 3;
-                }
-              }
-            }
+          if (extents && !(floor ? wallBottoms[column] < yBottom : wallTops[column] > yTop))
+          {
             break;
-          case Wall::Segments:
-          case Wall::Strip:
-          case Wall::Shape: {
-            // orthogonal plane
-            /*glm::vec2 wallTestPos(ray->tileHitPos.x, ray->tileHitPos.y + ray->tileHit->planeShift);
-            glm::vec2 hitPoint = pf::lineToLineCollide(
-                startPos, ray->hitPos + rayDir * 100.0f,
-                glm::vec2(wallTestPos.x + 1, wallTestPos.y), wallTestPos);
-            if (hitPoint == hitPoint) 
-            {
-              hitWall = true;
-              ray->hitPos = hitPoint;
-              edgeDelta.y += tileDelta.y * (rayDir.y > 0.0f ? ray->tileHit->planeShift : 1.0f - ray->tileHit->planeShift);
-              ray->verticalHit = true;
-            }*/
-
-            glm::vec2 closeHitPoint;
-            float closeTexCoord;
-            float closeDis = INFINITY;
-            for (uint32_t p = ray->tileHit->fillState != Wall::Shape ? 1 : 0; p < ray->tileHit->positionData.size(); p += ray->tileHit->fillState != Wall::Segments ? 1 : 2)
-            {
-              glm::vec2 pos1;
-              glm::vec2 pos2;
-
-              if (ray->tileHit->fillState != Wall::Shape)
-              {
-                pos1 = ray->tileHit->positionData[p-1];
-                pos2 = ray->tileHit->positionData[p];
-              } else
-              {
-                pos1 = ray->tileHit->positionData[p];
-                pos2 = ray->tileHit->positionData[(p+1) % ray->tileHit->positionData.size()];
-              }
+          }
 
-              glm::vec2 hitPoint = pf::lineToLineCollide(
-                  startPos, ray->hitPos + rayDir * 100.0f,
-                  glm::vec2(ray->tileHitPos) + pos1, glm::vec2(ray->tileHitPos) + pos2);
-              if (hitPoint == hitPoint)
-              {
-                float dis;
-                if (ray->verticalHit)
-                {
-                  dis = tileDelta.y * (rayDir.y > 0.0f ? (hitPoint.y - ray->tileHitPos.y) : (1.0f - (hitPoint.y - ray->tileHitPos.y)));
-                } else
-                {
-                  dis = tileDelta.x * (rayDir.x > 0.0f ? (hitPoint.x - ray->tileHitPos.x) : (1.0f - (hitPoint.x - ray->tileHitPos.x)));
-                }
-
-                float texCoord;
-                if (glm::abs(pos2.x-pos1.x) > glm::abs(pos2.y-pos1.y))
-                {
-                  texCoord = hitPoint.x - ray->tileHitPos.x;
-                } else
-                {
-                  texCoord = hitPoint.y - ray->tileHitPos.y;
-                }
-
-                if (dis < closeDis)
-                {
-                  closeDis = dis;
-                  closeTexCoord = texCoord;
-                  closeHitPoint = hitPoint;
-                }
-              }
+          if (tileFloors)
+          {
+            glm::ivec2 tile = glm::floor(rowStart + rowStep * (column + 0.5f));
+            if (tile == lastTile)
+            {
+              continue;
             }
+            lastTile = tile;
 
-            if (closeDis != INFINITY) 
+            const Texture* tileImg = &surfaceImg;
+            if (tiles.contains(tile))
             {
-              hitWall = true;
-
-              if (ray->verticalHit)
-              {
-                edgeDelta.y += closeDis;
-              } else
+              const Wall& tileWall = tiles.material(tiles.tileIndex(tile));
+              const Texture& ownImg = floor ? tileWall.floorImg : tileWall.ceilingImg;
+              if (ownImg.data)
               {
-                edgeDelta.x += closeDis;
+                tileImg = &ownImg;
               }
-
-              ray->hitPos = closeHitPoint;
-
-              ray->texCoord = closeTexCoord;
-              
-              //ray->verticalHit = true;
             }
-            break;
-          } /*case Wall::Mirror:
-            if (ray->verticalHit) 
+
+            if (column == spanStart)
             {
-              stepDir.y = -stepDir.y;
-              ray->tileHitPos.y += stepDir.y;
-              // including these lines messed up the texture coordinates in
-              // mirrors
-              // startPos.y = -startPos.y;
-              // rayDir.y = -rayDir.y;
-            } else 
+              spanImg = tileImg;
+            } else if (!(*tileImg == *spanImg))
             {
-              stepDir.x = -stepDir.x;
-              ray->tileHitPos.x += stepDir.x;
-              startPos.x = -startPos.x;
-              rayDir.x = -rayDir.x;
+              break;
             }
-            break;*/
-          case Wall::Empty:
-            break;
+          }
+        }
+
+        float x1 = -1.0f + spanStart * lineWidth;
+        float x2 = glm::min(-1.0f + column * lineWidth, 1.0f);
+        if (spanImg->data)
+        {
+          glm::vec2 farDir1 = (view.front + view.right * x1) * farDis;
+          glm::vec2 farDir2 = (view.front + view.right * x2) * farDis;
+          glm::vec2 nearDir1 = (view.front + view.right * x1) * nearDis;
+          glm::vec2 nearDir2 = (view.front + view.right * x2) * nearDis;
+          const Texture& level = mipLevel(*spanImg, pixelRepeats * glm::max(spanImg->width, spanImg->height));
+          emitTextureQuad(level, color, glm::vec2(x1, yFar), glm::vec2(x2, yFar), glm::vec2(x2, yNear), glm::vec2(x1, yNear), (glm::vec2(view.pos) + farDir1)/scale, (glm::vec2(view.pos) + farDir2)/scale, (glm::vec2(view.pos) + nearDir2)/scale, (glm::vec2(view.pos) + nearDir1)/scale, farDis);
+        } else
+        {
+          emitRect(color, glm::vec2(x1, yTop), glm::vec2(x2, yBottom), farDis);
         }
       }
     }
+  }
 
-    if (hitWall && ray->tileHit->colorData[ray->surfaceHit].reflection > 0.0f)
+  void RaycastCamera::emitRect(const glm::vec4& color, glm::vec2 pos1, glm::vec2 pos2, float dis)
+  {
+    RAYCAST_STAT(frameStats.drawCalls++;)
+    if (batching)
     {
-      continueCasting = true;
-      rayDir[ray->verticalHit] = -rayDir[ray->verticalHit];
+      DrawCommand& command = frameCommands.emplace_back();
+      command.type = DrawCommand::Rect;
+      command.color = color;
+      command.pos[0] = pos1;
+      command.pos[1] = pos2;
+      command.dis = dis;
+    } else if (drawRect)
+    {
+      drawRect(color, pos1, pos2);
     }
+  }
 
-    if (ray->verticalHit) 
+  void RaycastCamera::emitTextureRect(const Texture& tex, const glm::vec4& color, glm::vec2 pos1, glm::vec2 pos2, glm::vec2 tPos1, glm::vec2 tPos2, float dis, const Texture* columnTex)
+  {
+    RAYCAST_STAT(frameStats.drawCalls++;)
+    if (batching)
     {
-      ray->dis = (edgeDelta.y - tileDelta.y) + startDis;
-      // returnValue.hitPos = startPos + rayDir*returnValue.dis;
-    } else 
+      DrawCommand& command = frameCommands.emplace_back();
+      command.type = DrawCommand::TextureRect;
+      command.tex = tex;
+      if (columnTex)
+      {
+        command.columnTex = *columnTex;
+      }
+      command.color = color;
+      command.pos[0] = pos1;
+      command.pos[1] = pos2;
+      command.tPos[0] = tPos1;
+      command.tPos[1] = tPos2;
+      command.dis = dis;
+    } else if (drawTextureRect)
     {
-      ray->dis = (edgeDelta.x - tileDelta.x) + startDis;
-      // returnValue.hitPos = startPos + rayDir*returnValue.dis;
+      drawTextureRect(tex, pos1, pos2, tPos1, tPos2, color.a);
     }
+  }
 
-    if (!hitWall) 
-    {
-      ray->tileHit = nullptr;
-    } else 
+  void RaycastCamera::emitTextureQuad(const Texture& tex, const glm::vec4& color, glm::vec2 pos1, glm::vec2 pos2, glm::vec2 pos3, glm::vec2 pos4, glm::vec2 tPos1, glm::vec2 tPos2, glm::vec2 tPos3, glm::vec2 tPos4, float dis, glm::vec4 depth, const Texture* columnTex)
+  {
+    RAYCAST_STAT(frameStats.drawCalls++;)
+    if (batching)
     {
-      continueCasting |= ray->tileHit->colorData[ray->surfaceHit].color.a < 1.0f;
-        
-      if (continueCasting) 
+      DrawCommand& command = frameCommands.emplace_back();
+      command.type = DrawCommand::TextureQuad;
+      command.tex = tex;
+      if (columnTex)
+      {
+        command.columnTex = *columnTex;
+      }
+      command.color = color;
+      command.pos[0] = pos1;
+      command.pos[1] = pos2;
+      command.pos[2] = pos3;
+      command.pos[3] = pos4;
+      command.tPos[0] = tPos1;
+      command.tPos[1] = tPos2;
+      command.tPos[2] = tPos3;
+      command.tPos[3] = tPos4;
+      for (int p = 0; p < 4; p++)
       {
-        std::vector<RayCastData> childCast = castRay(ray->hitPos + rayDir * 0.01f, rayDir, ray->dis, tile);
-        returnValue.insert(returnValue.end(), childCast.begin(), childCast.end());
+        command.depth[p] = depth[p];
       }
+      command.dis = dis;
+    } else if (drawTextureQuad)
+    {
+      drawTextureQuad(tex, pos1, pos2, pos3, pos4, tPos1, tPos2, tPos3, tPos4, color.a);
     }
-
-    return returnValue;
   }
 
-  void RaycastCamera::sprite(const Texture& spriteTex, const glm::vec3 &spritePos, glm::vec2 spriteSize, glm::vec2 spriteOrigin) 
+  const Texture& RaycastCamera::mipLevel(const Texture& tex, float texelsPerPixel, const Texture** columns)
   {
-    glm::vec2 tempFront = glm::normalize(front);
-    glm::vec2 tempRight = glm::normalize(right);
-    glm::mat2 inverseCameraProjection = glm::inverse(glm::mat2(tempRight.x, tempFront.x, tempRight.y, tempFront.y));
+    if (!view.mipmapTextures || !tex.data)
+    {
+      return tex;
+    }
 
-    glm::vec2 transformedPos = inverseCameraProjection * glm::vec2(spritePos - pos);
-    if (transformedPos.y <= 0.0f) 
+    uint32_t mip = textureCache.pickLevel(tex, texelsPerPixel);
+    if (columns)
     {
-      return;
+      *columns = &textureCache.columns(tex, mip);
     }
-    transformedPos.x *= glm::length(front) / glm::length(right);
-    //transformedPos.y;
+    return textureCache.level(tex, mip);
+  }
 
-    //glm::vec2 projectedPos(screenSize.x * 0.5f * (transformedPos.x / transformedPos.y + 1.0f), screenSize.y * 0.5f * ((pos.z - spritePos.z) / transformedPos.y + 1.0f) + facing * screenSize.y);
-    glm::vec2 projectedPos(transformedPos.x / transformedPos.y, ((pos.z - spritePos.z) / transformedPos.y) + facing);
+  void RaycastCamera::groupCommands()
+  {
+    // Commands are split into runs whose screen columns don't overlap
+    // Nothing in a run can cover anything else in it, so each run can be
+    // reordered by texture without changing the image
+    columnStamps.assign(view.res.x, 0);
 
-    spriteSize = glm::abs(spriteSize / transformedPos.y);
+    uint32_t run = 1;
+    uint32_t runStart = 0;
+    for (uint32_t c = 0; c < frameCommands.size(); c++)
+    {
+      const DrawCommand& command = frameCommands[c];
 
-    DrawData sprite;
-    sprite.tex = spriteTex;
-    sprite.pos1 = projectedPos - spriteSize*spriteOrigin;
-    sprite.pos2 = projectedPos + spriteSize*(1.0f-spriteOrigin);
-    //sprite.setFillColor(sf::Color(glm::min(color.r / transformedPos.y, 255.0f), glm::min(color.g / transformedPos.y, 255.0f), glm::min(color.b / transformedPos.y, 255.0f)));
-    sprite.dis = transformedPos.y;
-    toDraw.push_back(sprite);
+      float left = command.pos[0].x;
+      float right = command.pos[0].x;
+      for (uint32_t p = 1; p < (command.type == DrawCommand::TextureQuad ? 4 : 2); p++)
+      {
+        left = glm::min(left, command.pos[p].x);
+        right = glm::max(right, command.pos[p].x);
+      }
+
+      // Edges shared by neighbouring columns land on the same column boundary
+      int64_t firstColumn = std::floor((left + 1.0f) * 0.5f * view.res.x + 0.001f);
+      int64_t endColumn = std::ceil((right + 1.0f) * 0.5f * view.res.x - 0.001f);
+      firstColumn = glm::clamp<int64_t>(firstColumn, 0, view.res.x);
+      endColumn = glm::clamp<int64_t>(glm::max(endColumn, firstColumn + 1), 0, view.res.x);
+
+      bool overlaps = false;
+      for (int64_t column = firstColumn; column < endColumn && !overlaps; column++)
+      {
+        overlaps = columnStamps[column] == run;
+      }
+
+      if (overlaps)
+      {
+        groupRun(runStart, c);
+        runStart = c;
+        run++;
+      }
+
+      for (int64_t column = firstColumn; column < endColumn; column++)
+      {
+        columnStamps[column] = run;
+      }
+    }
+
+    groupRun(runStart, frameCommands.size());
   }
 
-  void RaycastCamera::rotate(float ang) 
+  void RaycastCamera::groupRun(uint32_t first, uint32_t end)
   {
-    glm::mat2 rotation(glm::cos(ang), glm::sin(ang), -glm::sin(ang), glm::cos(ang));
+    if (end - first < 2)
+    {
+      return;
+    }
 
-    front = rotation * front;
-    right = rotation * right;
+    groupKeys.clear();
+    for (uint32_t c = first; c < end; c++)
+    {
+      groupKeys.emplace_back(reinterpret_cast<uintptr_t>(frameCommands[c].tex.data), c);
+    }
+
+    // The index breaks ties, so the order within a texture is kept
+    std::sort(groupKeys.begin(), groupKeys.end());
+
+    groupScratch.clear();
+    for (const std::pair<uintptr_t, uint32_t>& key: groupKeys)
+    {
+      groupScratch.push_back(frameCommands[key.second]);
+    }
+    std::copy(groupScratch.begin(), groupScratch.end(), frameCommands.begin() + first);
   }
 
-  void RaycastCamera::update() 
+  void RaycastCamera::viewWorld()
   {
-    walls();
+    if (sharedWorld)
+    {
+      snapshot = sharedWorld->snapshot();
+    } else
+    {
+      snapshot.reset();
+      if (pagedWorld)
+      {
+        pagedWorld->update(world, glm::vec2(pos));
+      }
+      world.commit();
+    }
+  }
 
-    toDraw.sort([](const DrawData& a, const DrawData& b) 
+  void RaycastCamera::sortDrawQueue()
+  {
+    // Stable LSD radix sort, farthest first
+    // Each key is the bit pattern of dis flipped so that unsigned order is
+    // descending float order, with the draw index in the low 32 bits
+    if (toDraw.empty())
     {
-      return a.dis > b.dis;
-    });
+      return;
+    }
 
-    float top = toDraw.front().pos1.y;
-    sky(top);
+    sortKeys.resize(toDraw.size());
+    for (uint32_t d = 0; d < toDraw.size(); d++)
+    {
+      uint32_t bits;
+      std::memcpy(&bits, &toDraw[d].dis, sizeof(bits));
+      if (bits == 0x80000000u)
+      {
+        // -0 and 0 compare equal
+        bits = 0;
+      }
+      bits = (bits & 0x80000000u) ? bits : ~(bits | 0x80000000u);
 
-    floorsAndCeilings(top, toDraw.front().pos2.y);
+      sortKeys[d] = uint64_t(bits) << 32 | d;
+    }
 
-    Wall *playerTile = &wall(glm::uvec2(pos));
-    while (!toDraw.empty()) 
+    sortScratch.resize(sortKeys.size());
+    for (uint32_t shift = 32; shift < 64; shift += 8)
     {
-      /*fogShader.setUniform("fogLevel", calculateFogStrength(playerTile, toDraw.front().getScale().x));
+      uint32_t counts[256] = {};
+      for (uint64_t key: sortKeys)
+      {
+        counts[(key >> shift) & 0xFF]++;
+      }
 
-      fogShader.setUniform("texture", *toDraw.front().getTexture());*/
+      // Every key shares this digit
+      if (counts[(sortKeys.front() >> shift) & 0xFF] == sortKeys.size())
+      {
+        continue;
+      }
 
-      if (drawTextureRect && toDraw.front().tex.data)
+      uint32_t offset = 0;
+      for (uint32_t& count: counts)
       {
-        drawTextureRect(toDraw.front().tex, toDraw.front().pos1, toDraw.front().pos2, toDraw.front().tPos1, toDraw.front().tPos2, toDraw.front().color.a);
-      } else if (drawRect)
+        uint32_t bucketSize = count;
+        count = offset;
+        offset += bucketSize;
+      }
+
+      for (uint64_t key: sortKeys)
       {
-        drawRect(toDraw.front().color, toDraw.front().pos1, toDraw.front().pos2);
+        sortScratch[counts[(key >> shift) & 0xFF]++] = key;
       }
-      toDraw.pop_front();
+      sortKeys.swap(sortScratch);
+    }
+
+    sortedDraw.resize(toDraw.size());
+    for (uint32_t d = 0; d < sortKeys.size(); d++)
+    {
+      sortedDraw[d] = toDraw[uint32_t(sortKeys[d])];
     }
+    toDraw.swap(sortedDraw);
   }
 
-  // private members
-  float RaycastCamera::calculateFogStrength(Wall *tile, float dis) 
+  glm::vec3 RaycastCamera::surfaceLight(const RayCastData& hit, std::vector<uint64_t>& lightMisses) const
+  {
+    if (hit.tileHit->fillState != Wall::Filled)
+    {
+      return lighting.pointLight(viewed(), hit.hitPos, hit.tileHitPos, glm::vec2(0.0f));
+    }
+
+    LightMap::Face face;
+    if (hit.verticalHit)
+    {
+      face = hit.hitPos.y < hit.tileHitPos.y + 0.5f ? LightMap::MinY : LightMap::MaxY;
+    } else
+    {
+      face = hit.hitPos.x < hit.tileHitPos.x + 0.5f ? LightMap::MinX : LightMap::MaxX;
+    }
+
+    return lighting.faceLight(viewed(), hit.tileHitPos, face, hit.texCoord, lightMisses);
+  }
+
+  float RaycastCamera::calculateFogStrength(const Wall *tile, float dis) 
   {
     if (tile->fogMaxDistance > 0.0f || tile->fogMaxStrength > 0.0f || tile->fogMinStrength > 0.0f) 
     {
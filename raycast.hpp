@@ -1,29 +1,29 @@
 #ifndef RAYCAST_RENDERER
 #define RAYCAST_RENDERER
 
+#include <cmath>
+#include <memory>
 #include <vector>
-#include <list>
 
 #include <glm/ext/vector_int2.hpp>
+#include <glm/ext/vector_int2_sized.hpp>
 #include <glm/ext/vector_uint2.hpp>
 
 #include "wall.hpp"
+#include "world.hpp"
 #include "texture.hpp"
 #include "light.hpp"
+#include "lightmap.hpp"
+#include "raycaster.hpp"
+#include "pagedworld.hpp"
+#include "sharedworld.hpp"
+#include "drawcommand.hpp"
+#include "framestats.hpp"
+#include "workerpool.hpp"
+#include "texturecache.hpp"
 
 namespace pf 
 {
-  struct RayCastData
-  {
-    Wall *tileHit = nullptr;
-    glm::vec2 hitPos;
-    uint32_t surfaceHit;
-    float texCoord;
-    float dis;
-    bool verticalHit;
-    glm::ivec2 tileHitPos;
-  };
-
   class RaycastCamera 
   {
     public:
@@ -31,6 +31,20 @@ namespace pf
       void (*drawTextureRect)(const Texture& tex, glm::vec2 pos1, glm::vec2 pos2, glm::vec2 tPos1, glm::vec2 tPos2, float alpha) = nullptr;
       void (*drawTextureQuad)(const Texture& tex, glm::vec2 pos1, glm::vec2 pos2, glm::vec2 pos3, glm::vec2 pos4, glm::vec2 tPos1, glm::vec2 tPos2, glm::vec2 tPos3, glm::vec2 tPos4, float alpha) = nullptr;
 
+      // When set, update() hands the whole frame to this in one call instead of
+      // using the callbacks above
+      // Commands are in draw order, with runs that can't overlap grouped by texture
+      void (*drawBatch)(const DrawCommand* commands, size_t count) = nullptr;
+
+      // Called around each phase of a frame, for profilers, with phase one of
+      // "walls", "sort", "sky", "floorsAndCeilings", "build", "group" or "submit"
+      // Only called when built with RAYCAST_STATS, see framestats.hpp
+      // Note: Frames begun by beginFrame(), or by update() with asyncFrames, call
+      // them from the frame worker thread for every phase up to "group", while
+      // the thread calling update() may be in "submit" at the same time
+      void (*traceBegin)(const char* phase) = nullptr;
+      void (*traceEnd)(const char* phase) = nullptr;
+
       glm::vec3 pos;
 
       glm::vec2 front = glm::vec2(0.0f, -1.0f);
@@ -41,6 +55,69 @@ namespace pf
       uint32_t renderDistance = -1;
       bool doShadows = 1;
 
+      // Light walls with lights and ambientLight, multiplying their color by it
+      // Lighting of filled tiles is cached per face between frames
+      // Note: The legacy drawTextureRect callback only gets the alpha, so use drawBatch for lit textures
+      bool doLighting = false;
+      glm::vec3 ambientLight = glm::vec3(0.0f);
+
+      // Number of threads walls() splits the screen columns across
+      // 1 casts every column on the calling thread, 0 uses every hardware thread
+      // The output is identical either way
+      uint32_t renderThreads = 1;
+
+      // Trace neighbouring columns together in SIMD packets when the target supports it
+      // The output is identical to tracing them one at a time
+      bool usePackets = true;
+
+      // Let rays jump across empty 8x8 and 64x64 tile squares of the world instead
+      // of reading every tile, the output is identical to visiting each tile
+      // SIMD packets still read each tile, so on large open maps this is usually
+      // fastest with usePackets off
+      bool skipEmptySpace = true;
+
+      // Trace rays in 32.32 fixed point, which picks the same tiles and places
+      // hits on filled tiles the same on every compiler and CPU, and keeps
+      // texture coordinates exact far from the world's origin
+      // Rays are traced one at a time then, even with usePackets
+      bool fixedPointRays = false;
+
+      // Reuse last frame's hits for columns whose rays are unaffected by camera
+      // and world changes, so a still camera or pos.z and facing changes only
+      // reproject the walls
+      bool cacheColumns = true;
+
+      // Only cast every columnStride-th column of each batch of 16 columns, then
+      // the columns between two cast ones whose hits differ in tile, face or depth
+      // Columns between hits on the same faces are interpolated, which is exact
+      // for flat faces but misses anything thin enough to fit between two rays
+      // 1 casts every column, other values are rounded down to a power of two
+      uint32_t columnStride = 1;
+
+      // When above zero, update() and buildFrame() double columnStride after
+      // frames taking longer than this many milliseconds, up to maxColumnStride,
+      // and halve it again after frames taking under half as long
+      float frameTimeTarget = 0.0f;
+      uint32_t maxColumnStride = 8;
+
+      // When building a frame for drawBatch, draw each run of columns whose
+      // farthest hit is on the same textured face as one TextureQuad, so there
+      // are about as many wall commands as visible faces
+      // Runs are cut where a sprite is between the near and far end of a face,
+      // so the sprite still sorts correctly against it
+      bool mergeWallFaces = false;
+
+      // Draw textured walls, sprites, floors and ceilings from mip levels picked
+      // by how many texels land on each pixel, so distant surfaces don't shimmer
+      // The camera builds each texture's levels the first time it draws it and
+      // keeps them, see clearTextureCache()
+      // Walls and sprites also get their level transposed in DrawCommand::columnTex
+      bool mipmapTextures = false;
+
+      // Most surfaces walls() will draw in one column, including ones seen
+      // through transparent or reflective surfaces
+      uint32_t maxRayHits = 64;
+
       std::vector<Light> lights;
       Texture floorImg;
       glm::vec4 floorColor;
@@ -53,29 +130,195 @@ namespace pf
 
       RaycastCamera();
 
+      // Waits for the frame being built, if any
+      ~RaycastCamera();
+
+      // When set, the camera renders and casts through the latest snapshot of
+      // this world instead of its own, taken by every walls(), update(),
+      // castRay() and getWorld()
+      // Note: wall() and resizeWorld() still edit the camera's own world
+      std::shared_ptr<SharedWorld> sharedWorld;
+
+      // When set, the camera's own world is filled with the chunks around pos
+      // at the same points, which replaces what resizeWorld() and wall() did
+      // Ignored while sharedWorld is set, whose owner pages it instead
+      std::shared_ptr<PagedWorld> pagedWorld;
+
       // Note: This function will invalidate the current contents of the world
       void resizeWorld(glm::uvec2 newSize);
 
+      // Edits are picked up by the next walls(), update() or castRay()
+      // Note: The reference is only valid until then
       Wall& wall(glm::uvec2 wallPos);
 
       const Wall& wall(glm::uvec2 wallPos) const;
 
+      // Replaces the camera's own world with an open map, see World::load()
+      bool loadMap(const MapFile& map, const std::vector<Texture>& textures);
+
+      // Writes the world the camera sees to a map file, see World::save()
+      bool saveMap(const char* path, const std::vector<Texture>& textures);
+
+      // Drops the levels built for mipmapTextures, which has to happen when the
+      // pixels of a drawn texture change in place
+      // Note: Commands of earlier frames can point into the dropped levels
+      void clearTextureCache();
+
       void sky(float startSky);
 
+      // Rows are cut into spans that skip columns the last walls() covered, and
+      // split where the tiles under them change floor or ceiling texture
       void floorsAndCeilings(float startCeil, float startFloor);
 
       void walls();
 
       std::vector<RayCastData> castRay(glm::vec2 startPos, glm::vec2 rayDir, float startDis = 0.0f, uint32_t startRenderDis = 0);
 
+      // Writes at most maxHits hits into hits without allocating and returns how many were written
+      // Transparent and reflective surfaces continue the ray until maxHits is reached
+      // Note: tileHit is only valid until the next walls(), update(), castRay() or getWorld()
+      uint32_t castRay(glm::vec2 startPos, glm::vec2 rayDir, RayCastData* hits, uint32_t maxHits, float startDis = 0.0f, uint32_t startRenderDis = 0);
+
+      // The tile grid the camera sees, with all edits made through wall() so far
+      // or the latest snapshot of sharedWorld, for casting batches of queries
+      // through a RayCaster without the camera
+      // Note: Only valid until the next walls(), update(), castRay() or getWorld()
+      const World& getWorld();
+
       void sprite(const Texture& spriteTex, const glm::vec3 &spritePos, glm::vec2 spriteSize, glm::vec2 spriteOrigin = glm::vec2(0.5f));
 
+      // Sprites as parallel arrays, sprite i is at (x[i], y[i], z[i]), sized
+      // (width[i], height[i]) and drawn with textures[i]
+      // origins may be null, which centers every sprite like sprite() does by default
+      struct SpriteBatch
+      {
+        size_t count = 0;
+        const float* x = nullptr;
+        const float* y = nullptr;
+        const float* z = nullptr;
+        const float* width = nullptr;
+        const float* height = nullptr;
+        const Texture* textures = nullptr;
+        const glm::vec2* origins = nullptr;
+      };
+
+      // Queues sprites for the next frame, drawn like sprite() on each of them
+      // They're projected together once the walls are cast, so sprites outside the
+      // view or behind opaque walls are dropped, and partly hidden ones are cut
+      // into the runs of columns they can be seen in
+      // The arrays are copied, they only have to be valid during the call
+      void sprites(const SpriteBatch& batch);
+
       void rotate(float ang);
 
       void update();
 
+      // When set and drawBatch is too, update() submits the frame the last
+      // update() began and begins the next one on another thread, so drawBatch
+      // runs while that frame is cast
+      // Frames are shown one update() after the camera was set up for them, and
+      // the first update() only begins one
+      bool asyncFrames = false;
+
+      // Builds the next frame like update() without submitting it
+      // If beginFrame() began a frame, waits for it and returns that one instead
+      // The commands stay valid until the next call
+      const std::vector<DrawCommand>& buildFrame();
+
+      // Begins building the next frame on another thread, finish it with buildFrame()
+      // The frame is drawn as the camera is set up now, so the settings above
+      // and the sprites queued for it can be changed as soon as this returns
+      // Until the frame is finished, resizeWorld(), wall(), loadMap(), saveMap(),
+      // castRay(), getWorld(), walls(), sky() and floorsAndCeilings() wait for it
+      // Does nothing while a frame is already being built
+      void beginFrame();
+
+      // Counts and timings of the last update() or buildFrame(), all zero unless
+      // built with RAYCAST_STATS
+      const FrameStats& getStats() const
+      {
+        return finishedStats;
+      }
+
     private:
-      float calculateFogStrength(Wall *tile, float dis);
+      float calculateFogStrength(const Wall *tile, float dis);
+
+      // Light reaching a wall hit, faces missing from the light map are added to lightMisses
+      glm::vec3 surfaceLight(const RayCastData& hit, std::vector<uint64_t>& lightMisses) const;
+
+      // Settings the frame being drawn reads instead of the public members,
+      // copied from them when it begins
+      struct FrameView
+      {
+        glm::vec3 pos;
+        glm::vec2 front;
+        glm::vec2 right;
+        float facing = 0.0f;
+        glm::uvec2 res;
+        uint32_t renderDistance = 0;
+        bool doShadows = false;
+        bool doLighting = false;
+        glm::vec3 ambientLight;
+        uint32_t renderThreads = 1;
+        bool usePackets = false;
+        bool skipEmptySpace = false;
+        bool fixedPointRays = false;
+        bool cacheColumns = false;
+        uint32_t columnStride = 1;
+        bool mergeWallFaces = false;
+        bool mipmapTextures = false;
+        uint32_t maxRayHits = 0;
+        std::vector<Light> lights;
+        Texture floorImg;
+        glm::vec4 floorColor;
+        float floorScale = 1.0f;
+        Texture skyImg;
+        glm::vec4 skyColor;
+        Texture ceilingImg;
+        glm::vec4 ceilingColor;
+        float ceilingScale = 1.0f;
+      };
+
+      // Waits for the frame beginFrame() began, leaving it for buildFrame()
+      void waitFrame();
+
+      // Picks up the world and copies the settings into view
+      void takeView();
+
+      // Takes the view and the sprites queued so far for the next frame
+      void startFrame();
+
+      // Draws the frame into frameCommands, on whichever thread builds it
+      void buildCommands();
+
+      // Publishes the stats of the frame just finished and adapts columnStride to it
+      void completeFrame();
+
+      void drawSky(float startSky);
+
+      void drawFloorsAndCeilings(float startCeil, float startFloor);
+
+      void castWalls();
+
+      void drawFrame();
+
+      // Record a command when building a batch, otherwise call the matching callback
+      void emitRect(const glm::vec4& color, glm::vec2 pos1, glm::vec2 pos2, float dis);
+
+      void emitTextureRect(const Texture& tex, const glm::vec4& color, glm::vec2 pos1, glm::vec2 pos2, glm::vec2 tPos1, glm::vec2 tPos2, float dis, const Texture* columnTex = nullptr);
+
+      void emitTextureQuad(const Texture& tex, const glm::vec4& color, glm::vec2 pos1, glm::vec2 pos2, glm::vec2 pos3, glm::vec2 pos4, glm::vec2 tPos1, glm::vec2 tPos2, glm::vec2 tPos3, glm::vec2 tPos4, float dis, glm::vec4 depth = glm::vec4(1.0f), const Texture* columnTex = nullptr);
+
+      // The mip level of tex to draw with texelsPerPixel of its texels on each
+      // pixel, with its transposed copy written to columns when given
+      // Without mipmapTextures it's tex itself and columns is left alone
+      const Texture& mipLevel(const Texture& tex, float texelsPerPixel, const Texture** columns = nullptr);
+
+      void groupCommands();
+
+      void groupRun(uint32_t first, uint32_t end);
+
+      static constexpr uint32_t columnsPerBatch = 16;
 
       struct DrawData
       {
@@ -89,12 +332,220 @@ namespace pf
 
         glm::vec2 tPos1 = glm::vec2(0.0f);
         glm::vec2 tPos2 = glm::vec2(1.0f);
+
+        // A wall merged over several columns, drawn as a quad from pos1.y and
+        // pos2.y at pos1.x to endY at pos2.x
+        // edgeDis holds the distance of the left and right edge
+        bool merged = false;
+        glm::vec2 endY = glm::vec2(0.0f);
+        glm::vec2 edgeDis = glm::vec2(0.0f);
+      };
+
+      // Columns whose farthest hits are being merged into one wall
+      struct WallSpan
+      {
+        bool open = false;
+        uint32_t firstColumn = 0;
+        uint32_t lastColumn = 0;
+        RayCastData firstHit;
+        RayCastData lastHit;
+        DrawData draw;
+        float nearDis = 0.0f;
+        float farDis = 0.0f;
+        float spriteNear = INFINITY;
+        float spriteFar = -INFINITY;
+      };
+
+      struct ThreadScratch
+      {
+        std::vector<RayCastData> hits;
+        std::vector<RayCastData> rebuiltHits;
+        // Light map faces this thread had to light directly
+        std::vector<uint64_t> lightMisses;
+        RayStats rayStats;
+        uint32_t columnsInterpolated = 0;
+      };
+
+      // Flags the columns whose cached hits camera movement or world edits may have changed
+      void markDirtyColumns();
+
+      // Casts the dirty columns of a batch and projects all of them
+      void wallColumns(uint32_t batch, float lineWidth, ThreadScratch& scratch, std::vector<DrawData>& output);
+
+      void storeColumn(uint32_t column, const RayCastData* hits, uint32_t hitCount, std::vector<RayCastData>& batchHits);
+
+      // Casts a whole batch of columns castStride apart, filling in the rest with refineColumns()
+      void castSparse(uint32_t firstColumn, uint32_t endColumn, RayCaster& caster, ThreadScratch& scratch, std::vector<RayCastData>& batchHits);
+
+      // Fills in the columns between two stored ones, interpolating them if
+      // columnsMatch() and otherwise casting the middle one and trying both halves
+      void refineColumns(uint32_t leftColumn, uint32_t rightColumn, RayCaster& caster, ThreadScratch& scratch, std::vector<RayCastData>& batchHits);
+
+      // Whether every hit of two stored columns is on the same face of a filled
+      // tile at a similar depth, so the columns between can be interpolated
+      bool columnsMatch(uint32_t leftColumn, uint32_t rightColumn, const std::vector<RayCastData>& batchHits) const;
+
+      // Moves columnStride toward frameTimeTarget after a frame
+      void adaptColumnStride(double frameMs);
+
+      void projectColumn(float ray, float lineWidth, const RayCastData* eyeCasts, uint32_t hitCount, std::vector<uint64_t>& lightMisses, std::vector<DrawData>& output);
+
+      // Appends the column batches to toDraw, merging the farthest walls of
+      // neighbouring columns where they are on the same face
+      void mergeWalls(float lineWidth);
+
+      // Whether a column's farthest hit continues the span's face
+      bool extendsSpan(const WallSpan& span, uint32_t column, const RayCastData& hit, const DrawData& draw) const;
+
+      // Appends the span to toDraw, as a quad if it covers more than one column
+      void closeSpan(WallSpan& span, float lineWidth);
+
+      // Whether nothing behind the draw shows through it, taken the same way as
+      // the software renderer does, since textures with alpha may have holes
+      static bool opaque(const DrawData& draw);
+
+      // Remembers which draw is the farthest wall of a column, and where the
+      // farthest and the nearest opaque walls start and end on screen
+      void recordExtent(uint32_t column, const std::vector<DrawData>& output, size_t firstHit);
+
+      // Projects the sprites queued by sprites() and appends what can be seen of them to toDraw
+      void projectSprites(float lineWidth);
+
+      // Emits the floor or ceiling rows past start
+      void surfaceRows(bool floor, float start);
+
+      // Sorts toDraw by dis, farthest first, keeping the order of equal distances
+      void sortDrawQueue();
+
+      // Picks up edits to the camera's own world or a new snapshot of sharedWorld,
+      // paging pagedWorld into the camera's world first
+      void viewWorld();
+
+      // The world the last viewWorld() picked
+      const World& viewed() const
+      {
+        return snapshot ? *snapshot : world;
+      }
+
+      // The thread frames begun by beginFrame() are built on, kept between frames
+      // Copying the camera waits for the frame being built, and the copy
+      // starts out without a thread or a frame of its own
+      struct FrameWorker
+      {
+        std::unique_ptr<TaskThread> thread;
+        // Whether beginFrame() began a frame that buildFrame() hasn't taken yet
+        bool pending = false;
+
+        FrameWorker() = default;
+        FrameWorker(const FrameWorker& other);
+        FrameWorker& operator=(const FrameWorker& other);
+
+        void wait() const;
       };
 
-      std::list<DrawData> toDraw;
+      // First, so copies wait for the frame before copying what it uses
+      FrameWorker frameWorker;
+
+      // Cleared rather than freed every frame, so its storage is reused
+      std::vector<DrawData> toDraw;
+      std::vector<DrawData> sortedDraw;
+      std::vector<uint64_t> sortKeys;
+      std::vector<uint64_t> sortScratch;
+
+      FrameView view;
+
+      // Sprites sprite() projected for the next frame
+      std::vector<DrawData> queuedDraws;
+
+      bool batching = false;
+      // The commands being built, and the ones buildFrame() last returned
+      std::vector<DrawCommand> frameCommands;
+      std::vector<DrawCommand> finishedCommands;
+      std::vector<uint32_t> columnStamps;
+      std::vector<std::pair<uintptr_t, uint32_t>> groupKeys;
+      std::vector<DrawCommand> groupScratch;
+
+      // Screen space x of each column cast by walls()
+      std::vector<float> columns;
+      // One draw buffer per batch of columns, merged in column order
+      std::vector<std::vector<DrawData>> columnBatches;
+      // Screen y of the top and bottom of the farthest opaque wall in each column
+      std::vector<float> wallTops;
+      std::vector<float> wallBottoms;
+      // Index of each column's farthest wall in its batch's draws, -1 if it has none
+      std::vector<uint32_t> wallDraws;
+      // Nearest and farthest sprite over each column, for merging walls
+      std::vector<float> spriteNear;
+      std::vector<float> spriteFar;
+      // Distance and screen y of the top and bottom of the nearest wall in each
+      // column that nothing shows through, INFINITY if it has none
+      std::vector<float> occluderDis;
+      std::vector<float> occluderTops;
+      std::vector<float> occluderBottoms;
+
+      // Sprites queued by sprites(), as structure of arrays
+      struct SpriteQueue
+      {
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> z;
+        // Magnitudes of the sizes
+        std::vector<float> width;
+        std::vector<float> height;
+        std::vector<glm::vec2> origins;
+        std::vector<Texture> textures;
+      };
+      SpriteQueue queuedSprites;
+      // The queued sprites the frame being drawn took
+      SpriteQueue frameSprites;
+      // Where each queued sprite lands on screen, and its size there
+      std::vector<float> spriteDepths;
+      std::vector<float> spriteScreenX;
+      std::vector<float> spriteScreenY;
+      std::vector<float> spriteWidths;
+      std::vector<float> spriteHeights;
+
+      std::vector<ThreadScratch> threadScratch;
+
+      // Hits of each column from the frame they were cast in, stored per batch
+      std::vector<std::vector<RayCastData>> batchHits;
+      std::vector<uint32_t> columnHitStarts;
+      std::vector<uint32_t> columnHitCounts;
+      // Ray distance up to which world edits matter to the column
+      std::vector<float> columnReach;
+      // Whether the column's ray was reflected before its last hit
+      std::vector<uint8_t> columnBent;
+      std::vector<uint8_t> columnDirty;
+      glm::vec2 cachedRayStart = glm::vec2(NAN);
+      glm::vec2 cachedFront = glm::vec2(NAN);
+      glm::vec2 cachedRight = glm::vec2(NAN);
+      uint32_t cachedRenderDistance = 0;
+      uint32_t cachedMaxRayHits = 0;
+      uint32_t cachedColumnStride = 0;
+      bool cachedFixedPoint = false;
+      // columnStride as the last walls() used it
+      uint32_t castStride = 1;
+      uint64_t seenChanges = 0;
+      uint64_t seenWorld = 0;
+      // The world the cached hits point into, kept alive while they do
+      const World* castWorld = nullptr;
+      std::shared_ptr<const World> castSnapshot;
+      // Whether the cached hits have to be pointed at the viewed world's materials
+      bool rebaseHits = false;
+      std::shared_ptr<WorkerPool> workers;
+
+      LightMap lighting;
+      TextureCache textureCache;
+      std::vector<uint64_t> missedFaces;
+
+      // Stats of the frame being drawn, and of the last one finished
+      FrameStats frameStats;
+      FrameStats finishedStats;
+      // How long the last frame took to draw
+      double frameMs = 0.0;
 
-      glm::uvec2 wallMapSize = glm::uvec2(0.0f);
-      std::vector<Wall> wallMap;
+      World world;
+      std::shared_ptr<const World> snapshot;
   };
 }
 #endif
@@ -0,0 +1,992 @@
+#include "raycaster.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include "simd.hpp"
+
+#if defined(_MSC_VER) && defined(_M_X64)
+  #include <intrin.h>
+#endif
+
+namespace pf
+{
+  namespace
+  {
+    // Unsigned 128 bit integers for the fixed point rays, since not every
+    // compiler has __int128
+    struct Wide
+    {
+      uint64_t high;
+      uint64_t low;
+    };
+
+    Wide multiplyWide(uint64_t a, uint64_t b)
+    {
+#if defined(__SIZEOF_INT128__)
+      unsigned __int128 product = (unsigned __int128)a * b;
+      return {uint64_t(product >> 64), uint64_t(product)};
+#elif defined(_MSC_VER) && defined(_M_X64)
+      Wide product;
+      product.low = _umul128(a, b, &product.high);
+      return product;
+#else
+      // Schoolbook on 32 bit halves
+      uint64_t low = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+      uint64_t middle1 = (a >> 32) * (b & 0xFFFFFFFF);
+      uint64_t middle2 = (a & 0xFFFFFFFF) * (b >> 32);
+      uint64_t carry = ((low >> 32) + (middle1 & 0xFFFFFFFF) + (middle2 & 0xFFFFFFFF)) >> 32;
+      return {(a >> 32) * (b >> 32) + (middle1 >> 32) + (middle2 >> 32) + carry, a * b};
+#endif
+    }
+
+    // divisor has to be below 2^32
+    Wide divideWide(Wide dividend, uint64_t divisor)
+    {
+      Wide quotient;
+      quotient.high = dividend.high / divisor;
+      uint64_t remainder = dividend.high % divisor;
+      // The remainder is below the divisor, so the rest of the quotient fits 64 bits
+#if defined(__SIZEOF_INT128__)
+      quotient.low = uint64_t(((unsigned __int128)remainder << 64 | dividend.low) / divisor);
+#elif defined(_MSC_VER) && defined(_M_X64) && _MSC_VER >= 1920
+      quotient.low = _udiv128(remainder, dividend.low, divisor, &remainder);
+#else
+      uint64_t upper = remainder << 32 | dividend.low >> 32;
+      uint64_t lower = upper % divisor << 32 | (dividend.low & 0xFFFFFFFF);
+      quotient.low = upper / divisor << 32 | lower / divisor;
+#endif
+      return quotient;
+    }
+
+    // Rounds once, to the nearest float
+    float wideToFloat(Wide value)
+    {
+      if (value.high == 0)
+      {
+        return float(value.low);
+      }
+
+      // Shifted down to 64 bits, the bits shifted out only matter in whether
+      // any are set, which is kept in the lowest bit, far below where the float rounds
+      int shift = 64;
+      while (shift > 1 && !(value.high >> (shift - 1)))
+      {
+        shift--;
+      }
+      uint64_t top = shift == 64 ? value.high | (value.low != 0) :
+        value.high << (64 - shift) | value.low >> shift | ((value.low & ((uint64_t(1) << shift) - 1)) != 0);
+      return std::ldexp(float(top), shift);
+    }
+  }
+
+  RayCaster::RayCaster(const World& world, uint32_t renderDistance, bool skipEmptySpace, bool fixedPoint) :
+  world{world}, renderDistance{renderDistance}, skipEmptySpace{skipEmptySpace}, fixedPoint{fixedPoint}
+  {
+    if (world.hasEdits())
+    {
+      kernel = Full;
+    } else
+    {
+      kernel = Kernel((world.hasShapes() ? ShapesOpaque : FilledOpaque) + (world.hasSeeThrough() ? FilledSeeThrough : FilledOpaque));
+    }
+  }
+
+  uint32_t RayCaster::castHits(glm::vec2 startPos, glm::vec2 rayDir, RayCastData* hits, uint32_t maxHits, float startDis, uint32_t startRenderDis) const
+  {
+    return withKernel([&](auto shapes, auto seeThrough)
+    {
+      uint32_t hitCount = 0;
+      while (hitCount < maxHits)
+      {
+        if (!castSegment<shapes, seeThrough>(startPos, rayDir, startDis, startRenderDis, hits[hitCount++]))
+        {
+          break;
+        }
+      }
+
+      return hitCount;
+    });
+  }
+
+  bool RayCaster::castSegment(glm::vec2& startPos, glm::vec2& rayDir, float& startDis, uint32_t& startRenderDis, RayCastData& rayData) const
+  {
+    return withKernel([&](auto shapes, auto seeThrough)
+    {
+      return castSegment<shapes, seeThrough>(startPos, rayDir, startDis, startRenderDis, rayData);
+    });
+  }
+
+  void RayCaster::castRayPacket(glm::vec2 startPos, const glm::vec2* rayDirs, RayCastData* hits, uint32_t maxHits, uint32_t* hitCounts) const
+  {
+    // The packet steps in floats, so fixed point rays go one at a time
+    if (fixedPoint)
+    {
+      for (uint32_t lane = 0; lane < simd::packetWidth; lane++)
+      {
+        hitCounts[lane] = castHits(startPos, rayDirs[lane], hits + lane * maxHits, maxHits);
+      }
+      return;
+    }
+
+    withKernel([&](auto shapes, auto seeThrough)
+    {
+      castRayPacket<shapes, seeThrough>(startPos, rayDirs, hits, maxHits, hitCounts);
+    });
+  }
+
+  void RayCaster::query(const glm::vec2* origins, const glm::vec2* dirs, const float* maxDis, size_t count, QueryMode mode, QueryHit* hits, WorkerPool* workers) const
+  {
+    withKernel([&](auto shapes, auto seeThrough)
+    {
+      if (workers && workers->size() > 1 && count > raysPerTask)
+      {
+        workers->run((count + raysPerTask - 1) / raysPerTask, [&](uint32_t task, uint32_t)
+        {
+          size_t end = std::min(size_t(task + 1) * raysPerTask, count);
+          for (size_t ray = size_t(task) * raysPerTask; ray < end; ray++)
+          {
+            hits[ray] = query<shapes, seeThrough>(origins[ray], dirs[ray], maxDis ? maxDis[ray] : INFINITY, mode);
+          }
+        });
+      } else
+      {
+        for (size_t ray = 0; ray < count; ray++)
+        {
+          hits[ray] = query<shapes, seeThrough>(origins[ray], dirs[ray], maxDis ? maxDis[ray] : INFINITY, mode);
+        }
+      }
+    });
+  }
+
+  RayCaster::QueryHit RayCaster::query(glm::vec2 origin, glm::vec2 dir, float maxDis, QueryMode mode) const
+  {
+    return withKernel([&](auto shapes, auto seeThrough)
+    {
+      return query<shapes, seeThrough>(origin, dir, maxDis, mode);
+    });
+  }
+
+  // private members
+  template<bool shapes, bool seeThrough>
+  bool RayCaster::castSegment(glm::vec2& startPos, glm::vec2& rayDir, float& startDis, uint32_t& startRenderDis, RayCastData& rayData) const
+  {
+    RayState state;
+    beginRay(startPos, rayDir, startRenderDis, state, rayData);
+
+    bool hitWall = fixedPoint ? traverseRay<shapes, true>(state, rayData) : traverseRay<shapes, false>(state, rayData);
+
+    if (!finishRay<seeThrough>(state, hitWall, startDis, rayData))
+    {
+      return false;
+    }
+    RAYCAST_STAT(if (stats) stats->childCasts++;)
+
+    startPos = rayData.hitPos + state.rayDir * 0.01f;
+    rayDir = state.rayDir;
+    startDis = rayData.dis;
+    startRenderDis = state.tile;
+    return true;
+  }
+
+  template<bool shapes, bool seeThrough>
+  void RayCaster::castRayPacket(glm::vec2 startPos, const glm::vec2* rayDirs, RayCastData* hits, uint32_t maxHits, uint32_t* hitCounts) const
+  {
+    constexpr uint32_t width = simd::packetWidth;
+
+    RayState states[width];
+    for (uint32_t lane = 0; lane < width; lane++)
+    {
+      beginRay(startPos, rayDirs[lane], 0, states[lane], hits[lane * maxHits]);
+    }
+
+    alignas(32) float edgeX[width], edgeY[width], deltaX[width], deltaY[width], lastEdge[width];
+    alignas(32) int32_t tileX[width], tileY[width], stepX[width], stepY[width], vertical[width], laneBits[width];
+    for (uint32_t lane = 0; lane < width; lane++)
+    {
+      edgeX[lane] = states[lane].edgeDelta.x;
+      edgeY[lane] = states[lane].edgeDelta.y;
+      deltaX[lane] = states[lane].tileDelta.x;
+      deltaY[lane] = states[lane].tileDelta.y;
+      tileX[lane] = hits[lane * maxHits].tileHitPos.x;
+      tileY[lane] = hits[lane * maxHits].tileHitPos.y;
+      stepX[lane] = states[lane].stepDir.x;
+      stepY[lane] = states[lane].stepDir.y;
+      laneBits[lane] = 1 << lane;
+    }
+
+    simd::FloatN vEdgeX = simd::load(edgeX), vEdgeY = simd::load(edgeY);
+    simd::FloatN vDeltaX = simd::load(deltaX), vDeltaY = simd::load(deltaY);
+    simd::FloatN vLastEdge = simd::zeroFloat();
+    simd::IntN vTileX = simd::load(tileX), vTileY = simd::load(tileY);
+    simd::IntN vStepX = simd::load(stepX), vStepY = simd::load(stepY);
+    simd::IntN vVertical = simd::zeroInt();
+    simd::IntN vLaneBits = simd::load(laneBits);
+
+    // Step every lane through empty tiles in lockstep
+    // A lane leaves the packet just before it would enter an occupied tile, and
+    // the scalar traversal takes over from that exact state, so results are unchanged
+    uint32_t tile = 0;
+    uint32_t liveLanes = (1u << width) - 1;
+    uint32_t steppedLanes = 0;
+    uint32_t laneTile[width];
+    while (liveLanes && tile < renderDistance)
+    {
+      simd::FloatN stepsX = simd::lessThan(vEdgeX, vEdgeY);
+      simd::IntN stepsXInt = simd::asInt(stepsX);
+
+      simd::FloatN nextEdgeX = simd::select(stepsX, simd::add(vEdgeX, vDeltaX), vEdgeX);
+      simd::FloatN nextEdgeY = simd::select(stepsX, vEdgeY, simd::add(vEdgeY, vDeltaY));
+      simd::IntN nextTileX = simd::select(stepsXInt, simd::add(vTileX, vStepX), vTileX);
+      simd::IntN nextTileY = simd::select(stepsXInt, vTileY, simd::add(vTileY, vStepY));
+
+      simd::store(tileX, nextTileX);
+      simd::store(tileY, nextTileY);
+
+      uint32_t blockedLanes = 0;
+      for (uint32_t lanes = liveLanes; lanes; lanes &= lanes - 1)
+      {
+        uint32_t lane = simd::lowestLane(lanes);
+        if (world.occupied(glm::ivec2(tileX[lane], tileY[lane])))
+        {
+          blockedLanes |= 1u << lane;
+          laneTile[lane] = tile;
+        }
+      }
+
+      uint32_t commitLanes = liveLanes & ~blockedLanes;
+      simd::IntN commitInt = simd::testBits(vLaneBits, commitLanes);
+      simd::FloatN commit = simd::asFloat(commitInt);
+
+      vLastEdge = simd::select(commit, simd::select(stepsX, vEdgeX, vEdgeY), vLastEdge);
+      vEdgeX = simd::select(commit, nextEdgeX, vEdgeX);
+      vEdgeY = simd::select(commit, nextEdgeY, vEdgeY);
+      vTileX = simd::select(commitInt, nextTileX, vTileX);
+      vTileY = simd::select(commitInt, nextTileY, vTileY);
+      vVertical = simd::select(commitInt, simd::bitNot(stepsXInt), vVertical);
+
+      steppedLanes |= commitLanes;
+      liveLanes = commitLanes;
+      tile++;
+      RAYCAST_STAT(if (stats) stats->steps += simd::laneCount(commitLanes);)
+    }
+
+    for (uint32_t lanes = liveLanes; lanes; lanes &= lanes - 1)
+    {
+      laneTile[simd::lowestLane(lanes)] = tile;
+    }
+
+    simd::store(edgeX, vEdgeX);
+    simd::store(edgeY, vEdgeY);
+    simd::store(lastEdge, vLastEdge);
+    simd::store(tileX, vTileX);
+    simd::store(tileY, vTileY);
+    simd::store(vertical, vVertical);
+
+    for (uint32_t lane = 0; lane < width; lane++)
+    {
+      RayState& state = states[lane];
+      RayCastData* laneHits = &hits[lane * maxHits];
+      RayCastData& ray = laneHits[0];
+
+      state.edgeDelta = glm::vec2(edgeX[lane], edgeY[lane]);
+      state.tile = laneTile[lane];
+      ray.tileHitPos = glm::ivec2(tileX[lane], tileY[lane]);
+      if (steppedLanes & (1u << lane))
+      {
+        ray.hitPos = state.startPos + state.rayDir * lastEdge[lane];
+        ray.verticalHit = vertical[lane] != 0;
+      }
+
+      bool hitWall = traverseRay<shapes, false>(state, ray);
+
+      // Transparent and reflective hits continue down the scalar path
+      hitCounts[lane] = 1;
+      if (finishRay<seeThrough>(state, hitWall, 0.0f, ray) && maxHits > 1)
+      {
+        RAYCAST_STAT(if (stats) stats->childCasts++;)
+        hitCounts[lane] += castHits(ray.hitPos + state.rayDir * 0.01f, state.rayDir, laneHits + 1, maxHits - 1, ray.dis, state.tile);
+      }
+    }
+  }
+
+  template<bool shapes, bool seeThrough>
+  RayCaster::QueryHit RayCaster::query(glm::vec2 origin, glm::vec2 dir, float maxDis, QueryMode mode) const
+  {
+    QueryHit queryHit;
+
+    float length = glm::length(dir);
+    if (!(length > 0.0f) || !(maxDis >= 0.0f))
+    {
+      return queryHit;
+    }
+    glm::vec2 rayDir = dir / length;
+
+    // Nothing is hit once the ray leaves the world
+    glm::vec2 worldMin(world.origin());
+    glm::vec2 toMin = (worldMin - origin) / rayDir;
+    glm::vec2 toMax = (worldMin + glm::vec2(world.size()) - origin) / rayDir;
+    glm::vec2 entry = glm::min(toMin, toMax);
+    glm::vec2 exit = glm::max(toMin, toMax);
+    float exitDis = glm::min(exit.x, exit.y);
+    if (exitDis < glm::max(entry.x, entry.y) || exitDis < 0.0f)
+    {
+      return queryHit;
+    }
+
+    // A ray crosses at most dis * sqrt(2) + 2 tiles within dis, so the
+    // traversal can stop there instead of at renderDistance
+    float tileDis = glm::min(maxDis, exitDis);
+    RayCaster limited(world, renderDistance, skipEmptySpace, fixedPoint);
+    if (tileDis * 1.5f + 2.0f < float(renderDistance))
+    {
+      limited.renderDistance = uint32_t(tileDis * 1.5f) + 2;
+    }
+    RAYCAST_STAT(limited.stats = stats;)
+
+    glm::vec2 startPos = origin;
+    float startDis = 0.0f;
+    uint32_t startRenderDis = 0;
+    while (true)
+    {
+      RayState state;
+      RayCastData rayData;
+      limited.beginRay(startPos, rayDir, startRenderDis, state, rayData);
+      bool hitWall = fixedPoint ? limited.traverseRay<shapes, true>(state, rayData) : limited.traverseRay<shapes, false>(state, rayData);
+      limited.finishRay<seeThrough>(state, hitWall, startDis, rayData);
+      if (!hitWall || rayData.dis > maxDis)
+      {
+        return queryHit;
+      }
+
+      const Wall::ColorData& surface = rayData.tileHit->colorData[rayData.surfaceHit];
+      if (!seeThrough || mode == AnyHit || surface.color.a >= 1.0f || surface.reflection > 0.0f)
+      {
+        queryHit.tile = rayData.tileHitPos;
+        queryHit.point = rayData.hitPos;
+        queryHit.dis = rayData.dis;
+        if (rayData.verticalHit)
+        {
+          queryHit.face = rayDir.y > 0.0f ? MinY : MaxY;
+        } else
+        {
+          queryHit.face = rayDir.x > 0.0f ? MinX : MaxX;
+        }
+        return queryHit;
+      }
+
+      // See through it, carrying on in a straight line
+      RAYCAST_STAT(if (stats) stats->childCasts++;)
+      startPos = rayData.hitPos + rayDir * 0.01f;
+      startDis = rayData.dis;
+      startRenderDis = state.tile;
+    }
+  }
+
+  void RayCaster::beginRay(glm::vec2 startPos, glm::vec2 rayDir, uint32_t startRenderDis, RayState& state, RayCastData& rayData) const
+  {
+    RayCastData *ray = &rayData;
+
+    *ray = RayCastData();
+    ray->tileHitPos = glm::floor(startPos);
+    RAYCAST_STAT(if (stats) stats->casts++;)
+
+    state.startPos = startPos;
+    state.rayDir = rayDir;
+    state.tileDelta = glm::abs(1.0f / rayDir);
+    state.tile = startRenderDis;
+
+    // setup ray dirs
+    if (rayDir.x < 0) 
+    {
+      state.stepDir.x = -1;
+      state.edgeDelta.x = (startPos.x - ray->tileHitPos.x) * state.tileDelta.x;
+    } else 
+    {
+      state.stepDir.x = 1;
+      state.edgeDelta.x = (ray->tileHitPos.x + 1.0f - startPos.x) * state.tileDelta.x;
+    }
+    if (rayDir.y < 0) 
+    {
+      state.stepDir.y = -1;
+      state.edgeDelta.y = (startPos.y - ray->tileHitPos.y) * state.tileDelta.y;
+    } else 
+    {
+      state.stepDir.y = 1;
+      state.edgeDelta.y = (ray->tileHitPos.y + 1.0f - startPos.y) * state.tileDelta.y;
+    }
+
+    if (fixedPoint)
+    {
+      // Scaling by powers of 2 is exact, and so is flooring the result
+      state.startFixed = glm::i64vec2(std::floor(std::ldexp(double(startPos.x), 32)), std::floor(std::ldexp(double(startPos.y), 32)));
+      glm::vec2 magnitude = glm::abs(rayDir);
+      int exponent;
+      std::frexp(glm::max(magnitude.x, magnitude.y), &exponent);
+      state.dirShift = 24 - exponent;
+      // Exact for the larger component, the smaller is truncated to the same scale
+      state.dirFixed = glm::u64vec2(std::ldexp(magnitude.x, state.dirShift), std::ldexp(magnitude.y, state.dirShift));
+
+      constexpr uint64_t one = uint64_t(1) << 32;
+      for (int axis = 0; axis < 2; axis++)
+      {
+        uint64_t fraction = uint64_t(state.startFixed[axis]) & (one - 1);
+        state.nextEdge[axis] = state.stepDir[axis] > 0 ? one - fraction : fraction;
+      }
+      state.errorX = state.nextEdge.x * state.dirFixed.y;
+      state.errorY = state.nextEdge.y * state.dirFixed.x;
+      uint64_t common = glm::min(state.errorX, state.errorY);
+      state.errorX -= common;
+      state.errorY -= common;
+      state.lastEdge = 0;
+      state.hitDis = 0.0f;
+    }
+  }
+
+  template<bool shapes, bool fixed>
+  bool RayCaster::traverseRay(RayState& state, RayCastData& rayData) const
+  {
+    RayCastData *ray = &rayData;
+
+    glm::vec2 startPos = state.startPos;
+    glm::vec2 rayDir = state.rayDir;
+    glm::vec2 edgeDelta = state.edgeDelta;
+    glm::vec2 tileDelta = state.tileDelta;
+    glm::i8vec2 stepDir = state.stepDir;
+
+    bool hitWall = false;
+    bool skipEmpty = skipEmptySpace;
+    RAYCAST_STAT(uint64_t steps = 0;)
+
+    uint32_t tile = state.tile;
+    for (; !hitWall && tile < renderDistance; tile++) 
+    {
+      RAYCAST_STAT(steps++;)
+      if (fixed)
+      {
+        ray->verticalHit = stepFixed(state);
+        ray->tileHitPos[ray->verticalHit] += stepDir[ray->verticalHit];
+      } else if (edgeDelta.x < edgeDelta.y) 
+      {
+        ray->hitPos = startPos + rayDir * edgeDelta.x;
+        edgeDelta.x += tileDelta.x;
+        ray->tileHitPos.x += stepDir.x;
+        ray->verticalHit = false;
+      } else 
+      {
+        ray->hitPos = startPos + rayDir * edgeDelta.y;
+        edgeDelta.y += tileDelta.y;
+        ray->tileHitPos.y += stepDir.y;
+        ray->verticalHit = true;
+      }
+
+      if (world.contains(ray->tileHitPos)) 
+      {
+        uint32_t tileIndex = world.tileIndex(ray->tileHitPos);
+        Wall::FillState fillState = world.fillState(tileIndex);
+        glm::vec2 inTile;
+        if (fillState != Wall::Empty)
+        {
+          ray->tileHit = &world.material(tileIndex);
+          if (fixed)
+          {
+            inTile = placeFixedHit(state, *ray);
+          }
+        } else if (skipEmpty)
+        {
+          state.edgeDelta = edgeDelta;
+          state.tile = tile;
+          if (fixed)
+          {
+            crossEmptySpaceFixed(state, *ray);
+          } else
+          {
+            crossEmptySpace(state, *ray);
+          }
+          edgeDelta = state.edgeDelta;
+          tile = state.tile;
+        }
+
+        if (!shapes)
+        {
+          if (fillState != Wall::Empty)
+          {
+            hitWall = true;
+            hitFilled(rayDir, *ray);
+            if (fixed)
+            {
+              ray->texCoord = inTile[!ray->verticalHit];
+            }
+          }
+        } else switch (fillState) 
+        {
+          case Wall::Filled:
+            hitWall = true;
+            hitFilled(rayDir, *ray);
+            if (fixed)
+            {
+              ray->texCoord = inTile[!ray->verticalHit];
+            }
+            break;
+          case Wall::Segments:
+          case Wall::Strip:
+          case Wall::Shape: {
+            // orthogonal plane
+            /*glm::vec2 wallTestPos(ray->tileHitPos.x, ray->tileHitPos.y + ray->tileHit->planeShift);
+            glm::vec2 hitPoint = pf::lineToLineCollide(
+                startPos, ray->hitPos + rayDir * 100.0f,
+                glm::vec2(wallTestPos.x + 1, wallTestPos.y), wallTestPos);
+            if (hitPoint == hitPoint) 
+            {
+              hitWall = true;
+              ray->hitPos = hitPoint;
+              edgeDelta.y += tileDelta.y * (rayDir.y > 0.0f ? ray->tileHit->planeShift : 1.0f - ray->tileHit->planeShift);
+              ray->verticalHit = true;
+            }*/
+
+            // Edges of tiles edited through wall() aren't prepared until commit()
+            const World::TileEdges* edges = world.edges(tileIndex);
+            glm::vec2 tileCorner(ray->tileHitPos);
+            float edgeDis;
+            uint32_t edge;
+            float closeDis = INFINITY;
+            glm::vec2 closeHitPoint;
+            float closeTexCoord;
+            if (fixed)
+            {
+              // From where the ray entered the tile, which is exact however far
+              // the tile is from the start
+              if (edges && hitEdges(*edges, inTile, rayDir, edgeDis, edge))
+              {
+                glm::vec2 inTileHit = inTile + rayDir * edgeDis;
+                closeHitPoint = tileCorner + inTileHit;
+                closeDis = edgeDis;
+                closeTexCoord = edges->texCoordX[edge] ? inTileHit.x : inTileHit.y;
+              }
+            } else if (edges && hitEdges(*edges, startPos - tileCorner, rayDir, edgeDis, edge))
+            {
+              closeHitPoint = startPos + rayDir * edgeDis;
+              if (ray->verticalHit)
+              {
+                closeDis = tileDelta.y * (rayDir.y > 0.0f ? (closeHitPoint.y - tileCorner.y) : (1.0f - (closeHitPoint.y - tileCorner.y)));
+              } else
+              {
+                closeDis = tileDelta.x * (rayDir.x > 0.0f ? (closeHitPoint.x - tileCorner.x) : (1.0f - (closeHitPoint.x - tileCorner.x)));
+              }
+              closeTexCoord = edges->texCoordX[edge] ? closeHitPoint.x - tileCorner.x : closeHitPoint.y - tileCorner.y;
+            }
+
+            if (closeDis != INFINITY) 
+            {
+              hitWall = true;
+
+              if (fixed)
+              {
+                state.hitDis += closeDis;
+              } else if (ray->verticalHit)
+              {
+                edgeDelta.y += closeDis;
+              } else
+              {
+                edgeDelta.x += closeDis;
+              }
+
+              ray->hitPos = closeHitPoint;
+
+              ray->texCoord = closeTexCoord;
+              
+              //ray->verticalHit = true;
+            }
+            break;
+          } /*case Wall::Mirror:
+            if (ray->verticalHit) 
+            {
+              stepDir.y = -stepDir.y;
+              ray->tileHitPos.y += stepDir.y;
+              // including these lines messed up the texture coordinates in
+              // mirrors
+              // startPos.y = -startPos.y;
+              // rayDir.y = -rayDir.y;
+            } else 
+            {
+              stepDir.x = -stepDir.x;
+              ray->tileHitPos.x += stepDir.x;
+              startPos.x = -startPos.x;
+              rayDir.x = -rayDir.x;
+            }
+            break;*/
+          case Wall::Empty:
+            break;
+        }
+      } else if (skipEmpty)
+      {
+        state.edgeDelta = edgeDelta;
+        state.tile = tile;
+        if (fixed)
+        {
+          crossEmptySpaceFixed(state, *ray);
+        } else
+        {
+          crossEmptySpace(state, *ray);
+        }
+        edgeDelta = state.edgeDelta;
+        tile = state.tile;
+      }
+    }
+
+    // Misses end where they crossed their last edge
+    if (fixed && !hitWall)
+    {
+      placeFixedHit(state, *ray);
+    }
+
+    state.edgeDelta = edgeDelta;
+    state.tile = tile;
+    RAYCAST_STAT(if (stats) stats->steps += steps;)
+
+    return hitWall;
+  }
+
+  bool RayCaster::stepFixed(RayState& state)
+  {
+    constexpr uint64_t one = uint64_t(1) << 32;
+
+    // Ties go to y, as they do in floats
+    bool vertical = !(state.errorX < state.errorY);
+    if (vertical)
+    {
+      state.lastEdge = state.nextEdge.y;
+      state.nextEdge.y += one;
+      state.errorY += state.dirFixed.x << 32;
+    } else
+    {
+      state.lastEdge = state.nextEdge.x;
+      state.nextEdge.x += one;
+      state.errorX += state.dirFixed.y << 32;
+    }
+
+    // One of them ends up 0 and the other below 2^56, however far the ray goes
+    uint64_t common = glm::min(state.errorX, state.errorY);
+    state.errorX -= common;
+    state.errorY -= common;
+    return vertical;
+  }
+
+  glm::vec2 RayCaster::placeFixedHit(RayState& state, RayCastData& rayData)
+  {
+    RayCastData *ray = &rayData;
+
+    constexpr int64_t one = int64_t(1) << 32;
+    int axis = ray->verticalHit;
+    int across = !axis;
+    uint64_t dir = state.dirFixed[axis];
+    glm::i64vec2 corner = glm::i64vec2(ray->tileHitPos) * one;
+
+    // On the crossed edge, and across it as far as the ray got meanwhile,
+    // rounded towards the start
+    glm::i64vec2 hitFixed;
+    hitFixed[axis] = corner[axis] + (state.stepDir[axis] < 0 ? one : 0);
+    uint64_t along = dir ? divideWide(multiplyWide(state.lastEdge, state.dirFixed[across]), dir).low : 0;
+    hitFixed[across] = state.startFixed[across] + (state.stepDir[across] < 0 ? -int64_t(along) : int64_t(along));
+
+    // Each conversion rounds once, to the nearest float
+    ray->hitPos = glm::vec2(std::ldexp(float(hitFixed.x), -32), std::ldexp(float(hitFixed.y), -32));
+    state.hitDis = dir ? std::ldexp(wideToFloat(divideWide(multiplyWide(state.lastEdge, uint64_t(1) << 32), dir)), state.dirShift - 64) : 0.0f;
+
+    return glm::vec2(std::ldexp(float(hitFixed.x - corner.x), -32), std::ldexp(float(hitFixed.y - corner.y), -32));
+  }
+
+  void RayCaster::hitFilled(glm::vec2 rayDir, RayCastData& rayData)
+  {
+    RayCastData *ray = &rayData;
+
+    ray->texCoord = ray->hitPos[!ray->verticalHit] - ray->tileHitPos[!ray->verticalHit];
+    if (ray->tileHit->colorData.size() == 1)
+    {
+      ray->surfaceHit = 0;
+    } else
+    {
+      if (ray->verticalHit)
+      {
+        if (rayDir.y > 0.0f)
+        {
+          ray->surfaceHit = 0;
+        } else
+        {
+          ray->surfaceHit = 1;
+        }
+      } else
+      {
+        if (rayDir.x > 0.0f)
+        {
+          ray->surfaceHit = 2;
+        } else
+        {
+          ray->surfaceHit = 3;
+        }
+      }
+    }
+  }
+
+  bool RayCaster::hitEdges(const World::TileEdges& edges, glm::vec2 origin, glm::vec2 rayDir, float& hitDis, uint32_t& hitEdge)
+  {
+    // Clip the ray to the bounds first, most rays through a tile with a small shape miss it
+    float nearDis = 0.0f;
+    float farDis = INFINITY;
+    for (int axis = 0; axis < 2; axis++)
+    {
+      if (rayDir[axis] == 0.0f)
+      {
+        if (origin[axis] < edges.boundsMin[axis] || origin[axis] > edges.boundsMax[axis])
+        {
+          return false;
+        }
+      } else
+      {
+        float dis1 = (edges.boundsMin[axis] - origin[axis]) / rayDir[axis];
+        float dis2 = (edges.boundsMax[axis] - origin[axis]) / rayDir[axis];
+        nearDis = glm::max(nearDis, glm::min(dis1, dis2));
+        farDis = glm::min(farDis, glm::max(dis1, dis2));
+      }
+    }
+    // Some slack, so edges on the bounds aren't lost to rounding
+    if (nearDis > farDis * 1.0001f + 0.0001f)
+    {
+      return false;
+    }
+
+    // origin + rayDir*dis = start + dir*along, solved for every edge of a packet at once
+    // Edges without a direction divide by 0, which fails the range checks
+    constexpr uint32_t width = simd::packetWidth;
+    alignas(32) float packetDis[width];
+    simd::FloatN vOriginX = simd::splat(origin.x), vOriginY = simd::splat(origin.y);
+    simd::FloatN vRayX = simd::splat(rayDir.x), vRayY = simd::splat(rayDir.y);
+    simd::FloatN vZero = simd::zeroFloat(), vOne = simd::splat(1.0f), vMiss = simd::splat(INFINITY);
+
+    hitDis = INFINITY;
+    for (uint32_t first = 0; first < edges.edgeCount; first += width)
+    {
+      const float* packet = edges.packets.data() + first * 4;
+      simd::FloatN toStartX = simd::sub(simd::loadUnaligned(packet), vOriginX);
+      simd::FloatN toStartY = simd::sub(simd::loadUnaligned(packet + width), vOriginY);
+      simd::FloatN dirX = simd::loadUnaligned(packet + width*2);
+      simd::FloatN dirY = simd::loadUnaligned(packet + width*3);
+
+      simd::FloatN denom = simd::sub(simd::mul(vRayX, dirY), simd::mul(vRayY, dirX));
+      simd::FloatN dis = simd::div(simd::sub(simd::mul(toStartX, dirY), simd::mul(toStartY, dirX)), denom);
+      simd::FloatN along = simd::div(simd::sub(simd::mul(toStartX, vRayY), simd::mul(toStartY, vRayX)), denom);
+
+      simd::FloatN hit = simd::bitAnd(simd::lessEqual(vZero, dis), simd::bitAnd(simd::lessEqual(vZero, along), simd::lessEqual(along, vOne)));
+      simd::store(packetDis, simd::select(hit, dis, vMiss));
+
+      // In edge order, so the first of equally near edges wins
+      for (uint32_t lane = 0; lane < width && first + lane < edges.edgeCount; lane++)
+      {
+        if (packetDis[lane] < hitDis)
+        {
+          hitDis = packetDis[lane];
+          hitEdge = first + lane;
+        }
+      }
+    }
+
+    return hitDis != INFINITY;
+  }
+
+  void RayCaster::crossEmptySpace(RayState& state, RayCastData& rayData) const
+  {
+    RayCastData *ray = &rayData;
+
+    uint32_t emptyShift = world.emptyShift(ray->tileHitPos);
+    if (emptyShift == 0)
+    {
+      return;
+    }
+
+    glm::vec2 edgeDelta = state.edgeDelta;
+    glm::vec2 tileDelta = state.tileDelta;
+    uint32_t tile = state.tile;
+    glm::i8vec2 stepDir = state.stepDir;
+
+    // Steps left along each axis before the ray leaves the square
+    // Squares are aligned to the world's origin
+    glm::ivec2 squareMin = world.origin() + (((ray->tileHitPos - world.origin()) >> int(emptyShift)) << int(emptyShift));
+    glm::ivec2 squareMax = squareMin + int((1u << emptyShift) - 1);
+    uint32_t stepsX = stepDir.x > 0 ? squareMax.x - ray->tileHitPos.x : ray->tileHitPos.x - squareMin.x;
+    uint32_t stepsY = stepDir.y > 0 ? squareMax.y - ray->tileHitPos.y : ray->tileHitPos.y - squareMin.y;
+
+    uint32_t takenX = 0;
+    uint32_t takenY = 0;
+    if (tile + 1 + stepsX + stepsY <= renderDistance)
+    {
+      // Each axis only ever adds its own tileDelta, so both edge distances can be
+      // run ahead separately with the same additions a single step would do
+      // The ray leaves through whichever side's edge it reaches first, ties going to y
+      float exitX = edgeDelta.x, lastX = 0.0f;
+      for (uint32_t step = 0; step < stepsX; step++)
+      {
+        lastX = exitX;
+        exitX += tileDelta.x;
+      }
+      float exitY = edgeDelta.y, lastY = 0.0f;
+      for (uint32_t step = 0; step < stepsY; step++)
+      {
+        lastY = exitY;
+        exitY += tileDelta.y;
+      }
+
+      // Count the steps the other axis takes before that
+      if (exitX < exitY)
+      {
+        takenX = stepsX;
+        for (exitY = edgeDelta.y; exitY <= exitX; takenY++)
+        {
+          lastY = exitY;
+          exitY += tileDelta.y;
+        }
+      } else
+      {
+        takenY = stepsY;
+        for (exitX = edgeDelta.x; takenX < stepsX && exitX < exitY; takenX++)
+        {
+          lastX = exitX;
+          exitX += tileDelta.x;
+        }
+      }
+
+      if (takenX + takenY > 0)
+      {
+        RAYCAST_STAT(if (stats) stats->emptySkips++;)
+        // The last step is the later one of the two axes
+        ray->verticalHit = takenX == 0 || (takenY > 0 && lastX < lastY);
+        ray->hitPos = state.startPos + state.rayDir * (ray->verticalHit ? lastY : lastX);
+      }
+      edgeDelta = glm::vec2(exitX, exitY);
+    } else
+    {
+      // Close to renderDistance, step one tile at a time so the ray stops in the same place
+      bool stepped = false;
+      float lastEdge = 0.0f;
+      while (tile + takenX + takenY + 1 < renderDistance) 
+      {
+        if (edgeDelta.x < edgeDelta.y) 
+        {
+          if (takenX == stepsX)
+          {
+            break;
+          }
+          lastEdge = edgeDelta.x;
+          edgeDelta.x += tileDelta.x;
+          takenX++;
+          ray->verticalHit = false;
+        } else 
+        {
+          if (takenY == stepsY)
+          {
+            break;
+          }
+          lastEdge = edgeDelta.y;
+          edgeDelta.y += tileDelta.y;
+          takenY++;
+          ray->verticalHit = true;
+        }
+        stepped = true;
+      }
+
+      if (stepped)
+      {
+        ray->hitPos = state.startPos + state.rayDir * lastEdge;
+      }
+    }
+
+    ray->tileHitPos += glm::ivec2(takenX * stepDir.x, takenY * stepDir.y);
+    state.edgeDelta = edgeDelta;
+    state.tile = tile + takenX + takenY;
+  }
+
+  void RayCaster::crossEmptySpaceFixed(RayState& state, RayCastData& rayData) const
+  {
+    RayCastData *ray = &rayData;
+
+    uint32_t emptyShift = world.emptyShift(ray->tileHitPos);
+    if (emptyShift == 0)
+    {
+      return;
+    }
+
+    glm::i8vec2 stepDir = state.stepDir;
+    // Squares are aligned to the world's origin
+    glm::ivec2 squareMin = world.origin() + (((ray->tileHitPos - world.origin()) >> int(emptyShift)) << int(emptyShift));
+    glm::ivec2 squareMax = squareMin + int((1u << emptyShift) - 1);
+    uint32_t stepsX = stepDir.x > 0 ? squareMax.x - ray->tileHitPos.x : ray->tileHitPos.x - squareMin.x;
+    uint32_t stepsY = stepDir.y > 0 ? squareMax.y - ray->tileHitPos.y : ray->tileHitPos.y - squareMin.y;
+
+    // Integer steps are cheap, it's reading the tiles that gets skipped, so this
+    // steps one edge at a time and stops where single steps would
+    uint32_t takenX = 0;
+    uint32_t takenY = 0;
+    while (state.tile + takenX + takenY + 1 < renderDistance)
+    {
+      bool vertical = !(state.errorX < state.errorY);
+      if (vertical ? takenY == stepsY : takenX == stepsX)
+      {
+        break;
+      }
+      stepFixed(state);
+      if (vertical)
+      {
+        takenY++;
+      } else
+      {
+        takenX++;
+      }
+      ray->verticalHit = vertical;
+    }
+
+    RAYCAST_STAT(if (stats && takenX + takenY > 0) stats->emptySkips++;)
+    ray->tileHitPos += glm::ivec2(takenX * stepDir.x, takenY * stepDir.y);
+    state.tile += takenX + takenY;
+  }
+
+  template<bool seeThrough>
+  bool RayCaster::finishRay(RayState& state, bool hitWall, float startDis, RayCastData& rayData) const
+  {
+    RayCastData *ray = &rayData;
+    glm::vec2& rayDir = state.rayDir;
+    glm::vec2 edgeDelta = state.edgeDelta;
+    glm::vec2 tileDelta = state.tileDelta;
+
+    bool continueCasting = false;
+
+    if (seeThrough && hitWall && ray->tileHit->colorData[ray->surfaceHit].reflection > 0.0f)
+    {
+      continueCasting = true;
+      rayDir[ray->verticalHit] = -rayDir[ray->verticalHit];
+    }
+
+    if (fixedPoint)
+    {
+      ray->dis = state.hitDis + startDis;
+    } else if (ray->verticalHit) 
+    {
+      ray->dis = (edgeDelta.y - tileDelta.y) + startDis;
+      // returnValue.hitPos = startPos + rayDir*returnValue.dis;
+    } else 
+    {
+      ray->dis = (edgeDelta.x - tileDelta.x) + startDis;
+      // returnValue.hitPos = startPos + rayDir*returnValue.dis;
+    }
+
+    if (!hitWall) 
+    {
+      ray->tileHit = nullptr;
+    } else if (seeThrough)
+    {
+      continueCasting |= ray->tileHit->colorData[ray->surfaceHit].color.a < 1.0f;
+    }
+
+    return hitWall && continueCasting;
+  }
+}
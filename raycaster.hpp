@@ -0,0 +1,225 @@
+#ifndef RAYCAST_RAY_CASTER_HPP
+#define RAYCAST_RAY_CASTER_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include <glm/ext/vector_float2.hpp>
+#include <glm/ext/vector_int2.hpp>
+#include <glm/ext/vector_int2_sized.hpp>
+#include <glm/ext/vector_uint2_sized.hpp>
+
+#include "framestats.hpp"
+#include "wall.hpp"
+#include "world.hpp"
+#include "workerpool.hpp"
+
+namespace pf
+{
+  struct RayCastData
+  {
+    const Wall *tileHit = nullptr;
+    glm::vec2 hitPos;
+    uint32_t surfaceHit;
+    float texCoord;
+    float dis;
+    bool verticalHit;
+    glm::ivec2 tileHitPos;
+  };
+
+  // Casts rays through the tiles of a world
+  // Only reads the world, so any number of threads can cast through the same
+  // caster at once as long as nothing commits to the world meanwhile
+  class RayCaster
+  {
+    public:
+      enum QueryMode
+      {
+        // Stops at the first surface that can't be seen through, passing
+        // transparent surfaces and not following reflections
+        FirstOpaque,
+
+        // Stops at the first surface of any kind
+        AnyHit
+      };
+
+      // Side of a tile
+      enum Face : uint8_t
+      {
+        MinY,
+        MaxY,
+        MinX,
+        MaxX
+      };
+
+      struct QueryHit
+      {
+        glm::ivec2 tile = glm::ivec2(0);
+        glm::vec2 point = glm::vec2(0.0f);
+        // Distance from the origin, INFINITY when nothing was hit in range
+        float dis = INFINITY;
+        // Side of the tile the ray entered through
+        Face face = MinY;
+      };
+
+      // Traversal compiled for the tiles a world uses, so rays through worlds
+      // without shapes or see through surfaces skip the checks for them
+      enum Kernel : uint8_t
+      {
+        FilledOpaque,
+        ShapesOpaque,
+        FilledSeeThrough,
+        Full
+      };
+
+      // Rays stop after crossing renderDistance tiles
+      // Picks the kernel for the world's committed tiles, or Full while it has
+      // uncommitted edits
+      // With fixedPoint, rays are traced in 32.32 fixed point instead of by
+      // adding up float distances, see traverseRay()
+      RayCaster(const World& world, uint32_t renderDistance = -1, bool skipEmptySpace = true, bool fixedPoint = false);
+
+      Kernel getKernel() const
+      {
+        return kernel;
+      }
+
+      // Counts the work of later casts into stats, see framestats.hpp
+      // Note: The counts aren't atomic, so a caster counting into stats must only
+      // be used by one thread at a time, which rules out query() with workers
+      void setStats(RayStats* rayStats)
+      {
+        stats = rayStats;
+      }
+
+      // Writes at most maxHits hits into hits and returns how many were written
+      // Transparent and reflective surfaces continue the ray until maxHits is reached
+      uint32_t castHits(glm::vec2 startPos, glm::vec2 rayDir, RayCastData* hits, uint32_t maxHits, float startDis = 0.0f, uint32_t startRenderDis = 0) const;
+
+      // Casts until the next surface and advances the arguments past it
+      // Returns whether the ray continues through that surface
+      bool castSegment(glm::vec2& startPos, glm::vec2& rayDir, float& startDis, uint32_t& startRenderDis, RayCastData& rayData) const;
+
+      // Casts simd::packetWidth rays from the same point, equivalent to castHits() on each
+      // In fixed point it is castHits() on each
+      // Lane l writes its hits to hits[l*maxHits] and their count to hitCounts[l]
+      void castRayPacket(glm::vec2 startPos, const glm::vec2* rayDirs, RayCastData* hits, uint32_t maxHits, uint32_t* hitCounts) const;
+
+      // Casts count rays from origins[i] along dirs[i] and writes what they hit to hits[i]
+      // Distances are in world units whatever the length of dirs[i], and rays give
+      // up past maxDis[i], or renderDistance tiles if maxDis is null
+      // Splits the rays across the workers when given
+      void query(const glm::vec2* origins, const glm::vec2* dirs, const float* maxDis, size_t count, QueryMode mode, QueryHit* hits, WorkerPool* workers = nullptr) const;
+
+      QueryHit query(glm::vec2 origin, glm::vec2 dir, float maxDis, QueryMode mode) const;
+
+    private:
+      // Traversal state of a single ray, so a ray can be handed between the
+      // packet and scalar paths mid flight
+      struct RayState
+      {
+        glm::vec2 startPos;
+        glm::vec2 rayDir;
+        glm::vec2 edgeDelta;
+        glm::vec2 tileDelta;
+        glm::i8vec2 stepDir;
+        uint32_t tile;
+
+        // Only used in fixed point
+        // The start in 32.32 fixed point, exactly, and the direction's components
+        // scaled by 2^dirShift and truncated to whole numbers below 2^24
+        // The larger component keeps all its bits, the smaller loses those below
+        // the larger one's last, which turns the ray by less than 2^-23 radians
+        // Every step and hit of the ray goes by the truncated direction
+        glm::i64vec2 startFixed;
+        glm::u64vec2 dirFixed;
+        int32_t dirShift;
+        // How far the ray goes along each axis, in 2^-32 tiles, until the next
+        // tile edge on that axis, and until the edge it crossed last
+        glm::u64vec2 nextEdge;
+        uint64_t lastEdge;
+        // nextEdge.x * dirFixed.y and nextEdge.y * dirFixed.x, less what they
+        // have in common, so the nearer edge is the smaller one exactly
+        uint64_t errorX;
+        uint64_t errorY;
+        float hitDis;
+      };
+
+      // Calls function with the kernel's shapes and see through flags as
+      // std::bool_constant, so it can instantiate templates for them
+      template<typename Function>
+      auto withKernel(Function function) const
+      {
+        if (kernel == FilledOpaque)
+        {
+          return function(std::false_type(), std::false_type());
+        } else if (kernel == ShapesOpaque)
+        {
+          return function(std::true_type(), std::false_type());
+        } else if (kernel == FilledSeeThrough)
+        {
+          return function(std::false_type(), std::true_type());
+        }
+        return function(std::true_type(), std::true_type());
+      }
+
+      template<bool shapes, bool seeThrough>
+      bool castSegment(glm::vec2& startPos, glm::vec2& rayDir, float& startDis, uint32_t& startRenderDis, RayCastData& rayData) const;
+
+      template<bool shapes, bool seeThrough>
+      void castRayPacket(glm::vec2 startPos, const glm::vec2* rayDirs, RayCastData* hits, uint32_t maxHits, uint32_t* hitCounts) const;
+
+      template<bool shapes, bool seeThrough>
+      QueryHit query(glm::vec2 origin, glm::vec2 dir, float maxDis, QueryMode mode) const;
+
+      void beginRay(glm::vec2 startPos, glm::vec2 rayDir, uint32_t startRenderDis, RayState& state, RayCastData& rayData) const;
+
+      // Without shapes every occupied tile is filled
+      // In fixed point the tiles crossed and the hits on filled tiles only take
+      // integer arithmetic and exact conversions, so they come out the same on
+      // every compiler and CPU, and don't get less precise far from the origin
+      // Shapes are still hit in floats, from where the ray entered their tile
+      template<bool shapes, bool fixed>
+      bool traverseRay(RayState& state, RayCastData& rayData) const;
+
+      // Crosses the nearer tile edge of a fixed point ray
+      // Returns whether it was an edge along x, like RayCastData::verticalHit
+      static bool stepFixed(RayState& state);
+
+      // Sets the hit position and distance of a fixed point ray to where it
+      // crossed its last edge, returning that position relative to the tile's corner
+      static glm::vec2 placeFixedHit(RayState& state, RayCastData& rayData);
+
+      static void hitFilled(glm::vec2 rayDir, RayCastData& rayData);
+
+      // Finds the nearest edge the ray from origin, relative to the tile's corner,
+      // hits at a distance of at least 0, testing a packet of edges at a time
+      // Returns false when it hits none
+      static bool hitEdges(const World::TileEdges& edges, glm::vec2 origin, glm::vec2 rayDir, float& hitDis, uint32_t& hitEdge);
+
+      // Moves the ray from an empty tile up to the last tile it visits in the
+      // empty square around it, with the same arithmetic as visiting each tile
+      void crossEmptySpace(RayState& state, RayCastData& rayData) const;
+
+      void crossEmptySpaceFixed(RayState& state, RayCastData& rayData) const;
+
+      // Returns whether the ray continues, with state.rayDir reflected if needed
+      // Without see through surfaces it never does
+      template<bool seeThrough>
+      bool finishRay(RayState& state, bool hitWall, float startDis, RayCastData& rayData) const;
+
+      // Rays handed to each worker task by query()
+      static constexpr uint32_t raysPerTask = 256;
+
+      const World& world;
+      uint32_t renderDistance;
+      bool skipEmptySpace;
+      bool fixedPoint;
+      Kernel kernel;
+      RayStats* stats = nullptr;
+  };
+}
+
+#endif // RAYCAST_RAY_CASTER_HPP
@@ -0,0 +1,61 @@
+#include "sharedworld.hpp"
+
+namespace pf
+{
+  SharedWorld::SharedWorld(glm::uvec2 size) :
+  spares{std::make_shared<SpareWorlds>()}
+  {
+    working.resize(size);
+    current = std::shared_ptr<const World>(new World(working), Recycle{spares});
+  }
+
+  void SharedWorld::publish()
+  {
+    working.commit();
+
+    if (current->id() == working.id() && current->changeCount() == working.changeCount())
+    {
+      return;
+    }
+
+    std::unique_ptr<World> next;
+    {
+      std::lock_guard<std::mutex> lock(spares->mutex);
+      if (!spares->worlds.empty())
+      {
+        next = std::move(spares->worlds.back());
+        spares->worlds.pop_back();
+      }
+    }
+
+    if (!next || !next->catchUp(working))
+    {
+      next = std::make_unique<World>(working);
+    }
+
+    std::shared_ptr<const World> published(next.release(), Recycle{spares});
+    {
+      std::lock_guard<std::mutex> lock(currentMutex);
+      current.swap(published);
+    }
+    // The old snapshot goes to the spares here unless someone still holds it
+  }
+
+  std::shared_ptr<const World> SharedWorld::snapshot() const
+  {
+    std::lock_guard<std::mutex> lock(currentMutex);
+    return current;
+  }
+
+  // private members
+  void SharedWorld::Recycle::operator()(World* world) const
+  {
+    std::unique_ptr<World> spare(world);
+
+    std::lock_guard<std::mutex> lock(spares->mutex);
+    if (spares->worlds.size() < maxSpares)
+    {
+      spares->worlds.push_back(std::move(spare));
+    }
+  }
+}
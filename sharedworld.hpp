@@ -0,0 +1,66 @@
+#ifndef RAYCAST_SHARED_WORLD_HPP
+#define RAYCAST_SHARED_WORLD_HPP
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <glm/ext/vector_uint2.hpp>
+
+#include "world.hpp"
+
+namespace pf
+{
+  // A world that many cameras and threads read while one thread edits it
+  // Readers hold immutable snapshots, edits go to a private working copy and
+  // reach later snapshots on publish(), so neither side waits for the other
+  class SharedWorld
+  {
+    public:
+      SharedWorld(glm::uvec2 size = glm::uvec2(0));
+
+      // The working copy, for the editing thread only
+      // Note: Edits don't show up in snapshots until publish()
+      World& edit()
+      {
+        return working;
+      }
+
+      // Makes the edits so far visible to later snapshots
+      // Reuses a snapshot nobody holds anymore by copying only the tiles changed
+      // since it was published, otherwise copies the whole world
+      void publish();
+
+      // The latest published world, which never changes while it is held
+      // Safe to call from any thread
+      std::shared_ptr<const World> snapshot() const;
+
+    private:
+      // Snapshots nobody holds anymore, shared with the snapshots themselves so
+      // they can be handed back after the SharedWorld is gone
+      struct SpareWorlds
+      {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<World>> worlds;
+      };
+
+      // Deleter of snapshots, which hands them back to the spares
+      struct Recycle
+      {
+        std::shared_ptr<SpareWorlds> spares;
+
+        void operator()(World* world) const;
+      };
+
+      // More than this many spares are freed
+      static constexpr size_t maxSpares = 2;
+
+      World working;
+      std::shared_ptr<SpareWorlds> spares;
+
+      mutable std::mutex currentMutex;
+      std::shared_ptr<const World> current;
+  };
+}
+
+#endif // RAYCAST_SHARED_WORLD_HPP
@@ -0,0 +1,160 @@
+#ifndef RAYCAST_SIMD_HPP
+#define RAYCAST_SIMD_HPP
+
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+  #include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+  #include <intrin.h>
+#endif
+
+// Thin wrappers over the widest float/int32 vectors the target supports
+// Only the handful of operations the packet traversal needs are provided
+namespace pf::simd
+{
+#if defined(__AVX2__)
+  constexpr uint32_t packetWidth = 8;
+
+  typedef __m256 FloatN;
+  typedef __m256i IntN;
+
+  inline FloatN load(const float* values) { return _mm256_load_ps(values); }
+  inline FloatN loadUnaligned(const float* values) { return _mm256_loadu_ps(values); }
+  inline IntN load(const int32_t* values) { return _mm256_load_si256((const __m256i*)values); }
+  inline void store(float* values, FloatN v) { _mm256_store_ps(values, v); }
+  inline void storeUnaligned(float* values, FloatN v) { _mm256_storeu_ps(values, v); }
+  inline void store(int32_t* values, IntN v) { _mm256_store_si256((__m256i*)values, v); }
+
+  inline FloatN zeroFloat() { return _mm256_setzero_ps(); }
+  inline FloatN splat(float value) { return _mm256_set1_ps(value); }
+  inline IntN zeroInt() { return _mm256_setzero_si256(); }
+
+  inline FloatN add(FloatN a, FloatN b) { return _mm256_add_ps(a, b); }
+  inline IntN add(IntN a, IntN b) { return _mm256_add_epi32(a, b); }
+  inline FloatN sub(FloatN a, FloatN b) { return _mm256_sub_ps(a, b); }
+  inline FloatN mul(FloatN a, FloatN b) { return _mm256_mul_ps(a, b); }
+  inline FloatN div(FloatN a, FloatN b) { return _mm256_div_ps(a, b); }
+
+  inline FloatN lessThan(FloatN a, FloatN b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  inline FloatN lessEqual(FloatN a, FloatN b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+  inline FloatN bitAnd(FloatN a, FloatN b) { return _mm256_and_ps(a, b); }
+
+  inline FloatN select(FloatN mask, FloatN a, FloatN b) { return _mm256_blendv_ps(b, a, mask); }
+  inline IntN select(IntN mask, IntN a, IntN b) { return _mm256_blendv_epi8(b, a, mask); }
+
+  inline IntN bitNot(IntN a) { return _mm256_xor_si256(a, _mm256_set1_epi32(-1)); }
+
+  // All ones in each lane whose bit in laneBits is also set in bits
+  inline IntN testBits(IntN laneBits, uint32_t bits) { return _mm256_cmpeq_epi32(_mm256_and_si256(laneBits, _mm256_set1_epi32(bits)), laneBits); }
+
+  inline IntN asInt(FloatN a) { return _mm256_castps_si256(a); }
+  inline FloatN asFloat(IntN a) { return _mm256_castsi256_ps(a); }
+#elif defined(__SSE2__)
+  constexpr uint32_t packetWidth = 4;
+
+  typedef __m128 FloatN;
+  typedef __m128i IntN;
+
+  inline FloatN load(const float* values) { return _mm_load_ps(values); }
+  inline FloatN loadUnaligned(const float* values) { return _mm_loadu_ps(values); }
+  inline IntN load(const int32_t* values) { return _mm_load_si128((const __m128i*)values); }
+  inline void store(float* values, FloatN v) { _mm_store_ps(values, v); }
+  inline void storeUnaligned(float* values, FloatN v) { _mm_storeu_ps(values, v); }
+  inline void store(int32_t* values, IntN v) { _mm_store_si128((__m128i*)values, v); }
+
+  inline FloatN zeroFloat() { return _mm_setzero_ps(); }
+  inline FloatN splat(float value) { return _mm_set1_ps(value); }
+  inline IntN zeroInt() { return _mm_setzero_si128(); }
+
+  inline FloatN add(FloatN a, FloatN b) { return _mm_add_ps(a, b); }
+  inline IntN add(IntN a, IntN b) { return _mm_add_epi32(a, b); }
+  inline FloatN sub(FloatN a, FloatN b) { return _mm_sub_ps(a, b); }
+  inline FloatN mul(FloatN a, FloatN b) { return _mm_mul_ps(a, b); }
+  inline FloatN div(FloatN a, FloatN b) { return _mm_div_ps(a, b); }
+
+  inline FloatN lessThan(FloatN a, FloatN b) { return _mm_cmplt_ps(a, b); }
+  inline FloatN lessEqual(FloatN a, FloatN b) { return _mm_cmple_ps(a, b); }
+  inline FloatN bitAnd(FloatN a, FloatN b) { return _mm_and_ps(a, b); }
+
+  inline FloatN select(FloatN mask, FloatN a, FloatN b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+  inline IntN select(IntN mask, IntN a, IntN b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+
+  inline IntN bitNot(IntN a) { return _mm_xor_si128(a, _mm_set1_epi32(-1)); }
+
+  // All ones in each lane whose bit in laneBits is also set in bits
+  inline IntN testBits(IntN laneBits, uint32_t bits) { return _mm_cmpeq_epi32(_mm_and_si128(laneBits, _mm_set1_epi32(bits)), laneBits); }
+
+  inline IntN asInt(FloatN a) { return _mm_castps_si128(a); }
+  inline FloatN asFloat(IntN a) { return _mm_castsi128_ps(a); }
+#else
+  // Scalar fallback, one lane per "packet"
+  constexpr uint32_t packetWidth = 1;
+
+  typedef float FloatN;
+  typedef int32_t IntN;
+
+  inline FloatN load(const float* values) { return *values; }
+  inline FloatN loadUnaligned(const float* values) { return *values; }
+  inline IntN load(const int32_t* values) { return *values; }
+  inline void store(float* values, FloatN v) { *values = v; }
+  inline void storeUnaligned(float* values, FloatN v) { *values = v; }
+  inline void store(int32_t* values, IntN v) { *values = v; }
+
+  inline FloatN zeroFloat() { return 0.0f; }
+  inline FloatN splat(float value) { return value; }
+  inline IntN zeroInt() { return 0; }
+
+  inline FloatN add(FloatN a, FloatN b) { return a + b; }
+  inline IntN add(IntN a, IntN b) { return a + b; }
+  inline FloatN sub(FloatN a, FloatN b) { return a - b; }
+  inline FloatN mul(FloatN a, FloatN b) { return a * b; }
+  inline FloatN div(FloatN a, FloatN b) { return a / b; }
+
+  // Masks are kept as 0.0f or 1.0f in FloatN and 0 or -1 in IntN
+  inline FloatN lessThan(FloatN a, FloatN b) { return a < b ? 1.0f : 0.0f; }
+  inline FloatN lessEqual(FloatN a, FloatN b) { return a <= b ? 1.0f : 0.0f; }
+  inline FloatN bitAnd(FloatN a, FloatN b) { return a != 0.0f && b != 0.0f ? 1.0f : 0.0f; }
+
+  inline FloatN select(FloatN mask, FloatN a, FloatN b) { return mask != 0.0f ? a : b; }
+  inline IntN select(IntN mask, IntN a, IntN b) { return mask ? a : b; }
+
+  inline IntN bitNot(IntN a) { return ~a; }
+
+  inline IntN testBits(IntN laneBits, uint32_t bits) { return (laneBits & bits) == laneBits ? -1 : 0; }
+
+  inline IntN asInt(FloatN a) { return a != 0.0f ? -1 : 0; }
+  inline FloatN asFloat(IntN a) { return a ? 1.0f : 0.0f; }
+#endif
+
+  // Index of the lowest lane set in a mask of lanes, which mustn't be 0
+  inline uint32_t lowestLane(uint32_t lanes)
+  {
+#if defined(_MSC_VER)
+    unsigned long lane;
+    _BitScanForward(&lane, lanes);
+    return lane;
+#else
+    return __builtin_ctz(lanes);
+#endif
+  }
+
+  // Number of lanes set in a mask of lanes
+  inline uint32_t laneCount(uint32_t lanes)
+  {
+#if defined(_MSC_VER)
+    // __popcnt needs a CPU with the instruction, and packets are few lanes wide
+    uint32_t count = 0;
+    for (; lanes; lanes &= lanes - 1)
+    {
+      count++;
+    }
+    return count;
+#else
+    return __builtin_popcount(lanes);
+#endif
+  }
+}
+
+#endif // RAYCAST_SIMD_HPP
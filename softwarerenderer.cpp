@@ -0,0 +1,487 @@
+#include "softwarerenderer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm/common.hpp>
+
+#include "raycast.hpp"
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+namespace pf
+{
+  namespace
+  {
+    uint32_t packColor(const glm::vec4& color)
+    {
+      glm::vec4 clamped = glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+      return uint32_t(clamped.r) | uint32_t(clamped.g) << 8 | uint32_t(clamped.b) << 16 | uint32_t(clamped.a) << 24;
+    }
+
+    // Rounded x/255 for x in [0, 255*255]
+    uint32_t divide255(uint32_t x)
+    {
+      x += 128;
+      return (x + (x >> 8)) >> 8;
+    }
+
+    uint32_t blendPixel(uint32_t dst, uint32_t src)
+    {
+      uint32_t alpha = src >> 24;
+      uint32_t inverse = 255 - alpha;
+
+      uint32_t result = divide255(255 * alpha + (dst >> 24) * inverse) << 24;
+      for (uint32_t shift = 0; shift < 24; shift += 8)
+      {
+        result |= divide255(((src >> shift) & 0xFF) * alpha + ((dst >> shift) & 0xFF) * inverse) << shift;
+      }
+      return result;
+    }
+
+    // src over dst, with the same rounding as blendPixel()
+    void blendPixels(uint32_t* dst, const uint32_t* src, uint32_t count)
+    {
+      uint32_t p = 0;
+#if defined(__SSE2__)
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i max = _mm_set1_epi16(255);
+      const __m128i half = _mm_set1_epi16(128);
+      const __m128i alphaByte = _mm_set1_epi32(0xFF000000);
+      for (; p + 4 <= count; p += 4)
+      {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + p));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + p));
+
+        // Alpha in every byte of its pixel, and the source alpha channel
+        // replaced with 255 so it blends to srcA + dstA*(1-srcA)
+        __m128i alpha = _mm_srli_epi32(s, 24);
+        alpha = _mm_or_si128(alpha, _mm_slli_epi32(alpha, 8));
+        alpha = _mm_or_si128(alpha, _mm_slli_epi32(alpha, 16));
+        s = _mm_or_si128(s, alphaByte);
+
+        __m128i halves[2];
+        for (int h = 0; h < 2; h++)
+        {
+          __m128i s16 = h ? _mm_unpackhi_epi8(s, zero) : _mm_unpacklo_epi8(s, zero);
+          __m128i d16 = h ? _mm_unpackhi_epi8(d, zero) : _mm_unpacklo_epi8(d, zero);
+          __m128i a16 = h ? _mm_unpackhi_epi8(alpha, zero) : _mm_unpacklo_epi8(alpha, zero);
+
+          __m128i x = _mm_add_epi16(_mm_mullo_epi16(s16, a16), _mm_mullo_epi16(d16, _mm_sub_epi16(max, a16)));
+          x = _mm_add_epi16(x, half);
+          halves[h] = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+        }
+
+        _mm_storeu_si128((__m128i*)(dst + p), _mm_packus_epi16(halves[0], halves[1]));
+      }
+#endif
+      for (; p < count; p++)
+      {
+        dst[p] = blendPixel(dst[p], src[p]);
+      }
+    }
+
+    uint32_t readTexel(const Texture& tex, int64_t x, int64_t y)
+    {
+      x %= int64_t(tex.width);
+      y %= int64_t(tex.height);
+      x += x < 0 ? tex.width : 0;
+      y += y < 0 ? tex.height : 0;
+
+      const uint8_t* texel = tex.data + (y * tex.width + x) * tex.channels;
+      switch (tex.channels)
+      {
+        case 1:
+          return texel[0] * 0x010101u | 0xFF000000u;
+        case 2:
+          return texel[0] * 0x010101u | uint32_t(texel[1]) << 24;
+        case 3:
+          return texel[0] | texel[1] << 8 | texel[2] << 16 | 0xFF000000u;
+        default:
+          return texel[0] | texel[1] << 8 | texel[2] << 16 | uint32_t(texel[3]) << 24;
+      }
+    }
+  }
+
+  SoftwareRenderer::SoftwareRenderer(uint8_t* framebuffer, glm::uvec2 framebufferSize, uint32_t rowStride) :
+  pixels{framebuffer}, size{framebufferSize}, stride{rowStride ? rowStride : framebufferSize.x * 4}
+  {
+
+  }
+
+  void SoftwareRenderer::clear(const glm::vec4& color)
+  {
+    uint32_t packed = packColor(color);
+    for (uint32_t y = 0; y < size.y; y++)
+    {
+      uint8_t* row = pixels + y * stride;
+      for (uint32_t x = 0; x < size.x; x++)
+      {
+        std::memcpy(row + x * 4, &packed, 4);
+      }
+    }
+  }
+
+  void SoftwareRenderer::draw(const DrawCommand* commands, size_t count)
+  {
+    if (!pixels)
+    {
+      return;
+    }
+
+    if (stride == 0)
+    {
+      stride = size.x * 4;
+    }
+
+    findOccluders(commands, count);
+
+    for (uint32_t c = 0; c < count; c++)
+    {
+      if (commands[c].type == DrawCommand::TextureQuad)
+      {
+        drawQuad(commands[c], c);
+      } else
+      {
+        drawRect(commands[c], c);
+      }
+    }
+  }
+
+  void SoftwareRenderer::render(RaycastCamera& camera)
+  {
+    const std::vector<DrawCommand>& commands = camera.buildFrame();
+    draw(commands.data(), commands.size());
+  }
+
+  // private members
+  void SoftwareRenderer::findOccluders(const DrawCommand* commands, size_t count)
+  {
+    occluders.assign(size.x, Occluder());
+
+    for (uint32_t c = 0; c < count; c++)
+    {
+      const DrawCommand& command = commands[c];
+
+      // Only fully opaque walls, textures without alpha can't have holes
+      if ((command.type == DrawCommand::TextureQuad && !isWallQuad(command)) || !(command.dis > 0.0f) || std::isinf(command.dis) || command.color.a < 1.0f)
+      {
+        continue;
+      }
+      if (command.type != DrawCommand::Rect && command.tex.data && command.tex.channels != 1 && command.tex.channels != 3)
+      {
+        continue;
+      }
+
+      if (command.type == DrawCommand::TextureQuad)
+      {
+        int32_t left, right;
+        wallQuadColumns(command, left, right);
+        for (int32_t x = left; x < right; x++)
+        {
+          int32_t top, bottom;
+          glm::vec2 texStart, texStep;
+          wallQuadRows(command, x, top, bottom, texStart, texStep);
+
+          Occluder& occluder = occluders[x];
+          if (bottom - top >= occluder.bottom - occluder.top)
+          {
+            occluder.command = c;
+            occluder.top = top;
+            occluder.bottom = bottom;
+          }
+        }
+        continue;
+      }
+
+      glm::vec2 corner1 = toPixels(glm::min(command.pos[0], command.pos[1]));
+      glm::vec2 corner2 = toPixels(glm::max(command.pos[0], command.pos[1]));
+      int32_t left = glm::clamp<float>(std::ceil(corner1.x - 0.5f), 0.0f, size.x);
+      int32_t right = glm::clamp<float>(std::ceil(corner2.x - 0.5f), 0.0f, size.x);
+      int32_t top = glm::clamp<float>(std::ceil(corner1.y - 0.5f), 0.0f, size.y);
+      int32_t bottom = glm::clamp<float>(std::ceil(corner2.y - 0.5f), 0.0f, size.y);
+
+      for (int32_t x = left; x < right; x++)
+      {
+        Occluder& occluder = occluders[x];
+        if (bottom - top >= occluder.bottom - occluder.top)
+        {
+          occluder.command = c;
+          occluder.top = top;
+          occluder.bottom = bottom;
+        }
+      }
+    }
+  }
+
+  void SoftwareRenderer::drawRect(const DrawCommand& command, uint32_t index)
+  {
+    glm::vec2 corner1 = toPixels(command.pos[0]);
+    glm::vec2 corner2 = toPixels(command.pos[1]);
+    glm::vec2 tex1 = command.tPos[0];
+    glm::vec2 tex2 = command.tPos[1];
+    for (int axis = 0; axis < 2; axis++)
+    {
+      if (corner1[axis] > corner2[axis])
+      {
+        std::swap(corner1[axis], corner2[axis]);
+        std::swap(tex1[axis], tex2[axis]);
+      }
+    }
+
+    int32_t left = glm::clamp<float>(std::ceil(corner1.x - 0.5f), 0.0f, size.x);
+    int32_t right = glm::clamp<float>(std::ceil(corner2.x - 0.5f), 0.0f, size.x);
+    int32_t top = glm::clamp<float>(std::ceil(corner1.y - 0.5f), 0.0f, size.y);
+    int32_t bottom = glm::clamp<float>(std::ceil(corner2.y - 0.5f), 0.0f, size.y);
+    if (left >= right || top >= bottom)
+    {
+      return;
+    }
+
+    glm::vec2 texPerPixel = (tex2 - tex1) / (corner2 - corner1);
+    glm::vec2 texStart = tex1 + (glm::vec2(left, top) + 0.5f - corner1) * texPerPixel;
+
+    // Walls are thin columns, so walk whichever way the spans are longer
+    if (right - left < bottom - top)
+    {
+      for (int32_t x = left; x < right; x++)
+      {
+        shadeSpan(command, index, x, top, true, bottom - top, texStart + glm::vec2((x - left) * texPerPixel.x, 0.0f), glm::vec2(0.0f, texPerPixel.y));
+      }
+    } else
+    {
+      for (int32_t y = top; y < bottom; y++)
+      {
+        shadeSpan(command, index, left, y, false, right - left, texStart + glm::vec2(0.0f, (y - top) * texPerPixel.y), glm::vec2(texPerPixel.x, 0.0f));
+      }
+    }
+  }
+
+  void SoftwareRenderer::drawQuad(const DrawCommand& command, uint32_t index)
+  {
+    if (isWallQuad(command))
+    {
+      drawWallQuad(command, index);
+      return;
+    }
+
+    glm::vec2 corners[4];
+    float minY = INFINITY;
+    float maxY = -INFINITY;
+    for (int p = 0; p < 4; p++)
+    {
+      corners[p] = toPixels(command.pos[p]);
+      minY = glm::min(minY, corners[p].y);
+      maxY = glm::max(maxY, corners[p].y);
+    }
+
+    int32_t top = glm::clamp<float>(std::ceil(minY - 0.5f), 0.0f, size.y);
+    int32_t bottom = glm::clamp<float>(std::ceil(maxY - 0.5f), 0.0f, size.y);
+
+    // Scanline fill of a convex quad
+    // Floor and ceiling rows are at a constant depth, so interpolating the
+    // texture linearly along a row is perspective correct
+    for (int32_t y = top; y < bottom; y++)
+    {
+      float centerY = y + 0.5f;
+
+      float leftX = INFINITY;
+      float rightX = -INFINITY;
+      glm::vec2 leftTex;
+      glm::vec2 rightTex;
+      for (int e = 0; e < 4; e++)
+      {
+        glm::vec2 a = corners[e];
+        glm::vec2 b = corners[(e+1) % 4];
+        if ((a.y <= centerY && centerY < b.y) || (b.y <= centerY && centerY < a.y))
+        {
+          float t = (centerY - a.y) / (b.y - a.y);
+          float x = a.x + (b.x - a.x) * t;
+          glm::vec2 tex = command.tPos[e] + (command.tPos[(e+1) % 4] - command.tPos[e]) * t;
+          if (x < leftX)
+          {
+            leftX = x;
+            leftTex = tex;
+          }
+          if (x > rightX)
+          {
+            rightX = x;
+            rightTex = tex;
+          }
+        }
+      }
+
+      int32_t left = glm::clamp<float>(std::ceil(leftX - 0.5f), 0.0f, size.x);
+      int32_t right = glm::clamp<float>(std::ceil(rightX - 0.5f), 0.0f, size.x);
+      if (left >= right)
+      {
+        continue;
+      }
+
+      glm::vec2 texStep = (rightTex - leftTex) / (rightX - leftX);
+      shadeSpan(command, index, left, y, false, right - left, leftTex + texStep * (left + 0.5f - leftX), texStep);
+    }
+  }
+
+  void SoftwareRenderer::drawWallQuad(const DrawCommand& command, uint32_t index)
+  {
+    int32_t left, right;
+    wallQuadColumns(command, left, right);
+    for (int32_t x = left; x < right; x++)
+    {
+      int32_t top, bottom;
+      glm::vec2 texStart, texStep;
+      wallQuadRows(command, x, top, bottom, texStart, texStep);
+      if (top < bottom)
+      {
+        shadeSpan(command, index, x, top, true, bottom - top, texStart, texStep);
+      }
+    }
+  }
+
+  void SoftwareRenderer::wallQuadColumns(const DrawCommand& command, int32_t& left, int32_t& right) const
+  {
+    left = glm::clamp<float>(std::ceil(toPixels(command.pos[0]).x - 0.5f), 0.0f, size.x);
+    right = glm::clamp<float>(std::ceil(toPixels(command.pos[1]).x - 0.5f), 0.0f, size.x);
+  }
+
+  void SoftwareRenderer::wallQuadRows(const DrawCommand& command, int32_t x, int32_t& top, int32_t& bottom, glm::vec2& texStart, glm::vec2& texStep) const
+  {
+    glm::vec2 corners[4];
+    for (int p = 0; p < 4; p++)
+    {
+      corners[p] = toPixels(command.pos[p]);
+    }
+
+    // Screen position and 1 / depth are linear across the columns, the texture
+    // coordinate is linear once divided by depth
+    float t = (x + 0.5f - corners[0].x) / (corners[1].x - corners[0].x);
+    float leftQ = 1.0f / command.depth[0];
+    float rightQ = 1.0f / command.depth[1];
+    float q = leftQ + (rightQ - leftQ) * t;
+    glm::vec2 texTop = (command.tPos[0] * leftQ + (command.tPos[1] * rightQ - command.tPos[0] * leftQ) * t) / q;
+    glm::vec2 texBottom = (command.tPos[3] * leftQ + (command.tPos[2] * rightQ - command.tPos[3] * leftQ) * t) / q;
+    float topY = corners[0].y + (corners[1].y - corners[0].y) * t;
+    float bottomY = corners[3].y + (corners[2].y - corners[3].y) * t;
+
+    top = glm::clamp<float>(std::ceil(topY - 0.5f), 0.0f, size.y);
+    bottom = glm::clamp<float>(std::ceil(bottomY - 0.5f), 0.0f, size.y);
+
+    // Within a column the wall is at one depth, so the texture is linear down it
+    texStep = (texBottom - texTop) / (bottomY - topY);
+    texStart = texTop + (top + 0.5f - topY) * texStep;
+  }
+
+  bool SoftwareRenderer::isWallQuad(const DrawCommand& command)
+  {
+    return command.type == DrawCommand::TextureQuad && (command.depth[0] != command.depth[1] || command.depth[0] != command.depth[3] || command.depth[1] != command.depth[2]);
+  }
+
+  void SoftwareRenderer::shadeSpan(const DrawCommand& command, uint32_t index, int32_t x, int32_t y, bool vertical, uint32_t count, glm::vec2 texPos, glm::vec2 texStep)
+  {
+    glm::ivec2 step = vertical ? glm::ivec2(0, 1) : glm::ivec2(1, 0);
+    ptrdiff_t pixelStep = vertical ? ptrdiff_t(stride) : 4;
+
+    auto occluded = [&](uint32_t p)
+    {
+      const Occluder& occluder = occluders[x + step.x * p];
+      int32_t pixelY = y + step.y * p;
+      return occluder.command > index && occluder.top <= pixelY && pixelY < occluder.bottom;
+    };
+
+    uint32_t p = 0;
+    while (p < count)
+    {
+      while (p < count && occluded(p))
+      {
+        p++;
+      }
+
+      uint32_t start = p;
+      while (p < count && !occluded(p))
+      {
+        p++;
+      }
+
+      if (p > start)
+      {
+        fetchSpan(command, texPos + texStep * float(start), texStep, p - start);
+        blendSpan(pixels + (y + step.y * start) * ptrdiff_t(stride) + (x + step.x * start) * 4, pixelStep, p - start);
+      }
+    }
+  }
+
+  void SoftwareRenderer::fetchSpan(const DrawCommand& command, glm::vec2 texPos, glm::vec2 texStep, uint32_t count)
+  {
+    spanColors.resize(count);
+
+    const Texture& tex = command.tex;
+    if (command.type == DrawCommand::Rect || !tex.data || tex.width == 0 || tex.height == 0)
+    {
+      std::fill(spanColors.begin(), spanColors.end(), packColor(command.color));
+      return;
+    }
+
+    glm::vec2 texels = glm::vec2(tex.width, tex.height);
+    glm::vec2 start = texPos * texels;
+    glm::vec2 step = texStep * texels;
+    if (step.x == 0.0f && command.columnTex.data)
+    {
+      // Down a single column of the texture, which is a row of the transposed copy
+      for (uint32_t p = 0; p < count; p++)
+      {
+        spanColors[p] = readTexel(command.columnTex, std::floor(start.y + step.y * p), std::floor(start.x));
+      }
+    } else
+    {
+      for (uint32_t p = 0; p < count; p++)
+      {
+        spanColors[p] = readTexel(tex, std::floor(start.x + step.x * p), std::floor(start.y + step.y * p));
+      }
+    }
+
+    uint32_t tint = packColor(command.color);
+    if (tint != 0xFFFFFFFFu)
+    {
+      for (uint32_t& color: spanColors)
+      {
+        uint32_t tinted = 0;
+        for (uint32_t shift = 0; shift < 32; shift += 8)
+        {
+          tinted |= divide255(((color >> shift) & 0xFF) * ((tint >> shift) & 0xFF)) << shift;
+        }
+        color = tinted;
+      }
+    }
+  }
+
+  void SoftwareRenderer::blendSpan(uint8_t* dst, ptrdiff_t step, uint32_t count)
+  {
+    if (step == 4)
+    {
+      blendPixels(reinterpret_cast<uint32_t*>(dst), spanColors.data(), count);
+      return;
+    }
+
+    // Columns are gathered so they can be blended in the same wide loop
+    spanPixels.resize(count);
+    for (uint32_t p = 0; p < count; p++)
+    {
+      std::memcpy(&spanPixels[p], dst + p * step, 4);
+    }
+
+    blendPixels(spanPixels.data(), spanColors.data(), count);
+
+    for (uint32_t p = 0; p < count; p++)
+    {
+      std::memcpy(dst + p * step, &spanPixels[p], 4);
+    }
+  }
+
+  glm::vec2 SoftwareRenderer::toPixels(glm::vec2 ndc) const
+  {
+    return (ndc + 1.0f) * 0.5f * glm::vec2(size);
+  }
+}
@@ -0,0 +1,89 @@
+#ifndef RAYCAST_SOFTWARE_RENDERER_HPP
+#define RAYCAST_SOFTWARE_RENDERER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/ext/vector_float2.hpp>
+#include <glm/ext/vector_float4.hpp>
+#include <glm/ext/vector_uint2.hpp>
+
+#include "drawcommand.hpp"
+
+namespace pf
+{
+  class RaycastCamera;
+
+  // Draws frames into a caller owned RGBA8 framebuffer without any graphics library
+  // Textures are sampled with nearest filtering and repeat outside [0, 1)
+  class SoftwareRenderer
+  {
+    public:
+      // Row-major, 4 bytes per pixel in RGBA order, rows are stride bytes apart
+      uint8_t* pixels = nullptr;
+      glm::uvec2 size = glm::uvec2(0);
+      uint32_t stride = 0;
+
+      SoftwareRenderer() = default;
+
+      // A rowStride of 0 means the rows are tightly packed
+      SoftwareRenderer(uint8_t* framebuffer, glm::uvec2 framebufferSize, uint32_t rowStride = 0);
+
+      void clear(const glm::vec4& color);
+
+      // Draws the commands in order
+      // Pixels that a later opaque wall covers are never shaded
+      void draw(const DrawCommand* commands, size_t count);
+
+      // Builds the camera's next frame and draws it
+      void render(RaycastCamera& camera);
+
+    private:
+      // The largest opaque rect drawn over each pixel column
+      struct Occluder
+      {
+        uint32_t command = 0;
+        int32_t top = 0;
+        int32_t bottom = 0;
+      };
+
+      void findOccluders(const DrawCommand* commands, size_t count);
+
+      void drawRect(const DrawCommand& command, uint32_t index);
+
+      void drawQuad(const DrawCommand& command, uint32_t index);
+
+      // Draws a quad with corners at different depths column by column, since
+      // the depth only changes across columns
+      void drawWallQuad(const DrawCommand& command, uint32_t index);
+
+      // The pixel columns a wall quad covers
+      void wallQuadColumns(const DrawCommand& command, int32_t& left, int32_t& right) const;
+
+      // The pixel rows a wall quad covers in column x, and the texture coordinate
+      // at the first of them and its step per row
+      // Shared by drawing and occlusion, so both agree on every pixel
+      void wallQuadRows(const DrawCommand& command, int32_t x, int32_t& top, int32_t& bottom, glm::vec2& texStart, glm::vec2& texStep) const;
+
+      static bool isWallQuad(const DrawCommand& command);
+
+      // Shades count pixels from (x, y) along the row or column, skipping occluded runs
+      // The texture coordinate starts at texPos and moves texStep per pixel
+      void shadeSpan(const DrawCommand& command, uint32_t index, int32_t x, int32_t y, bool vertical, uint32_t count, glm::vec2 texPos, glm::vec2 texStep);
+
+      // Fills spanColors with the command's color or texels along a span
+      void fetchSpan(const DrawCommand& command, glm::vec2 texPos, glm::vec2 texStep, uint32_t count);
+
+      // Blends spanColors over count pixels step bytes apart
+      void blendSpan(uint8_t* dst, ptrdiff_t step, uint32_t count);
+
+      glm::vec2 toPixels(glm::vec2 ndc) const;
+
+      std::vector<Occluder> occluders;
+      std::vector<uint32_t> spanColors;
+      std::vector<uint32_t> spanPixels;
+  };
+}
+
+#endif // RAYCAST_SOFTWARE_RENDERER_HPP
@@ -0,0 +1,124 @@
+#include <cstring>
+#include <vector>
+
+#include "check.hpp"
+#include "raycast.hpp"
+
+using namespace pf;
+using pf::test::check;
+
+static std::vector<DrawCommand> submitted;
+
+static void submit(const DrawCommand* commands, size_t count)
+{
+  submitted.assign(commands, commands + count);
+}
+
+static bool sameCommands(const std::vector<DrawCommand>& a, const std::vector<DrawCommand>& b)
+{
+  if (a.size() != b.size())
+  {
+    return false;
+  }
+  for (size_t c = 0; c < a.size(); c++)
+  {
+    if (a[c].type != b[c].type || !(a[c].tex == b[c].tex) || a[c].color != b[c].color ||
+        std::memcmp(a[c].pos, b[c].pos, sizeof(a[c].pos)) != 0 || std::memcmp(a[c].tPos, b[c].tPos, sizeof(a[c].tPos)) != 0 ||
+        std::memcmp(a[c].depth, b[c].depth, sizeof(a[c].depth)) != 0 || std::memcmp(&a[c].dis, &b[c].dis, sizeof(a[c].dis)) != 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void setUp(RaycastCamera& camera)
+{
+  Wall wall(Wall::Filled);
+  wall.colorData.push_back(Wall::ColorData());
+
+  camera.resizeWorld(glm::uvec2(32));
+  for (uint32_t y = 0; y < 32; y++)
+  {
+    for (uint32_t x = 0; x < 32; x++)
+    {
+      if (x == 0 || y == 0 || x == 31 || y == 31 || (x % 6 == 0 && y % 6 == 0))
+      {
+        camera.wall(glm::uvec2(x, y)) = wall;
+      }
+    }
+  }
+  camera.res = glm::uvec2(96, 64);
+  camera.pos = glm::vec3(15.5f, 20.3f, 0.5f);
+  camera.renderThreads = 3;
+  camera.drawBatch = submit;
+}
+
+int main()
+{
+  // Frames built ahead have to come out the same as frames built when
+  // submitted, one update() later, however the camera changes meanwhile
+  RaycastCamera sync, async;
+  setUp(sync);
+  setUp(async);
+  async.asyncFrames = true;
+
+  uint8_t pixels[4 * 4 * 4] = {};
+  Texture spriteTex{4, 4, 4, pixels};
+  Wall wall(Wall::Filled);
+  wall.colorData.push_back(Wall::ColorData());
+
+  std::vector<DrawCommand> lastSync;
+  for (uint32_t frame = 0; frame < 30; frame++)
+  {
+    for (RaycastCamera* camera: {&sync, &async})
+    {
+      camera->rotate(0.05f);
+      camera->pos.x += 0.03f;
+      camera->sprite(spriteTex, glm::vec3(camera->pos.x + 2.0f, camera->pos.y - 3.0f, 0.5f), glm::vec2(0.5f));
+      if (frame == 10)
+      {
+        camera->wall(glm::uvec2(17, 14)) = wall;
+      }
+    }
+
+    submitted.clear();
+    async.update();
+    if (frame == 0)
+    {
+      check(submitted.empty(), "first async update() submitted a frame");
+    } else
+    {
+      check(sameCommands(submitted, lastSync), "async frame differs from the sync one");
+    }
+
+    submitted.clear();
+    sync.update();
+    lastSync = submitted;
+
+    // A jump while the async frame is in flight, which lasts through the next
+    // update(), whose frame has to match lastSync from before it all the same
+    for (RaycastCamera* camera: {&sync, &async})
+    {
+      camera->rotate(1.3f);
+      camera->pos.y += frame % 2 ? 3.0f : -3.0f;
+    }
+  }
+
+  // beginFrame() and buildFrame() without asyncFrames, after taking the frame
+  // the last update() began
+  async.asyncFrames = false;
+  async.buildFrame();
+  async.beginFrame();
+
+  // A copy waits for the frame in flight and starts out without one, so it
+  // builds its own from the same settings
+  RaycastCamera copy = async;
+  async.pos.x += 5.0f;
+  std::vector<DrawCommand> begun = async.buildFrame();
+  std::vector<DrawCommand> syncFrame = sync.buildFrame();
+  check(sameCommands(begun, syncFrame), "begun frame differs from the sync one");
+  check(sameCommands(copy.buildFrame(), syncFrame), "copied camera's frame differs from the sync one");
+
+  return pf::test::failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,55 @@
+#ifndef RAYCAST_TESTS_CHECK_HPP
+#define RAYCAST_TESTS_CHECK_HPP
+
+#include <cstdio>
+#include <cstring>
+
+#include "raycaster.hpp"
+
+namespace pf
+{
+  namespace test
+  {
+    inline int failures = 0;
+
+    // Prints what failed and carries on, so one run reports everything
+    inline void check(bool passed, const char* what)
+    {
+      if (!passed)
+      {
+        std::printf("FAILED: %s\n", what);
+        failures++;
+      }
+    }
+
+    // Bit for bit, since the fast paths promise the same arithmetic
+    // Hits may come from copies of a world, so tiles are compared by what's in them
+    inline bool sameHit(const RayCastData& a, const RayCastData& b)
+    {
+      if (!a.tileHit != !b.tileHit || (a.tileHit && !(*a.tileHit == *b.tileHit)) || a.verticalHit != b.verticalHit || a.tileHitPos != b.tileHitPos ||
+          std::memcmp(&a.hitPos, &b.hitPos, sizeof(a.hitPos)) != 0 || std::memcmp(&a.dis, &b.dis, sizeof(a.dis)) != 0)
+      {
+        return false;
+      }
+      return !a.tileHit || (a.surfaceHit == b.surfaceHit && std::memcmp(&a.texCoord, &b.texCoord, sizeof(a.texCoord)) == 0);
+    }
+
+    inline bool sameHits(const RayCastData* a, uint32_t countA, const RayCastData* b, uint32_t countB)
+    {
+      if (countA != countB)
+      {
+        return false;
+      }
+      for (uint32_t hit = 0; hit < countA; hit++)
+      {
+        if (!sameHit(a[hit], b[hit]))
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+  }
+}
+
+#endif // RAYCAST_TESTS_CHECK_HPP
@@ -0,0 +1,67 @@
+#include <cmath>
+#include <random>
+
+#include "check.hpp"
+#include "world.hpp"
+
+using namespace pf;
+using pf::test::check;
+
+// Skipping empty space has to hit exactly what visiting every tile hits,
+// on worlds whose sides aren't a multiple of the block size too
+static void compareSkipping(const World& world, std::mt19937& rng, uint32_t rays)
+{
+  glm::vec2 low = glm::vec2(world.origin()) - 20.0f;
+  glm::vec2 high = glm::vec2(world.origin()) + glm::vec2(world.size()) + 20.0f;
+  std::uniform_real_distribution<float> x(low.x, high.x);
+  std::uniform_real_distribution<float> y(low.y, high.y);
+  std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+
+  RayCaster plain(world, 200, false);
+  RayCaster skipping(world, 200, true);
+  RayCastData plainHits[16], skippingHits[16];
+  for (uint32_t ray = 0; ray < rays; ray++)
+  {
+    glm::vec2 start(x(rng), y(rng));
+    float a = angle(rng);
+    glm::vec2 dir(std::cos(a), std::sin(a));
+
+    uint32_t plainCount = plain.castHits(start, dir, plainHits, 16);
+    uint32_t skippingCount = skipping.castHits(start, dir, skippingHits, 16);
+    check(pf::test::sameHits(plainHits, plainCount, skippingHits, skippingCount), "skipping empty space changes the hits");
+  }
+}
+
+int main()
+{
+  Wall solid(Wall::Filled);
+  solid.colorData.push_back(Wall::ColorData());
+
+  // The block holding tile (9, 3) sticks out of the grid, and a ray entering
+  // it from outside must still stop at the tile
+  World edge;
+  edge.resize(glm::uvec2(10));
+  edge.setWall(glm::uvec2(9, 3), solid);
+  edge.commit();
+  RayCastData hit;
+  check(RayCaster(edge, 100, true).castHits(glm::vec2(12.5f, 3.5f), glm::vec2(-1.0f, 0.01f), &hit, 1) == 1 &&
+        hit.tileHitPos == glm::ivec2(9, 3), "ray from outside misses a tile on the edge");
+
+  std::mt19937 rng(1);
+  World world;
+  world.resize(glm::uvec2(37, 29), glm::ivec2(-5, 3));
+  for (uint32_t tile = 0; tile < 60; tile++)
+  {
+    world.setWall(glm::uvec2(rng() % 37, rng() % 29), solid);
+  }
+  // Tiles on the last row and column, in the blocks sticking out of the grid
+  for (uint32_t tile = 0; tile < 6; tile++)
+  {
+    world.setWall(glm::uvec2(36, rng() % 29), solid);
+    world.setWall(glm::uvec2(rng() % 37, 28), solid);
+  }
+  world.commit();
+  compareSkipping(world, rng, 20000);
+
+  return pf::test::failures == 0 ? 0 : 1;
+}
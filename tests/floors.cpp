@@ -0,0 +1,49 @@
+#include <cstdint>
+#include <vector>
+
+#include "check.hpp"
+#include "raycast.hpp"
+#include "softwarerenderer.hpp"
+
+using namespace pf;
+using pf::test::check;
+
+int main()
+{
+  // Textured floors are drawn as spans that end at the walls in each column
+  uint8_t red[3] = {255, 0, 0};
+  RaycastCamera camera;
+  camera.resizeWorld(glm::uvec2(16));
+  camera.floorImg = Texture{1, 1, 3, red};
+  camera.floorColor = glm::vec4(1.0f);
+
+  // A row of glass with nothing behind it, so it's the last hit of every column
+  Wall glass(Wall::Filled);
+  Wall::ColorData tint;
+  tint.color = glm::vec4(0.0f, 0.0f, 1.0f, 0.5f);
+  glass.colorData.push_back(tint);
+  for (uint32_t x = 0; x < 16; x++)
+  {
+    camera.wall(glm::uvec2(x, 6)) = glass;
+  }
+
+  glm::uvec2 res(64, 48);
+  camera.res = res;
+  camera.pos = glm::vec3(8.5f, 12.5f, 0.5f);
+  camera.renderDistance = 32;
+
+  std::vector<uint8_t> framebuffer(res.x * res.y * 4);
+  SoftwareRenderer renderer(framebuffer.data(), res);
+  renderer.clear(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+  renderer.render(camera);
+
+  // The floor carries on behind the glass up to the horizon
+  bool floorBehindGlass = true;
+  for (uint32_t y = res.y / 2 + 1; y < res.y; y++)
+  {
+    floorBehindGlass &= framebuffer[(y * res.x + res.x / 2) * 4] > 0;
+  }
+  check(floorBehindGlass, "floor stops at glass");
+
+  return pf::test::failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,252 @@
+#include <cmath>
+#include <random>
+
+#include <glm/ext/vector_double2.hpp>
+
+#include "check.hpp"
+#include "simd.hpp"
+#include "world.hpp"
+
+using namespace pf;
+using pf::test::check;
+
+static const uint32_t maxHits = 16;
+static const uint32_t renderDistance = 200;
+
+static Wall solid(float alpha, float reflection)
+{
+  Wall wall(Wall::Filled);
+  Wall::ColorData color;
+  color.color.a = alpha;
+  color.reflection = reflection;
+  wall.colorData.push_back(color);
+  return wall;
+}
+
+static Wall shape(Wall::FillState fillState, std::mt19937& rng)
+{
+  std::uniform_real_distribution<float> inTile(0.05f, 0.95f);
+  Wall wall(fillState);
+  wall.colorData.push_back(Wall::ColorData());
+  for (uint32_t p = 0; p < 4; p++)
+  {
+    wall.positionData.push_back(glm::vec2(inTile(rng), inTile(rng)));
+  }
+  return wall;
+}
+
+// A world whose committed tiles pick the kernel, with a shifted origin and
+// sides that aren't a multiple of the block size
+static World makeWorld(RayCaster::Kernel kernel, std::mt19937& rng)
+{
+  World world;
+  world.resize(glm::uvec2(45, 38), glm::ivec2(-64, 0));
+  bool shapes = kernel == RayCaster::ShapesOpaque || kernel == RayCaster::Full;
+  bool seeThrough = kernel == RayCaster::FilledSeeThrough || kernel == RayCaster::Full;
+  for (uint32_t tile = 0; tile < 150; tile++)
+  {
+    glm::uvec2 tilePos(rng() % 45, rng() % 38);
+    uint32_t kind = rng() % 6;
+    if (shapes && kind < 3)
+    {
+      world.setWall(tilePos, shape(Wall::FillState(Wall::Segments + kind), rng));
+    } else if (seeThrough && kind == 3)
+    {
+      world.setWall(tilePos, solid(0.5f, 0.0f));
+    } else if (seeThrough && kind == 4)
+    {
+      world.setWall(tilePos, solid(1.0f, 0.5f));
+    } else
+    {
+      world.setWall(tilePos, solid(1.0f, 0.0f));
+    }
+  }
+  world.commit();
+  return world;
+}
+
+static glm::vec2 randomOrigin(const World& world, std::mt19937& rng)
+{
+  // A third of the rays start outside the grid
+  glm::vec2 low = glm::vec2(world.origin()) - 30.0f;
+  glm::vec2 high = glm::vec2(world.origin()) + glm::vec2(world.size()) + 30.0f;
+  glm::vec2 origin;
+  do
+  {
+    origin = glm::vec2(std::uniform_real_distribution<float>(low.x, high.x)(rng), std::uniform_real_distribution<float>(low.y, high.y)(rng));
+  } while ((rng() % 3 == 0) == world.contains(glm::floor(origin)));
+  return origin;
+}
+
+static glm::vec2 randomDir(std::mt19937& rng)
+{
+  // Some rays run along an axis
+  float angle = std::uniform_real_distribution<float>(0.0f, 6.2831853f)(rng);
+  uint32_t kind = rng() % 16;
+  if (kind < 4)
+  {
+    angle = kind * 1.5707964f;
+  }
+  return glm::vec2(std::cos(angle), std::sin(angle));
+}
+
+// The specialized kernels, with and without skipping empty space, and the
+// packets all have to hit bit for bit what the general kernel visiting every
+// tile hits
+static void compareKernels(RayCaster::Kernel kernel, std::mt19937& rng)
+{
+  World world = makeWorld(kernel, rng);
+
+  // An uncommitted edit of an empty tile keeps the tiles as they are, but
+  // forces the general kernel
+  World general = world;
+  for (uint32_t tile = 0;; tile++)
+  {
+    if (general.fillState(tile) == Wall::Empty)
+    {
+      glm::ivec2 tilePos = general.tilePos(tile) - general.origin();
+      general.wall(glm::uvec2(tilePos));
+      break;
+    }
+  }
+
+  RayCaster reference(general, renderDistance, false);
+  RayCaster plain(world, renderDistance, false);
+  RayCaster skipping(world, renderDistance, true);
+  check(reference.getKernel() == RayCaster::Full, "edited world doesn't use the general kernel");
+  check(plain.getKernel() == kernel, "world picks the wrong kernel");
+
+  RayCastData referenceHits[maxHits], hits[maxHits];
+  RayCastData packetHits[simd::packetWidth * maxHits];
+  uint32_t packetCounts[simd::packetWidth];
+  glm::vec2 dirs[simd::packetWidth];
+  for (uint32_t packet = 0; packet < 1500; packet++)
+  {
+    glm::vec2 origin = randomOrigin(world, rng);
+    for (uint32_t lane = 0; lane < simd::packetWidth; lane++)
+    {
+      dirs[lane] = randomDir(rng);
+    }
+    skipping.castRayPacket(origin, dirs, packetHits, maxHits, packetCounts);
+
+    for (uint32_t lane = 0; lane < simd::packetWidth; lane++)
+    {
+      uint32_t referenceCount = reference.castHits(origin, dirs[lane], referenceHits, maxHits);
+      uint32_t count = plain.castHits(origin, dirs[lane], hits, maxHits);
+      check(pf::test::sameHits(referenceHits, referenceCount, hits, count), "specialized kernel differs from the general one");
+      count = skipping.castHits(origin, dirs[lane], hits, maxHits);
+      check(pf::test::sameHits(referenceHits, referenceCount, hits, count), "skipping empty space differs from the general kernel");
+      check(pf::test::sameHits(referenceHits, referenceCount, packetHits + lane * maxHits, packetCounts[lane]), "packet differs from the general kernel");
+    }
+  }
+}
+
+// The first hit of a ray by stepping through the tiles in double precision
+// and intersecting each edge exactly, which the floats have to stay close to
+static bool referenceHit(const World& world, glm::dvec2 origin, glm::dvec2 dir, glm::ivec2& hitTile, double& hitDis)
+{
+  glm::ivec2 tilePos = glm::ivec2(glm::floor(origin));
+  glm::ivec2 step(dir.x < 0.0 ? -1 : 1, dir.y < 0.0 ? -1 : 1);
+  glm::dvec2 tileDelta = glm::abs(1.0 / dir);
+  glm::dvec2 edgeDelta((dir.x < 0.0 ? origin.x - tilePos.x : tilePos.x + 1.0 - origin.x) * tileDelta.x,
+                       (dir.y < 0.0 ? origin.y - tilePos.y : tilePos.y + 1.0 - origin.y) * tileDelta.y);
+  for (uint32_t tile = 0; tile < renderDistance; tile++)
+  {
+    double enterDis;
+    if (edgeDelta.x < edgeDelta.y)
+    {
+      enterDis = edgeDelta.x;
+      edgeDelta.x += tileDelta.x;
+      tilePos.x += step.x;
+    } else
+    {
+      enterDis = edgeDelta.y;
+      edgeDelta.y += tileDelta.y;
+      tilePos.y += step.y;
+    }
+    if (!world.contains(tilePos))
+    {
+      continue;
+    }
+
+    uint32_t index = world.tileIndex(tilePos);
+    const Wall& material = world.material(index);
+    if (material.fillState == Wall::Filled)
+    {
+      hitTile = tilePos;
+      hitDis = enterDis;
+      return true;
+    } else if (material.fillState == Wall::Empty)
+    {
+      continue;
+    }
+
+    // Same pairing of positions as World::prepareEdges()
+    const std::vector<glm::vec2>& positions = material.positionData;
+    bool closed = material.fillState == Wall::Shape;
+    double closest = INFINITY;
+    for (uint32_t p = closed ? 0 : 1; p < positions.size(); p += material.fillState == Wall::Segments ? 2 : 1)
+    {
+      glm::dvec2 start = glm::dvec2(tilePos) + glm::dvec2(closed ? positions[p] : positions[p - 1]);
+      glm::dvec2 edge = glm::dvec2(tilePos) + glm::dvec2(closed ? positions[(p + 1) % positions.size()] : positions[p]) - start;
+      double denominator = dir.x * edge.y - dir.y * edge.x;
+      if (denominator == 0.0)
+      {
+        continue;
+      }
+      glm::dvec2 offset = start - origin;
+      double rayDis = (offset.x * edge.y - offset.y * edge.x) / denominator;
+      double along = (offset.x * dir.y - offset.y * dir.x) / denominator;
+      if (rayDis >= 0.0 && along >= 0.0 && along <= 1.0)
+      {
+        closest = rayDis < closest ? rayDis : closest;
+      }
+    }
+    if (closest != INFINITY)
+    {
+      hitTile = tilePos;
+      hitDis = closest;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void compareShapes(std::mt19937& rng)
+{
+  World world = makeWorld(RayCaster::ShapesOpaque, rng);
+  RayCaster caster(world, renderDistance);
+
+  uint32_t rays = 20000;
+  uint32_t differing = 0;
+  for (uint32_t ray = 0; ray < rays; ray++)
+  {
+    glm::vec2 origin = randomOrigin(world, rng);
+    glm::vec2 dir = randomDir(rng);
+    RayCastData hit;
+    bool hitWall = caster.castHits(origin, dir, &hit, 1) == 1 && hit.tileHit;
+
+    glm::ivec2 referenceTile;
+    double referenceDis;
+    bool referenceHitWall = referenceHit(world, glm::dvec2(origin), glm::dvec2(dir), referenceTile, referenceDis);
+    if (hitWall != referenceHitWall || (hitWall && (hit.tileHitPos != referenceTile || std::abs(hit.dis - referenceDis) > 1e-4)))
+    {
+      differing++;
+    }
+  }
+
+  // Rays grazing a corner of an edge may land either side of it in floats
+  check(differing * 1000 <= rays, "shape hits differ from the double precision reference");
+}
+
+int main()
+{
+  std::mt19937 rng(7);
+  compareKernels(RayCaster::FilledOpaque, rng);
+  compareKernels(RayCaster::ShapesOpaque, rng);
+  compareKernels(RayCaster::FilledSeeThrough, rng);
+  compareKernels(RayCaster::Full, rng);
+  compareShapes(rng);
+
+  return pf::test::failures == 0 ? 0 : 1;
+}
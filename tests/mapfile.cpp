@@ -0,0 +1,88 @@
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "check.hpp"
+#include "mapfile.hpp"
+#include "world.hpp"
+
+using namespace pf;
+using pf::test::check;
+
+static const char* mapPath = "raycast-test-mapfile.map";
+
+// Whether both worlds have the same tiles, occupancy and materials in use
+static bool sameWorld(const World& a, const World& b)
+{
+  if (a.size() != b.size() || a.origin() != b.origin() || a.materialCount() != b.materialCount())
+  {
+    return false;
+  }
+  for (uint32_t tile = 0; tile < a.size().x * a.size().y; tile++)
+  {
+    glm::ivec2 tilePos = a.tilePos(tile);
+    if (a.fillState(tile) != b.fillState(tile) || !(a.material(tile) == b.material(tile)) ||
+        a.occupied(tilePos) != b.occupied(tilePos) || a.emptyShift(tilePos) != b.emptyShift(tilePos))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main()
+{
+  std::mt19937 rng(3);
+  World world;
+  world.resize(glm::uvec2(37, 29), glm::ivec2(64, -128));
+  for (uint32_t tile = 0; tile < 80; tile++)
+  {
+    Wall wall(rng() % 2 ? Wall::Filled : Wall::Empty);
+    Wall::ColorData color;
+    color.color = glm::vec4(float(rng() % 4) / 4.0f, 0.5f, 0.5f, 1.0f);
+    wall.colorData.push_back(color);
+    world.setWall(glm::uvec2(rng() % 37, rng() % 29), wall);
+  }
+  world.commit();
+
+  std::vector<Texture> textures;
+  check(world.save(mapPath, textures), "save failed");
+
+  std::vector<uint64_t> bytes(1 << 16);
+  FILE* file = std::fopen(mapPath, "rb");
+  size_t size = file ? std::fread(bytes.data(), 1, bytes.size() * sizeof(uint64_t), file) : 0;
+  if (file)
+  {
+    std::fclose(file);
+  }
+  std::remove(mapPath);
+  uint8_t* data = reinterpret_cast<uint8_t*>(bytes.data());
+
+  MapFile map;
+  check(map.open(data, size), "saved map doesn't open");
+  MapHeader header = map.getHeader();
+  World loaded;
+  check(loaded.load(map, textures) && sameWorld(world, loaded), "loaded world differs");
+
+  // The world counts references and fills the masks itself, whatever the file says
+  MapMaterial* records = reinterpret_cast<MapMaterial*>(data + header.materials);
+  for (uint32_t m = 0; m < header.materialCount; m++)
+  {
+    records[m].refs = m == 0 ? header.size[0] * header.size[1] : 0;
+  }
+  std::fill(data + header.blockMask, data + header.blockMask + MapFile::blockMaskBytes(header.size[0], header.size[1]), 0);
+  std::fill(data + header.regionMask, data + header.regionMask + MapFile::regionMaskBytes(header.size[0], header.size[1]), 0);
+  check(map.open(data, size) && loaded.load(map, textures) && sameWorld(world, loaded), "references or masks taken from the file");
+
+  // A tile whose fill state isn't its material's
+  uint32_t* tileMaterials = reinterpret_cast<uint32_t*>(data + header.materialGrid);
+  uint32_t tile = 0;
+  while (records[tileMaterials[tile]].fillState != Wall::Empty)
+  {
+    tile++;
+  }
+  data[header.fillGrid + tile] = Wall::Filled;
+  check(!map.open(data, size), "fill state differing from the material accepted");
+
+  return pf::test::failures == 0 ? 0 : 1;
+}
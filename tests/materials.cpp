@@ -0,0 +1,59 @@
+#include "check.hpp"
+#include "world.hpp"
+
+using namespace pf;
+using pf::test::check;
+
+static Wall colored(float red)
+{
+  Wall wall(Wall::Filled);
+  Wall::ColorData color;
+  color.color.r = red;
+  wall.colorData.push_back(color);
+  return wall;
+}
+
+int main()
+{
+  // Editing every tile of a large world through wall() must leave a pool
+  // sized by the distinct materials, not by the tiles edited
+  const uint32_t side = 512;
+  World world;
+  world.resize(glm::uvec2(side));
+  Wall red = colored(1.0f), blue = colored(0.5f);
+  for (uint32_t y = 0; y < side; y++)
+  {
+    for (uint32_t x = 0; x < side; x++)
+    {
+      world.wall(glm::uvec2(x, y)) = (x + y) % 2 ? red : blue;
+    }
+  }
+
+  // Edits stay out of the grid until they're committed
+  check(world.fillState(0) == Wall::Empty && world.material(0) == Wall(), "uncommitted edit reached the grid");
+  check(world.wall(glm::uvec2(0)) == blue, "uncommitted edit doesn't read back");
+  check(world.materialSlots() == 1, "uncommitted edits took material slots");
+
+  world.commit();
+  check(world.materialCount() == 2, "bulk edit left the wrong number of materials");
+  check(world.materialSlots() <= 3, "bulk edit grew the material pool");
+  check(world.fillState(1) == Wall::Filled && world.material(1) == red, "bulk edit wasn't committed");
+
+  // Setting tiles to what they are, then all to one material, gives back the
+  // slot left free at the end
+  world.wall(glm::uvec2(0)) = blue;
+  world.commit();
+  check(world.materialSlots() <= 3, "unchanged edit grew the material pool");
+  for (uint32_t y = 0; y < side; y++)
+  {
+    for (uint32_t x = 0; x < side; x++)
+    {
+      world.wall(glm::uvec2(x, y)) = blue;
+    }
+  }
+  world.commit();
+  check(world.materialCount() == 1 && world.material(1) == blue, "second bulk edit left the wrong materials");
+  check(world.materialSlots() <= 2, "free slots at the end of the pool were kept");
+
+  return pf::test::failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#include "check.hpp"
+#include "raycast.hpp"
+
+using namespace pf;
+using pf::test::check;
+
+static size_t wallCommands = 0;
+
+// A wall along the first row of every chunk
+static bool loadChunk(glm::ivec2, PagedWorld::Chunk& chunk)
+{
+  Wall wall(Wall::Filled);
+  wall.colorData.push_back(Wall::ColorData());
+  chunk.palette = {Wall(), wall};
+  chunk.tiles.assign(PagedWorld::chunkSize * PagedWorld::chunkSize, 0);
+  std::fill(chunk.tiles.begin(), chunk.tiles.begin() + PagedWorld::chunkSize, 1);
+  return true;
+}
+
+// Walls that differ from chunk to chunk and tile to tile
+static bool loadPattern(glm::ivec2 chunkPos, PagedWorld::Chunk& chunk)
+{
+  chunk.palette.clear();
+  for (uint32_t wall = 0; wall < 3; wall++)
+  {
+    Wall colored(wall == 0 ? Wall::Empty : Wall::Filled);
+    Wall::ColorData color;
+    color.color.r = float(chunkPos.x & 15) / 16.0f;
+    color.color.g = float(chunkPos.y & 15) / 16.0f;
+    color.color.b = float(wall) / 4.0f;
+    colored.colorData.push_back(color);
+    chunk.palette.push_back(colored);
+  }
+  chunk.tiles.resize(PagedWorld::chunkSize * PagedWorld::chunkSize);
+  for (uint32_t tile = 0; tile < chunk.tiles.size(); tile++)
+  {
+    chunk.tiles[tile] = (tile * 7 + chunkPos.x * 3 + chunkPos.y) % 5 % 3;
+  }
+  return true;
+}
+
+static bool sameTiles(const World& a, const World& b)
+{
+  if (a.size() != b.size() || a.origin() != b.origin() || a.materialCount() != b.materialCount())
+  {
+    return false;
+  }
+  for (uint32_t tile = 0; tile < a.size().x * a.size().y; tile++)
+  {
+    glm::ivec2 tilePos = a.tilePos(tile);
+    if (a.fillState(tile) != b.fillState(tile) || !(a.material(tile) == b.material(tile)) ||
+        a.occupied(tilePos) != b.occupied(tilePos) || a.emptyShift(tilePos) != b.emptyShift(tilePos))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void countWalls(const DrawCommand* commands, size_t count)
+{
+  for (size_t c = 0; c < count; c++)
+  {
+    wallCommands += commands[c].dis > 0.0f && !std::isinf(commands[c].dis);
+  }
+}
+
+int main()
+{
+  // The paged world only covers the area around the camera, so tiles are
+  // looked up relative to its origin, nowhere near (0, 0)
+  RaycastCamera camera;
+  camera.pagedWorld = std::make_shared<PagedWorld>();
+  camera.pagedWorld->loadChunk = loadChunk;
+  camera.pagedWorld->loadsPerUpdate = 64;
+  camera.drawBatch = countWalls;
+  camera.res = glm::uvec2(64, 48);
+  camera.renderDistance = 128;
+  camera.pos = glm::vec3(5000.5f, 7000.5f, 0.5f);
+  camera.rotate(0.3f);
+  camera.update();
+
+  check(camera.getWorld().contains(glm::ivec2(5000, 7000)), "paged world doesn't cover the camera");
+  check(wallCommands > 0, "no walls drawn far from the origin");
+
+  // A world that moves along keeps the chunks it still covers, and has to end
+  // up the same as one filled where it ends up, edits included
+  PagedWorld moving, fresh;
+  moving.loadChunk = loadPattern;
+  fresh.loadChunk = loadPattern;
+  moving.loadsPerUpdate = 1000;
+  fresh.loadsPerUpdate = 1000;
+  moving.unloadedWall.fillState = Wall::Filled;
+  fresh.unloadedWall.fillState = Wall::Filled;
+  World movingWorld, freshWorld;
+  glm::vec2 focus(-300.5f, 200.5f);
+  moving.update(movingWorld, focus);
+  uint64_t firstId = movingWorld.id();
+  Wall edit(Wall::Filled);
+  edit.colorData.push_back(Wall::ColorData());
+  for (uint32_t step = 0; step < 6; step++)
+  {
+    focus += glm::vec2(70.0f, -45.0f);
+    moving.update(movingWorld, focus);
+    moving.setWall(glm::ivec2(glm::floor(focus)), edit);
+  }
+  moving.update(movingWorld, focus);
+  check(movingWorld.id() != firstId, "world didn't move along with the focus");
+
+  fresh.update(freshWorld, focus);
+  for (uint32_t step = 0; step < 6; step++)
+  {
+    fresh.setWall(glm::ivec2(glm::floor(glm::vec2(-300.5f, 200.5f) + glm::vec2(70.0f, -45.0f) * float(step + 1))), edit);
+  }
+  fresh.update(freshWorld, focus);
+  check(sameTiles(movingWorld, freshWorld), "moved world differs from a freshly filled one");
+
+  return pf::test::failures == 0 ? 0 : 1;
+}
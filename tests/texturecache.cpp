@@ -0,0 +1,48 @@
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "check.hpp"
+#include "texturecache.hpp"
+
+using namespace pf;
+using pf::test::check;
+
+int main()
+{
+  std::vector<uint8_t> pixels(16 * 16 * 4);
+  for (size_t p = 0; p < pixels.size(); p++)
+  {
+    pixels[p] = uint8_t(p * 7);
+  }
+
+  TextureCache cache;
+  Texture square{16, 16, 4, pixels.data()};
+  check(cache.levelCount(square) == 5, "16x16 doesn't have 5 levels");
+  const Texture& half = cache.level(square, 1);
+  check(half.width == 8 && half.height == 8 && half.channels == 4, "level 1 isn't 8x8");
+
+  // Texel (x, y) of a level is texel (y, x) of its column copy
+  const Texture& columns = cache.columns(square, 1);
+  check(columns.width == half.height && columns.height == half.width, "column copy isn't transposed");
+  check(std::memcmp(columns.data + (3 * columns.width + 5) * 4, half.data + (5 * half.width + 3) * 4, 4) == 0, "column copy texel moved");
+
+  // The same pixels seen with another size get a chain of their own, and the
+  // levels handed out for the old size stay as they were
+  std::vector<uint8_t> before(half.data, half.data + half.width * half.height * 4);
+  const uint8_t* halfData = half.data;
+  size_t bytes = cache.getBytes();
+  Texture wide{32, 8, 4, pixels.data()};
+  const Texture& wideHalf = cache.level(wide, 1);
+  check(wideHalf.width == 16 && wideHalf.height == 4, "level 1 of 32x8 isn't 16x4");
+  check(cache.level(square, 1).data == halfData && std::memcmp(halfData, before.data(), before.size()) == 0, "levels of the old size were rebuilt");
+  check(cache.getBytes() > bytes, "new size shares the old chain");
+
+  cache.forget(wide);
+  check(cache.getBytes() == bytes && cache.level(square, 1).data == halfData, "forgetting one size dropped the other");
+
+  cache.clear();
+  check(cache.getBytes() == 0, "clear() left bytes");
+
+  return pf::test::failures == 0 ? 0 : 1;
+}
@@ -11,6 +11,11 @@ namespace pf
     uint32_t height = 0;
     uint8_t channels = 0;
     const uint8_t* data = nullptr;
+
+    bool operator==(const Texture& other) const
+    {
+      return width == other.width && height == other.height && channels == other.channels && data == other.data;
+    }
   };
 }
 
@@ -0,0 +1,165 @@
+#include "texturecache.hpp"
+
+#include <cmath>
+
+namespace pf
+{
+  uint32_t TextureCache::levelCount(const Texture& tex)
+  {
+    if (!tex.data || tex.width == 0 || tex.height == 0 || tex.channels == 0)
+    {
+      return 1;
+    }
+    return chain(tex).levels.size();
+  }
+
+  const Texture& TextureCache::level(const Texture& tex, uint32_t mip)
+  {
+    if (mip == 0 || !tex.data || tex.width == 0 || tex.height == 0 || tex.channels == 0)
+    {
+      return tex;
+    }
+
+    const Chain& texChain = chain(tex);
+    return texChain.levels[mip < texChain.levels.size() ? mip : texChain.levels.size() - 1];
+  }
+
+  const Texture& TextureCache::columns(const Texture& tex, uint32_t mip)
+  {
+    if (!tex.data || tex.width == 0 || tex.height == 0 || tex.channels == 0)
+    {
+      return tex;
+    }
+
+    const Chain& texChain = chain(tex);
+    return texChain.columnLevels[mip < texChain.columnLevels.size() ? mip : texChain.columnLevels.size() - 1];
+  }
+
+  uint32_t TextureCache::pickLevel(const Texture& tex, float texelsPerPixel)
+  {
+    if (!(texelsPerPixel >= 2.0f))
+    {
+      return 0;
+    }
+    uint32_t count = levelCount(tex);
+    if (std::isinf(texelsPerPixel))
+    {
+      return count - 1;
+    }
+
+    // Each level halves the texels per pixel, so it's the whole part of log2
+    int exponent;
+    std::frexp(texelsPerPixel, &exponent);
+    return uint32_t(exponent - 1) < count ? exponent - 1 : count - 1;
+  }
+
+  void TextureCache::forget(const Texture& tex)
+  {
+    auto cached = chains.find(tex);
+    if (cached != chains.end())
+    {
+      bytes -= chainBytes(cached->second);
+      chains.erase(cached);
+    }
+  }
+
+  void TextureCache::clear()
+  {
+    chains.clear();
+    bytes = 0;
+  }
+
+  // private members
+  const TextureCache::Chain& TextureCache::chain(const Texture& tex)
+  {
+    auto cached = chains.find(tex);
+    if (cached != chains.end())
+    {
+      return cached->second;
+    }
+
+    Chain& texChain = chains[tex];
+
+    uint32_t count = 1;
+    for (uint32_t side = tex.width > tex.height ? tex.width : tex.height; side > 1; side = (side + 1) / 2)
+    {
+      count++;
+    }
+    texChain.levels.resize(count);
+    texChain.columnLevels.resize(count);
+    texChain.pixels.resize(count * 2 - 1);
+
+    texChain.levels[0] = tex;
+    for (uint32_t mip = 1; mip < count; mip++)
+    {
+      halve(texChain.levels[mip - 1], texChain.levels[mip], texChain.pixels[mip - 1]);
+    }
+    for (uint32_t mip = 0; mip < count; mip++)
+    {
+      transpose(texChain.levels[mip], texChain.columnLevels[mip], texChain.pixels[count - 1 + mip]);
+    }
+
+    bytes += chainBytes(texChain);
+    return texChain;
+  }
+
+  void TextureCache::halve(const Texture& from, Texture& to, std::vector<uint8_t>& pixels)
+  {
+    to.width = (from.width + 1) / 2;
+    to.height = (from.height + 1) / 2;
+    to.channels = from.channels;
+    pixels.resize(size_t(to.width) * to.height * to.channels);
+
+    // A box filter over each 2x2 block, repeating the last row or column of odd sides
+    uint32_t channels = from.channels;
+    for (uint32_t y = 0; y < to.height; y++)
+    {
+      const uint8_t* row1 = from.data + size_t(y * 2) * from.width * channels;
+      const uint8_t* row2 = from.data + size_t(y * 2 + 1 < from.height ? y * 2 + 1 : y * 2) * from.width * channels;
+      uint8_t* out = pixels.data() + size_t(y) * to.width * channels;
+      for (uint32_t x = 0; x < to.width; x++)
+      {
+        size_t left = size_t(x * 2) * channels;
+        size_t right = size_t(x * 2 + 1 < from.width ? x * 2 + 1 : x * 2) * channels;
+        for (uint32_t c = 0; c < channels; c++)
+        {
+          out[x * channels + c] = (row1[left + c] + row1[right + c] + row2[left + c] + row2[right + c] + 2) / 4;
+        }
+      }
+    }
+    to.data = pixels.data();
+  }
+
+  void TextureCache::transpose(const Texture& from, Texture& to, std::vector<uint8_t>& pixels)
+  {
+    to.width = from.height;
+    to.height = from.width;
+    to.channels = from.channels;
+    pixels.resize(size_t(to.width) * to.height * to.channels);
+
+    uint32_t channels = from.channels;
+    for (uint32_t y = 0; y < from.height; y++)
+    {
+      const uint8_t* row = from.data + size_t(y) * from.width * channels;
+      for (uint32_t x = 0; x < from.width; x++)
+      {
+        uint8_t* out = pixels.data() + (size_t(x) * from.height + y) * channels;
+        for (uint32_t c = 0; c < channels; c++)
+        {
+          out[c] = row[x * channels + c];
+        }
+      }
+    }
+    to.data = pixels.data();
+  }
+
+  size_t TextureCache::chainBytes(const Chain& chain)
+  {
+    size_t chainSize = 0;
+    for (const std::vector<uint8_t>& levelPixels: chain.pixels)
+    {
+      chainSize += levelPixels.capacity();
+    }
+    return chainSize;
+  }
+}
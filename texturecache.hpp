@@ -0,0 +1,82 @@
+#ifndef RAYCAST_TEXTURE_CACHE_HPP
+#define RAYCAST_TEXTURE_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "texture.hpp"
+
+namespace pf
+{
+  // Mip chains of textures, and copies of each level laid out column by column
+  // A texture's chain is built the first time it's asked for and kept until
+  // forget() or clear(), so textures whose pixels change in place have to be
+  // forgotten, and the levels handed out stay valid until then
+  // Textures are told apart by their data pointer and size, so a pointer that
+  // comes back with another size gets a chain of its own, and the levels built
+  // for the old size stay valid for the commands still using them
+  class TextureCache
+  {
+    public:
+      // Level 0 is the texture itself, each level after it halves both sides,
+      // rounding up, down to 1x1
+      uint32_t levelCount(const Texture& tex);
+
+      // Returns tex itself for level 0 and textures without data
+      // Levels past the last return the last
+      const Texture& level(const Texture& tex, uint32_t mip);
+
+      // The level transposed, a texture height texels wide and width texels
+      // high whose rows are the level's columns, so texel (x, y) of the level is
+      // texel (y, x) of the copy
+      // Walls are sampled down their columns, which this keeps next to each other
+      const Texture& columns(const Texture& tex, uint32_t mip);
+
+      // The level closest to one texel per pixel when texelsPerPixel texels of
+      // level 0 land on each pixel, rounding towards the sharper level
+      uint32_t pickLevel(const Texture& tex, float texelsPerPixel);
+
+      void forget(const Texture& tex);
+
+      void clear();
+
+      // Bytes held by the levels and copies, not counting the textures themselves
+      size_t getBytes() const
+      {
+        return bytes;
+      }
+
+    private:
+      struct Chain
+      {
+        std::vector<Texture> levels;
+        std::vector<Texture> columnLevels;
+        std::vector<std::vector<uint8_t>> pixels;
+      };
+
+      struct TextureHash
+      {
+        size_t operator()(const Texture& tex) const
+        {
+          return std::hash<const uint8_t*>()(tex.data) ^ ((size_t(tex.width) * 0x9e3779b1u + tex.height) * 31 + tex.channels);
+        }
+      };
+
+      // Builds the chain on first use
+      const Chain& chain(const Texture& tex);
+
+      static void halve(const Texture& from, Texture& to, std::vector<uint8_t>& pixels);
+
+      static void transpose(const Texture& from, Texture& to, std::vector<uint8_t>& pixels);
+
+      static size_t chainBytes(const Chain& chain);
+
+      std::unordered_map<Texture, Chain, TextureHash> chains;
+      size_t bytes = 0;
+  };
+}
+
+#endif // RAYCAST_TEXTURE_CACHE_HPP
@@ -38,13 +38,22 @@ namespace pf
         glm::vec4 color = glm::vec4(1.0);
         Texture texture;
         float reflection = 0.0f;
+
+        bool operator==(const ColorData& other) const
+        {
+          return color == other.color && texture == other.texture && reflection == other.reflection;
+        }
       };
 
       std::vector<ColorData> colorData;
       std::vector<glm::vec2> positionData;
+
+      // Drawn on the floor and ceiling of this tile instead of the camera's floorImg and ceilingImg when set
+      Texture floorImg;
+      Texture ceilingImg;
   
       // val = minStr + min(dis/maxDis, 1.0f) * (maxStr - minStr)
-      glm::vec3 fogColor;
+      glm::vec3 fogColor = glm::vec3(0.0f);
       float fogMinStrength = 0.0f;
       float fogMaxStrength = 0.0f;
       float fogMaxDistance = 0.0f;
@@ -53,6 +62,13 @@ namespace pf
       {
 
       }
+
+      bool operator==(const Wall& other) const
+      {
+        return fillState == other.fillState && colorData == other.colorData && positionData == other.positionData &&
+          floorImg == other.floorImg && ceilingImg == other.ceilingImg &&
+          fogColor == other.fogColor && fogMinStrength == other.fogMinStrength && fogMaxStrength == other.fogMaxStrength && fogMaxDistance == other.fogMaxDistance;
+      }
     private:
   };
 }
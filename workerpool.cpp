@@ -0,0 +1,169 @@
+#include "workerpool.hpp"
+
+namespace pf
+{
+  WorkerPool::WorkerPool(uint32_t threadCount) : threadCount{threadCount > 0 ? threadCount : 1}
+  {
+    ranges.reset(new TaskRange[this->threadCount]);
+
+    for (uint32_t t = 1; t < this->threadCount; t++)
+    {
+      threads.emplace_back(&WorkerPool::threadMain, this, t);
+    }
+  }
+
+  WorkerPool::~WorkerPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(stateMutex);
+      stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& thread: threads)
+    {
+      thread.join();
+    }
+  }
+
+  uint32_t WorkerPool::size() const
+  {
+    return threadCount;
+  }
+
+  void WorkerPool::run(uint32_t taskCount, const std::function<void(uint32_t, uint32_t)>& task)
+  {
+    if (taskCount == 0)
+    {
+      return;
+    }
+
+    // Only one frame can be in flight per pool
+    std::lock_guard<std::mutex> runLock(runMutex);
+
+    if (threadCount == 1 || taskCount == 1)
+    {
+      for (uint32_t t = 0; t < taskCount; t++)
+      {
+        task(t, 0);
+      }
+      return;
+    }
+
+    for (uint32_t t = 0; t < threadCount; t++)
+    {
+      ranges[t].next.store(uint64_t(taskCount) * t / threadCount, std::memory_order_relaxed);
+      ranges[t].end = uint64_t(taskCount) * (t+1) / threadCount;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(stateMutex);
+      currentTask = &task;
+      busyThreads = threadCount - 1;
+      generation++;
+    }
+    wake.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> lock(stateMutex);
+    done.wait(lock, [this]() { return busyThreads == 0; });
+    currentTask = nullptr;
+  }
+
+  void WorkerPool::work(uint32_t threadIndex)
+  {
+    // Drain our own range first, then steal from the others in order
+    for (uint32_t r = 0; r < threadCount; r++)
+    {
+      TaskRange& range = ranges[(threadIndex + r) % threadCount];
+
+      uint32_t t;
+      while ((t = range.next.fetch_add(1, std::memory_order_relaxed)) < range.end)
+      {
+        (*currentTask)(t, threadIndex);
+      }
+    }
+  }
+
+  void WorkerPool::threadMain(uint32_t threadIndex)
+  {
+    uint64_t seenGeneration = 0;
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(stateMutex);
+        wake.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+        if (stopping)
+        {
+          return;
+        }
+        seenGeneration = generation;
+      }
+
+      work(threadIndex);
+
+      {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        busyThreads--;
+      }
+      done.notify_one();
+    }
+  }
+
+  TaskThread::TaskThread() : thread{&TaskThread::threadMain, this}
+  {
+  }
+
+  TaskThread::~TaskThread()
+  {
+    {
+      std::unique_lock<std::mutex> lock(stateMutex);
+      done.wait(lock, [this]() { return !busy; });
+      stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+  }
+
+  void TaskThread::start(std::function<void()> task)
+  {
+    {
+      std::lock_guard<std::mutex> lock(stateMutex);
+      this->task = std::move(task);
+      busy = true;
+    }
+    wake.notify_one();
+  }
+
+  void TaskThread::wait()
+  {
+    std::unique_lock<std::mutex> lock(stateMutex);
+    done.wait(lock, [this]() { return !busy; });
+  }
+
+  // private members
+  void TaskThread::threadMain()
+  {
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(stateMutex);
+        wake.wait(lock, [this]() { return stopping || busy; });
+        if (stopping)
+        {
+          return;
+        }
+      }
+
+      task();
+
+      {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        task = nullptr;
+        busy = false;
+      }
+      done.notify_all();
+    }
+  }
+}
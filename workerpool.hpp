@@ -0,0 +1,98 @@
+#ifndef RAYCAST_WORKER_POOL_HPP
+#define RAYCAST_WORKER_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pf
+{
+  // Persistent pool of threads for splitting a frame into independent tasks
+  // Each thread starts on its own contiguous range of tasks and steals from the
+  // other ranges once it runs dry, so a few expensive tasks don't stall the rest
+  class WorkerPool
+  {
+    public:
+      // threadCount includes the thread calling run()
+      WorkerPool(uint32_t threadCount = std::thread::hardware_concurrency());
+
+      ~WorkerPool();
+
+      WorkerPool(const WorkerPool&) = delete;
+      WorkerPool& operator=(const WorkerPool&) = delete;
+
+      uint32_t size() const;
+
+      // Calls task(taskIndex, threadIndex) once for every taskIndex in [0, taskCount)
+      // and returns when all of them have finished
+      // threadIndex is in [0, size()), and is unique among concurrently running tasks
+      void run(uint32_t taskCount, const std::function<void(uint32_t, uint32_t)>& task);
+
+    private:
+      struct alignas(64) TaskRange
+      {
+        std::atomic<uint32_t> next{0};
+        uint32_t end = 0;
+      };
+
+      void work(uint32_t threadIndex);
+
+      void threadMain(uint32_t threadIndex);
+
+      std::vector<std::thread> threads;
+      std::unique_ptr<TaskRange[]> ranges;
+      uint32_t threadCount;
+
+      const std::function<void(uint32_t, uint32_t)>* currentTask = nullptr;
+
+      std::mutex runMutex;
+      std::mutex stateMutex;
+      std::condition_variable wake;
+      std::condition_variable done;
+      uint64_t generation = 0;
+      uint32_t busyThreads = 0;
+      bool stopping = false;
+  };
+
+  // A single thread of its own that runs one task at a time in the background,
+  // kept between tasks
+  class TaskThread
+  {
+    public:
+      TaskThread();
+
+      // Waits for the task, if any
+      ~TaskThread();
+
+      TaskThread(const TaskThread&) = delete;
+      TaskThread& operator=(const TaskThread&) = delete;
+
+      // Hands task to the thread and returns at once
+      // Note: Has to be waited for before the next start()
+      void start(std::function<void()> task);
+
+      // Returns when the task of the last start() has finished
+      void wait();
+
+    private:
+      void threadMain();
+
+      std::function<void()> task;
+
+      std::mutex stateMutex;
+      std::condition_variable wake;
+      std::condition_variable done;
+      bool busy = false;
+      bool stopping = false;
+
+      // Last, so it starts after everything it uses
+      std::thread thread;
+  };
+}
+
+#endif // RAYCAST_WORKER_POOL_HPP
@@ -0,0 +1,744 @@
+#include "world.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
+#include <glm/common.hpp>
+
+namespace pf
+{
+  namespace
+  {
+    std::atomic<uint64_t> nextWorldId{1};
+
+    void hashCombine(size_t& seed, size_t value)
+    {
+      seed ^= value + 0x9E3779B97F4A7C15ull + (seed << 6) + (seed >> 2);
+    }
+
+    void hashFloat(size_t& seed, float value)
+    {
+      // 0 and -0 compare equal, so they have to hash equal
+      hashCombine(seed, std::hash<float>()(value == 0.0f ? 0.0f : value));
+    }
+
+    size_t hashWall(const Wall& wall)
+    {
+      size_t seed = wall.fillState;
+      for (const Wall::ColorData& colorData: wall.colorData)
+      {
+        for (int c = 0; c < 4; c++)
+        {
+          hashFloat(seed, colorData.color[c]);
+        }
+        hashCombine(seed, std::hash<const void*>()(colorData.texture.data));
+        hashFloat(seed, colorData.reflection);
+      }
+      for (glm::vec2 position: wall.positionData)
+      {
+        hashFloat(seed, position.x);
+        hashFloat(seed, position.y);
+      }
+      hashCombine(seed, std::hash<const void*>()(wall.floorImg.data));
+      hashCombine(seed, std::hash<const void*>()(wall.ceilingImg.data));
+      for (int c = 0; c < 3; c++)
+      {
+        hashFloat(seed, wall.fogColor[c]);
+      }
+      hashFloat(seed, wall.fogMinStrength);
+      hashFloat(seed, wall.fogMaxStrength);
+      hashFloat(seed, wall.fogMaxDistance);
+      return seed;
+    }
+  }
+
+  World::World()
+  {
+    resize(glm::uvec2(0));
+  }
+
+  // Note: This function will invalidate the current contents of the world
+  void World::resize(glm::uvec2 newSize, glm::ivec2 newOrigin, const Wall& fill)
+  {
+    gridSize = newSize;
+    gridOrigin = newOrigin;
+    fillGrid.assign(newSize.x * newSize.y, fill.fillState);
+    materialGrid.assign(newSize.x * newSize.y, 0);
+
+    blocksSize = (newSize + (1u << blockShift) - 1u) >> blockShift;
+    regionsSize = (newSize + (1u << regionShift) - 1u) >> regionShift;
+    blockMask.assign(blocksSize.x * blocksSize.y, 0);
+    regionMask.assign(regionsSize.x * regionsSize.y, 0);
+    if (fill.fillState != Wall::Empty)
+    {
+      for (uint32_t tile = 0; tile < fillGrid.size(); tile++)
+      {
+        updateOccupancy(tile, fill.fillState);
+      }
+    }
+
+    materials.clear();
+    materialRefs.clear();
+    freeMaterials.clear();
+    materialLookup.clear();
+    materialEdges.clear();
+    shapeMaterials = 0;
+    seeThroughMaterials = 0;
+    editedTiles.clear();
+    editedWalls.clear();
+    tileFloors = fill.floorImg.data || fill.ceilingImg.data;
+
+    // Anything remembered from before can't be compared with the new world
+    changeLogStart += changeLog.size() + 1;
+    changeLog.clear();
+    worldId = nextWorldId++;
+
+    // Every tile starts out sharing the fill material
+    materials.push_back(fill);
+    materialRefs.push_back(newSize.x * newSize.y);
+    materialLookup.emplace(hashWall(materials[0]), 0);
+    materialEdges.push_back(prepareEdges(materials[0]));
+    countFeatures(materials[0], 1);
+  }
+
+  bool World::load(const MapFile& map, const std::vector<Texture>& textures)
+  {
+    if (!map.isOpen() || textures.size() < map.getHeader().textureCount)
+    {
+      return false;
+    }
+    const MapHeader& header = map.getHeader();
+
+    gridSize = glm::uvec2(header.size[0], header.size[1]);
+    gridOrigin = glm::ivec2(header.origin[0], header.origin[1]);
+    fillGrid.assign(map.fillGrid(), map.fillGrid() + gridSize.x * gridSize.y);
+    materialGrid.assign(map.materialGrid(), map.materialGrid() + gridSize.x * gridSize.y);
+
+    blocksSize = (gridSize + (1u << blockShift) - 1u) >> blockShift;
+    regionsSize = (gridSize + (1u << regionShift) - 1u) >> regionShift;
+    blockMask.assign(blocksSize.x * blocksSize.y, 0);
+    regionMask.assign(regionsSize.x * regionsSize.y, 0);
+
+    auto texture = [&](uint32_t index)
+    {
+      return index == MapFile::noTexture ? Texture() : textures[index];
+    };
+
+    materials.clear();
+    materialRefs.clear();
+    freeMaterials.clear();
+    materialLookup.clear();
+    materialEdges.clear();
+    shapeMaterials = 0;
+    seeThroughMaterials = 0;
+    editedTiles.clear();
+    editedWalls.clear();
+    tileFloors = false;
+    for (uint32_t m = 0; m < header.materialCount; m++)
+    {
+      const MapMaterial& record = map.materials()[m];
+      Wall material(Wall::FillState(record.fillState));
+      material.colorData.resize(record.colorCount);
+      for (uint32_t c = 0; c < record.colorCount; c++)
+      {
+        const MapColor& color = map.colors()[record.firstColor + c];
+        material.colorData[c].color = glm::vec4(color.color[0], color.color[1], color.color[2], color.color[3]);
+        material.colorData[c].texture = texture(color.texture);
+        material.colorData[c].reflection = color.reflection;
+      }
+      const float* positions = map.positions() + record.firstPosition * 2;
+      material.positionData.resize(record.positionCount);
+      for (uint32_t p = 0; p < record.positionCount; p++)
+      {
+        material.positionData[p] = glm::vec2(positions[p*2], positions[p*2 + 1]);
+      }
+      material.floorImg = texture(record.floorTexture);
+      material.ceilingImg = texture(record.ceilingTexture);
+      material.fogColor = glm::vec3(record.fogColor[0], record.fogColor[1], record.fogColor[2]);
+      material.fogMinStrength = record.fogMinStrength;
+      material.fogMaxStrength = record.fogMaxStrength;
+      material.fogMaxDistance = record.fogMaxDistance;
+
+      materials.push_back(std::move(material));
+      materialRefs.push_back(0);
+      materialEdges.emplace_back();
+    }
+
+    // The references and masks in the file are only what the writer said, so
+    // they're counted again from the grids, which the file checked against the materials
+    for (uint32_t tile = 0; tile < materialGrid.size(); tile++)
+    {
+      materialRefs[materialGrid[tile]]++;
+    }
+    countOccupancy();
+
+    for (uint32_t m = 0; m < header.materialCount; m++)
+    {
+      if (materialRefs[m] == 0)
+      {
+        freeMaterials.push_back(m);
+      } else
+      {
+        materialLookup.emplace(hashWall(materials[m]), m);
+        materialEdges[m] = prepareEdges(materials[m]);
+        countFeatures(materials[m], 1);
+        tileFloors = tileFloors || materials[m].floorImg.data || materials[m].ceilingImg.data;
+      }
+    }
+
+    // Anything remembered from before can't be compared with the new world
+    changeLogStart += changeLog.size() + 1;
+    changeLog.clear();
+    worldId = nextWorldId++;
+    return true;
+  }
+
+  bool World::save(const char* path, const std::vector<Texture>& textures) const
+  {
+    if (hasEdits())
+    {
+      return false;
+    }
+
+    bool missingTexture = false;
+    auto textureIndex = [&](const Texture& texture)
+    {
+      if (!texture.data)
+      {
+        return MapFile::noTexture;
+      }
+      for (uint32_t t = 0; t < textures.size(); t++)
+      {
+        if (textures[t] == texture)
+        {
+          return t;
+        }
+      }
+      missingTexture = true;
+      return MapFile::noTexture;
+    };
+
+    // Only materials in use are written, so the grid is renumbered
+    std::vector<uint32_t> renumbered(materials.size(), 0);
+    std::vector<MapMaterial> materialRecords;
+    std::vector<MapColor> colorRecords;
+    std::vector<float> positions;
+    for (uint32_t m = 0; m < materials.size(); m++)
+    {
+      if (materialRefs[m] == 0)
+      {
+        continue;
+      }
+      renumbered[m] = materialRecords.size();
+      materialRecords.emplace_back();
+
+      const Wall& material = materials[m];
+      MapMaterial& record = materialRecords.back();
+      record.fillState = material.fillState;
+      record.refs = materialRefs[m];
+      record.firstColor = colorRecords.size();
+      record.colorCount = material.colorData.size();
+      for (const Wall::ColorData& colorData: material.colorData)
+      {
+        MapColor color;
+        for (int c = 0; c < 4; c++)
+        {
+          color.color[c] = colorData.color[c];
+        }
+        color.reflection = colorData.reflection;
+        color.texture = textureIndex(colorData.texture);
+        colorRecords.push_back(color);
+      }
+      record.firstPosition = positions.size() / 2;
+      record.positionCount = material.positionData.size();
+      for (glm::vec2 position: material.positionData)
+      {
+        positions.push_back(position.x);
+        positions.push_back(position.y);
+      }
+      record.floorTexture = textureIndex(material.floorImg);
+      record.ceilingTexture = textureIndex(material.ceilingImg);
+      for (int c = 0; c < 3; c++)
+      {
+        record.fogColor[c] = material.fogColor[c];
+      }
+      record.fogMinStrength = material.fogMinStrength;
+      record.fogMaxStrength = material.fogMaxStrength;
+      record.fogMaxDistance = material.fogMaxDistance;
+    }
+    if (missingTexture)
+    {
+      return false;
+    }
+
+    std::vector<uint32_t> materialIndices(materialGrid.size());
+    for (size_t tile = 0; tile < materialGrid.size(); tile++)
+    {
+      materialIndices[tile] = renumbered[materialGrid[tile]];
+    }
+
+    std::vector<MapTexture> textureRecords(textures.size());
+    for (uint32_t t = 0; t < textures.size(); t++)
+    {
+      textureRecords[t] = MapTexture{textures[t].width, textures[t].height, textures[t].channels, 0};
+    }
+
+    MapHeader header = {};
+    std::memcpy(header.magic, MapFile::magic, sizeof(header.magic));
+    header.version = MapFile::version;
+    header.byteOrder = MapFile::byteOrderMark;
+    header.headerSize = sizeof(MapHeader);
+    header.origin[0] = gridOrigin.x;
+    header.origin[1] = gridOrigin.y;
+    header.size[0] = gridSize.x;
+    header.size[1] = gridSize.y;
+    header.materialCount = materialRecords.size();
+    header.colorCount = colorRecords.size();
+    header.positionCount = positions.size() / 2;
+    header.textureCount = textureRecords.size();
+
+    // Lay the sections out one after another, each 8 byte aligned
+    const void* sectionData[8] = {fillGrid.data(), materialIndices.data(), blockMask.data(), regionMask.data(),
+      materialRecords.data(), colorRecords.data(), positions.data(), textureRecords.data()};
+    uint64_t sectionBytes[8] = {fillGrid.size(), materialGrid.size() * sizeof(uint32_t), blockMask.size() * sizeof(uint64_t), regionMask.size() * sizeof(uint64_t),
+      materialRecords.size() * sizeof(MapMaterial), colorRecords.size() * sizeof(MapColor), positions.size() * sizeof(float), textureRecords.size() * sizeof(MapTexture)};
+    uint64_t* sectionOffsets[8] = {&header.fillGrid, &header.materialGrid, &header.blockMask, &header.regionMask,
+      &header.materials, &header.colors, &header.positions, &header.textures};
+    uint64_t offset = (sizeof(MapHeader) + 7) / 8 * 8;
+    for (int section = 0; section < 8; section++)
+    {
+      *sectionOffsets[section] = offset;
+      offset = (offset + sectionBytes[section] + 7) / 8 * 8;
+    }
+    header.fileSize = offset;
+
+    FILE* file = std::fopen(path, "wb");
+    if (!file)
+    {
+      return false;
+    }
+
+    const uint8_t padding[8] = {};
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+      std::fwrite(padding, 1, header.fillGrid - sizeof(header), file) == header.fillGrid - sizeof(header);
+    for (int section = 0; section < 8 && written; section++)
+    {
+      uint64_t padded = (sectionBytes[section] + 7) / 8 * 8;
+      // Empty sections may have no data to point at
+      written = (sectionBytes[section] == 0 || std::fwrite(sectionData[section], 1, sectionBytes[section], file) == sectionBytes[section]) &&
+        std::fwrite(padding, 1, padded - sectionBytes[section], file) == padded - sectionBytes[section];
+    }
+    return std::fclose(file) == 0 && written;
+  }
+
+  Wall& World::wall(glm::uvec2 wallPos)
+  {
+    uint32_t tile = wallPos.y*gridSize.x + wallPos.x;
+    auto edited = editedWalls.find(tile);
+    if (edited == editedWalls.end())
+    {
+      edited = editedWalls.emplace(tile, materials[materialGrid[tile]]).first;
+      editedTiles.push_back(tile);
+    }
+
+    return edited->second;
+  }
+
+  const Wall& World::wall(glm::uvec2 wallPos) const
+  {
+    static const Wall outside;
+    if (wallPos.x >= gridSize.x || wallPos.y >= gridSize.y)
+    {
+      return outside;
+    }
+    uint32_t tile = wallPos.y*gridSize.x + wallPos.x;
+    if (!editedWalls.empty())
+    {
+      auto edited = editedWalls.find(tile);
+      if (edited != editedWalls.end())
+      {
+        return edited->second;
+      }
+    }
+    return materials[materialGrid[tile]];
+  }
+
+  void World::setWall(glm::uvec2 wallPos, const Wall& newWall)
+  {
+    wall(wallPos) = newWall;
+  }
+
+  void World::setWalls(glm::uvec2 corner, glm::uvec2 size, const std::vector<Wall>& palette, const uint16_t* tiles)
+  {
+    // Each wall is interned once, and holds a reference of its own while the tiles are written
+    std::vector<uint32_t> paletteMaterials(palette.size());
+    for (size_t wall = 0; wall < palette.size(); wall++)
+    {
+      paletteMaterials[wall] = internMaterial(Wall(palette[wall]));
+    }
+
+    std::vector<uint32_t> changed;
+    for (uint32_t y = 0; y < size.y; y++)
+    {
+      for (uint32_t x = 0; x < size.x; x++)
+      {
+        uint32_t tile = (corner.y + y)*gridSize.x + corner.x + x;
+        uint32_t material = paletteMaterials[tiles ? tiles[y*size.x + x] : 0];
+        if (materialGrid[tile] == material)
+        {
+          continue;
+        }
+
+        materialRefs[material]++;
+        releaseMaterial(materialGrid[tile]);
+        materialGrid[tile] = material;
+        if (fillGrid[tile] != materials[material].fillState)
+        {
+          updateOccupancy(tile, materials[material].fillState);
+          fillGrid[tile] = materials[material].fillState;
+        }
+        tileFloors = tileFloors || materials[material].floorImg.data || materials[material].ceilingImg.data;
+        changed.push_back(tile);
+      }
+    }
+
+    for (uint32_t material: paletteMaterials)
+    {
+      releaseMaterial(material);
+    }
+    logChanges(changed);
+  }
+
+  void World::moveOrigin(glm::ivec2 newOrigin, const Wall& fill)
+  {
+    editedTiles.clear();
+    editedWalls.clear();
+
+    // Tiles the new grid doesn't cover let go of their materials, and those it
+    // newly covers share fill, which holds a reference of its own meanwhile
+    uint32_t fillMaterial = internMaterial(Wall(fill));
+    glm::ivec2 offset = newOrigin - gridOrigin;
+    std::vector<uint8_t> newFillGrid(fillGrid.size(), fill.fillState);
+    std::vector<uint32_t> newMaterialGrid(materialGrid.size(), fillMaterial);
+    uint32_t kept = 0;
+    for (uint32_t y = 0; y < gridSize.y; y++)
+    {
+      int32_t newY = int32_t(y) - offset.y;
+      if (newY < 0 || uint32_t(newY) >= gridSize.y)
+      {
+        for (uint32_t x = 0; x < gridSize.x; x++)
+        {
+          releaseMaterial(materialGrid[y*gridSize.x + x]);
+        }
+        continue;
+      }
+
+      // The part of the row both grids cover moves over as it is
+      uint32_t keptStart = glm::clamp<int32_t>(offset.x, 0, gridSize.x);
+      uint32_t keptEnd = glm::clamp<int32_t>(int32_t(gridSize.x) + offset.x, 0, gridSize.x);
+      for (uint32_t x = 0; x < gridSize.x; x++)
+      {
+        if (x < keptStart || x >= keptEnd)
+        {
+          releaseMaterial(materialGrid[y*gridSize.x + x]);
+        }
+      }
+      if (keptStart < keptEnd)
+      {
+        uint32_t from = y*gridSize.x + keptStart;
+        uint32_t to = newY*gridSize.x + (keptStart - offset.x);
+        std::copy(fillGrid.begin() + from, fillGrid.begin() + from + (keptEnd - keptStart), newFillGrid.begin() + to);
+        std::copy(materialGrid.begin() + from, materialGrid.begin() + from + (keptEnd - keptStart), newMaterialGrid.begin() + to);
+        kept += keptEnd - keptStart;
+      }
+    }
+    materialRefs[fillMaterial] += newMaterialGrid.size() - kept;
+    releaseMaterial(fillMaterial);
+    fillGrid.swap(newFillGrid);
+    materialGrid.swap(newMaterialGrid);
+    gridOrigin = newOrigin;
+    tileFloors = tileFloors || fill.floorImg.data || fill.ceilingImg.data;
+    countOccupancy();
+
+    // Every tile index means another tile now, like after resize()
+    changeLogStart += changeLog.size() + 1;
+    changeLog.clear();
+    worldId = nextWorldId++;
+  }
+
+  void World::commit()
+  {
+    for (uint32_t tile: editedTiles)
+    {
+      Wall& edited = editedWalls.find(tile)->second;
+      if (fillGrid[tile] != edited.fillState)
+      {
+        updateOccupancy(tile, edited.fillState);
+      }
+      fillGrid[tile] = edited.fillState;
+      tileFloors = tileFloors || edited.floorImg.data || edited.ceilingImg.data;
+      // Interned before the old material is released, so a tile set to what it
+      // already was keeps its slot
+      uint32_t material = internMaterial(std::move(edited));
+      releaseMaterial(materialGrid[tile]);
+      materialGrid[tile] = material;
+    }
+
+    // Free slots at the end of the pool are given back, the rest are reused
+    if (!freeMaterials.empty() && materialRefs.back() == 0)
+    {
+      while (!materialRefs.empty() && materialRefs.back() == 0)
+      {
+        materials.pop_back();
+        materialRefs.pop_back();
+        materialEdges.pop_back();
+      }
+      uint32_t slots = materials.size();
+      freeMaterials.erase(std::remove_if(freeMaterials.begin(), freeMaterials.end(), [slots](uint32_t material) { return material >= slots; }), freeMaterials.end());
+    }
+
+    logChanges(editedTiles);
+
+    if (editedTiles.size() > maxChangeLog)
+    {
+      // Memory for a bulk edit isn't kept around for the next few tiles
+      std::vector<uint32_t>().swap(editedTiles);
+      std::unordered_map<uint32_t, Wall>().swap(editedWalls);
+    } else
+    {
+      editedTiles.clear();
+      editedWalls.clear();
+    }
+  }
+
+  bool World::changesSince(uint64_t count, const uint32_t*& tiles, size_t& tileCount) const
+  {
+    if (count < changeLogStart || count > changeCount())
+    {
+      return false;
+    }
+
+    tiles = changeLog.data() + (count - changeLogStart);
+    tileCount = changeCount() - count;
+    return true;
+  }
+
+  bool World::catchUp(const World& source)
+  {
+    const uint32_t* tiles = nullptr;
+    size_t tileCount = 0;
+    if (source.worldId != worldId || source.gridSize != gridSize || source.gridOrigin != gridOrigin || hasEdits() || !source.changesSince(changeCount(), tiles, tileCount))
+    {
+      return false;
+    }
+
+    for (size_t t = 0; t < tileCount; t++)
+    {
+      setWall(glm::uvec2(tiles[t] % gridSize.x, tiles[t] / gridSize.x), source.material(tiles[t]));
+    }
+    commit();
+
+    // Take over source's log, so both count changes the same way from here on
+    changeLog = source.changeLog;
+    changeLogStart = source.changeLogStart;
+    return true;
+  }
+
+  // private members
+  void World::updateOccupancy(uint32_t tile, Wall::FillState newFillState)
+  {
+    glm::ivec2 tilePos(tile % gridSize.x, tile / gridSize.x);
+    uint32_t block = blockIndex(tilePos);
+    uint64_t tileBit = uint64_t(1) << blockBit(tilePos);
+    if (newFillState != Wall::Empty)
+    {
+      blockMask[block] |= tileBit;
+    } else
+    {
+      blockMask[block] &= ~tileBit;
+    }
+
+    glm::ivec2 blockPos = tilePos >> int(blockShift);
+    glm::ivec2 region = tilePos >> int(regionShift);
+    uint64_t blockBitInRegion = uint64_t(1) << ((blockPos.y & 7)*8 + (blockPos.x & 7));
+    if (blockMask[block] != 0)
+    {
+      regionMask[region.y*regionsSize.x + region.x] |= blockBitInRegion;
+    } else
+    {
+      regionMask[region.y*regionsSize.x + region.x] &= ~blockBitInRegion;
+    }
+  }
+
+  void World::countOccupancy()
+  {
+    std::fill(blockMask.begin(), blockMask.end(), 0);
+    std::fill(regionMask.begin(), regionMask.end(), 0);
+    for (uint32_t y = 0; y < gridSize.y; y++)
+    {
+      for (uint32_t x = 0; x < gridSize.x; x++)
+      {
+        if (fillGrid[y * gridSize.x + x] != Wall::Empty)
+        {
+          glm::ivec2 tilePos(x, y);
+          blockMask[blockIndex(tilePos)] |= uint64_t(1) << blockBit(tilePos);
+        }
+      }
+    }
+    for (uint32_t y = 0; y < blocksSize.y; y++)
+    {
+      for (uint32_t x = 0; x < blocksSize.x; x++)
+      {
+        if (blockMask[y * blocksSize.x + x] != 0)
+        {
+          regionMask[(y >> (regionShift - blockShift)) * regionsSize.x + (x >> (regionShift - blockShift))] |= uint64_t(1) << ((y & 7)*8 + (x & 7));
+        }
+      }
+    }
+  }
+
+  void World::logChanges(const std::vector<uint32_t>& tiles)
+  {
+    if (tiles.size() > maxChangeLog / 2)
+    {
+      // Too many to be worth remembering one by one
+      changeLogStart += changeLog.size() + tiles.size();
+      changeLog.clear();
+    } else
+    {
+      if (changeLog.size() + tiles.size() > maxChangeLog)
+      {
+        // Drop the older half at once, so trimming stays cheap
+        size_t dropped = changeLog.size() - maxChangeLog / 2;
+        changeLog.erase(changeLog.begin(), changeLog.begin() + dropped);
+        changeLogStart += dropped;
+      }
+      changeLog.insert(changeLog.end(), tiles.begin(), tiles.end());
+    }
+  }
+
+  uint32_t World::internMaterial(Wall&& newMaterial)
+  {
+    size_t hash = hashWall(newMaterial);
+
+    auto range = materialLookup.equal_range(hash);
+    for (auto match = range.first; match != range.second; match++)
+    {
+      if (materials[match->second] == newMaterial)
+      {
+        materialRefs[match->second]++;
+        return match->second;
+      }
+    }
+
+    uint32_t material;
+    if (!freeMaterials.empty())
+    {
+      material = freeMaterials.back();
+      freeMaterials.pop_back();
+      materials[material] = std::move(newMaterial);
+    } else
+    {
+      material = materials.size();
+      materials.push_back(std::move(newMaterial));
+      materialRefs.push_back(0);
+      materialEdges.emplace_back();
+    }
+    materialRefs[material] = 1;
+
+    materialLookup.emplace(hash, material);
+    materialEdges[material] = prepareEdges(materials[material]);
+    countFeatures(materials[material], 1);
+    return material;
+  }
+
+  void World::releaseMaterial(uint32_t material)
+  {
+    if (--materialRefs[material] > 0)
+    {
+      return;
+    }
+
+    auto range = materialLookup.equal_range(hashWall(materials[material]));
+    for (auto match = range.first; match != range.second; match++)
+    {
+      if (match->second == material)
+      {
+        materialLookup.erase(match);
+        break;
+      }
+    }
+    countFeatures(materials[material], -1);
+
+    materials[material] = Wall();
+    materialEdges[material].reset();
+    freeMaterials.push_back(material);
+  }
+
+  void World::countFeatures(const Wall& material, int32_t change)
+  {
+    if (material.fillState == Wall::Segments || material.fillState == Wall::Strip || material.fillState == Wall::Shape)
+    {
+      shapeMaterials += change;
+    }
+
+    for (const Wall::ColorData& colorData: material.colorData)
+    {
+      if (colorData.color.a < 1.0f || colorData.reflection > 0.0f)
+      {
+        seeThroughMaterials += change;
+        break;
+      }
+    }
+  }
+
+  std::shared_ptr<const World::TileEdges> World::prepareEdges(const Wall& material)
+  {
+    if (material.fillState != Wall::Segments && material.fillState != Wall::Strip && material.fillState != Wall::Shape)
+    {
+      return nullptr;
+    }
+
+    // Same pairing of positions as the walls are drawn with
+    std::vector<glm::vec2> starts;
+    std::vector<glm::vec2> ends;
+    const std::vector<glm::vec2>& positions = material.positionData;
+    for (uint32_t p = material.fillState != Wall::Shape ? 1 : 0; p < positions.size(); p += material.fillState != Wall::Segments ? 1 : 2)
+    {
+      if (material.fillState != Wall::Shape)
+      {
+        starts.push_back(positions[p-1]);
+        ends.push_back(positions[p]);
+      } else
+      {
+        starts.push_back(positions[p]);
+        ends.push_back(positions[(p+1) % positions.size()]);
+      }
+    }
+
+    std::shared_ptr<TileEdges> edges = std::make_shared<TileEdges>();
+    edges->edgeCount = starts.size();
+    edges->texCoordX.resize(starts.size());
+
+    uint32_t packetCount = (starts.size() + simd::packetWidth - 1) / simd::packetWidth;
+    edges->packets.assign(packetCount * simd::packetWidth * 4, 0.0f);
+    for (uint32_t e = 0; e < starts.size(); e++)
+    {
+      float* packet = edges->packets.data() + e / simd::packetWidth * simd::packetWidth * 4 + e % simd::packetWidth;
+      glm::vec2 dir = ends[e] - starts[e];
+      packet[0] = starts[e].x;
+      packet[simd::packetWidth] = starts[e].y;
+      packet[simd::packetWidth*2] = dir.x;
+      packet[simd::packetWidth*3] = dir.y;
+      edges->texCoordX[e] = glm::abs(dir.x) > glm::abs(dir.y);
+
+      edges->boundsMin = e == 0 ? glm::min(starts[e], ends[e]) : glm::min(edges->boundsMin, glm::min(starts[e], ends[e]));
+      edges->boundsMax = e == 0 ? glm::max(starts[e], ends[e]) : glm::max(edges->boundsMax, glm::max(starts[e], ends[e]));
+    }
+
+    return edges;
+  }
+}
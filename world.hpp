@@ -0,0 +1,302 @@
+#ifndef RAYCAST_WORLD_HPP
+#define RAYCAST_WORLD_HPP
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/ext/vector_float2.hpp>
+#include <glm/ext/vector_int2.hpp>
+#include <glm/ext/vector_uint2.hpp>
+
+#include "mapfile.hpp"
+#include "simd.hpp"
+#include "texture.hpp"
+#include "wall.hpp"
+
+namespace pf
+{
+  // Tile grid stored as structure of arrays
+  // Ray traversal only reads the one byte fill state of each tile, everything
+  // else lives in a pool of deduplicated materials shared between tiles
+  class World
+  {
+    public:
+      // The edges of a Segments, Strip or Shape material, laid out to be tested
+      // against a ray a packet at a time
+      // Positions are relative to the tile's corner like positionData
+      struct TileEdges
+      {
+        // Each packet is simd::packetWidth start x, start y, direction x and
+        // direction y values in turn, the last one is padded with edges without
+        // a direction that are never hit
+        std::vector<float> packets;
+        // Whether the texture runs along x on each edge, rather than along y
+        std::vector<uint8_t> texCoordX;
+        uint32_t edgeCount = 0;
+
+        // Bounds of all edges, rays missing them can't hit any
+        glm::vec2 boundsMin = glm::vec2(0.0f);
+        glm::vec2 boundsMax = glm::vec2(0.0f);
+      };
+
+      World();
+
+      // The grid covers newSize tiles from newOrigin on, each starting out as fill
+      // newOrigin has to be a multiple of 1 << regionShift
+      // Note: This function will invalidate the current contents of the world
+      void resize(glm::uvec2 newSize, glm::ivec2 newOrigin = glm::ivec2(0), const Wall& fill = Wall());
+
+      // Replaces the world with an open map, copying its grids and counting the
+      // material references and empty space masks again from them
+      // textures are those the map was saved with, in the same order
+      // Returns false and changes nothing when there are fewer of them than the map uses
+      // Note: This function will invalidate the current contents of the world like resize()
+      bool load(const MapFile& map, const std::vector<Texture>& textures);
+
+      // Writes the world to a map file, referring to its textures by their index in textures
+      // Returns false when it has uncommitted edits, uses a texture missing from
+      // textures, or the file can't be written
+      bool save(const char* path, const std::vector<Texture>& textures) const;
+
+      glm::uvec2 size() const
+      {
+        return gridSize;
+      }
+
+      // Position of the grid's first tile, tiles are addressed by their position
+      // in the world except by wall() and setWall(), which count from here
+      glm::ivec2 origin() const
+      {
+        return gridOrigin;
+      }
+
+      // Returns a copy of the tile kept aside until the next commit() folds it
+      // back into the grid, rays and material() see the tile as it was until then
+      // Note: The reference is only valid until that commit()
+      Wall& wall(glm::uvec2 wallPos);
+
+      // Tiles outside the grid read as an empty wall, edited tiles as they are
+      // after the next commit()
+      const Wall& wall(glm::uvec2 wallPos) const;
+
+      void setWall(glm::uvec2 wallPos, const Wall& newWall);
+
+      // Writes size tiles from corner on at once, as indices into palette row by
+      // row, or all palette[0] when tiles is nullptr
+      // Takes effect right away like setWall() and commit(), interning each wall
+      // of palette once, and tiles that already match are left alone
+      void setWalls(glm::uvec2 corner, glm::uvec2 size, const std::vector<Wall>& palette, const uint16_t* tiles);
+
+      // Moves the grid to newOrigin, keeping the tiles both cover and filling
+      // the rest with fill
+      // newOrigin has to be a multiple of 1 << regionShift
+      // Note: Uncommitted edits are dropped, and as tile indices change, the
+      // world gets a new id() like after resize()
+      void moveOrigin(glm::ivec2 newOrigin, const Wall& fill = Wall());
+
+      // Applies edits made through wall(), cheap when there are none
+      void commit();
+
+      bool hasEdits() const
+      {
+        return !editedTiles.empty();
+      }
+
+      // Whether any tile has had its own floor or ceiling texture since the last resize
+      bool hasTileFloors() const
+      {
+        return tileFloors;
+      }
+
+      // Whether any committed tile is made of segments, a strip or a shape
+      bool hasShapes() const
+      {
+        return shapeMaterials > 0;
+      }
+
+      // Whether any committed tile has a surface that is see through or reflective
+      bool hasSeeThrough() const
+      {
+        return seeThroughMaterials > 0;
+      }
+
+      // Number of tile edits committed since the world was created, resizing counts
+      // as one edit to every tile
+      uint64_t changeCount() const
+      {
+        return changeLogStart + changeLog.size();
+      }
+
+      // Points tiles at the indices of the tiles committed since changeCount() was count
+      // Returns false when they aren't all remembered anymore, every tile may have changed then
+      bool changesSince(uint64_t count, const uint32_t*& tiles, size_t& tileCount) const;
+
+      // Shared by a world and its copies, so change counts can be compared
+      // between them, and new after every resize
+      uint64_t id() const
+      {
+        return worldId;
+      }
+
+      // Brings an older copy of source up to date by applying the tiles source
+      // changed since, afterwards the change counts of both match
+      // Returns false and changes nothing when those tiles aren't known
+      bool catchUp(const World& source);
+
+      bool contains(glm::ivec2 tilePos) const
+      {
+        tilePos -= gridOrigin;
+        return tilePos.x >= 0 && uint32_t(tilePos.x) < gridSize.x && tilePos.y >= 0 && uint32_t(tilePos.y) < gridSize.y;
+      }
+
+      uint32_t tileIndex(glm::ivec2 tilePos) const
+      {
+        return (tilePos.y - gridOrigin.y) * gridSize.x + (tilePos.x - gridOrigin.x);
+      }
+
+      glm::ivec2 tilePos(uint32_t tile) const
+      {
+        return gridOrigin + glm::ivec2(tile % gridSize.x, tile / gridSize.x);
+      }
+
+      // Whether anything but an empty tile is at tilePos, tiles outside the world are empty
+      bool occupied(glm::ivec2 tilePos) const
+      {
+        if (!contains(tilePos))
+        {
+          return false;
+        }
+        tilePos -= gridOrigin;
+        return blockMask[blockIndex(tilePos)] >> blockBit(tilePos) & 1;
+      }
+
+      // Log2 of the size of the largest empty aligned square around tilePos
+      // that the acceleration grid knows of, 0 when the tile may be occupied
+      // Squares are regionShift or blockShift tiles wide, tiles outside the world are empty
+      uint32_t emptyShift(glm::ivec2 tilePos) const
+      {
+        tilePos -= gridOrigin;
+        glm::ivec2 region = tilePos >> int(regionShift);
+        if (region.x < 0 || uint32_t(region.x) >= regionsSize.x || region.y < 0 || uint32_t(region.y) >= regionsSize.y ||
+            regionMask[region.y*regionsSize.x + region.x] == 0)
+        {
+          return regionShift;
+        }
+
+        // Blocks on the far edges stick out of the grid, and the tiles of them
+        // outside it are only empty if the ones inside are
+        glm::ivec2 block = tilePos >> int(blockShift);
+        if (uint32_t(block.x) >= blocksSize.x || uint32_t(block.y) >= blocksSize.y || blockMask[blockIndex(tilePos)] == 0)
+        {
+          return blockShift;
+        }
+
+        return 0;
+      }
+
+      Wall::FillState fillState(uint32_t tile) const
+      {
+        return Wall::FillState(fillGrid[tile]);
+      }
+
+      const Wall& material(uint32_t tile) const
+      {
+        return materials[materialGrid[tile]];
+      }
+
+      // The prepared edges of a tile, nullptr unless it's made of segments,
+      // a strip or a shape
+      // Edges of tiles edited through wall() are those from before the edit until commit()
+      const TileEdges* edges(uint32_t tile) const
+      {
+        return materialEdges[materialGrid[tile]].get();
+      }
+
+      uint32_t materialCount() const
+      {
+        return materials.size() - freeMaterials.size();
+      }
+
+      // Slots in the material pool, used or free
+      uint32_t materialSlots() const
+      {
+        return materials.size();
+      }
+
+      // Tiles per side of the squares emptyShift() reports, as powers of 2
+      static constexpr uint32_t blockShift = 3;
+      static constexpr uint32_t regionShift = 6;
+
+    private:
+      // tilePos counts from the origin in these
+      uint32_t blockIndex(glm::ivec2 tilePos) const
+      {
+        return (tilePos.y >> blockShift)*blocksSize.x + (tilePos.x >> blockShift);
+      }
+
+      uint32_t blockBit(glm::ivec2 tilePos) const
+      {
+        return (tilePos.y & 7)*8 + (tilePos.x & 7);
+      }
+
+      // Keeps the occupancy masks in step with a tile's new fill state
+      void updateOccupancy(uint32_t tile, Wall::FillState newFillState);
+
+      // Sets the occupancy masks from the whole fill grid
+      void countOccupancy();
+
+      // Adds committed tiles to the change log
+      void logChanges(const std::vector<uint32_t>& tiles);
+
+      // Returns an existing identical material if there is one, otherwise adds
+      // it, either way with one more reference
+      uint32_t internMaterial(Wall&& newMaterial);
+
+      void releaseMaterial(uint32_t material);
+
+      // Keeps the feature counts in step with materials entering (1) or leaving (-1) the lookup
+      void countFeatures(const Wall& material, int32_t change);
+
+      static std::shared_ptr<const TileEdges> prepareEdges(const Wall& material);
+
+      glm::uvec2 gridSize = glm::uvec2(0);
+      glm::ivec2 gridOrigin = glm::ivec2(0);
+      std::vector<uint8_t> fillGrid;
+      std::vector<uint32_t> materialGrid;
+
+      // Empty space acceleration, one bit per tile in each 8x8 block and one
+      // bit per block in each 8x8 block region
+      glm::uvec2 blocksSize = glm::uvec2(0);
+      glm::uvec2 regionsSize = glm::uvec2(0);
+      std::vector<uint64_t> blockMask;
+      std::vector<uint64_t> regionMask;
+
+      // A deque, so hit records can point at materials while new ones are added
+      std::deque<Wall> materials;
+      std::vector<uint32_t> materialRefs;
+      std::vector<uint32_t> freeMaterials;
+      std::unordered_multimap<size_t, uint32_t> materialLookup;
+      // Prepared once when a material enters the lookup, and shared with copies of the world
+      std::vector<std::shared_ptr<const TileEdges>> materialEdges;
+      // Materials in the lookup using each feature
+      uint32_t shapeMaterials = 0;
+      uint32_t seeThroughMaterials = 0;
+
+      // Tiles handed out by wall() in the order they were first edited, and
+      // their walls, which stay out of the pool until commit()
+      std::vector<uint32_t> editedTiles;
+      std::unordered_map<uint32_t, Wall> editedWalls;
+      bool tileFloors = false;
+
+      // Most recent committed tiles, older ones are dropped past maxChangeLog
+      static constexpr size_t maxChangeLog = 1 << 16;
+      std::vector<uint32_t> changeLog;
+      uint64_t changeLogStart = 0;
+      uint64_t worldId = 0;
+  };
+}
+
+#endif // RAYCAST_WORLD_HPP